@@ -0,0 +1,780 @@
+/*-
+ *
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * ataidled keeps a set of devices open and applies requests sent to it
+ * over a Unix domain socket, so several programs can manage the same
+ * drives without each opening them and running the whole of ataidle.
+ *
+ * Each request is one line, as in a plan file,
+ *
+ *	device operation [value]
+ *
+ * with the operations of ataidle -f plus "status" and "identify", and is
+ * answered with one line,
+ *
+ *	device operation ok [result]
+ *	device operation error message
+ *
+ * Every device has a thread of its own which runs its requests in order,
+ * so commands for one device never overlap while different devices are
+ * worked on at the same time.  The main thread only accepts clients and
+ * queues their requests; a request identical to the last one queued for
+ * the device, and not yet started, is answered with that one's result.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+#include "mi/atadefs.h"
+#include "mi/atagen.h"
+#include "mi/cache.h"
+#include "mi/plan.h"
+#include "mi/sim.h"
+#include "mi/trace.h"
+#include "mi/util.h"
+
+#define ATAIDLED_SOCKET		"/var/run/ataidled.sock"
+#define ATAIDLED_LINE		1024
+#define ATAIDLED_RESULT		256
+/* answers kept for a client which isn't reading them before it is dropped */
+#define ATAIDLED_OUTMAX		65536
+
+/* operations which only the daemon has, alongside those of plan.c */
+#define OP_STATUS		't'
+#define OP_IDENTIFY		'y'
+
+/* operations which check the IDENTIFY data for support first */
+#define OPS_NEED_IDENT		"SoIAP"
+
+/* a client waiting for the result of a request */
+struct waiter
+{
+	struct waiter *	next;
+	unsigned long	client;
+};
+
+struct request
+{
+	struct request *	next;
+	struct device *		dev;
+	int			ch;
+	long			val;
+	char			name[16];	/* as the client gave it */
+	int			rc;
+	char			result[ATAIDLED_RESULT];
+	struct waiter *		waiters;
+};
+
+struct device
+{
+	const char *		name;
+	ATA *			ata;
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct request *	head;	/* in progress when busy */
+	struct request *	tail;
+	bool			busy;
+	bool			quit;
+};
+
+struct client
+{
+	int		fd;
+	unsigned long	id;
+	size_t		len;
+	char		buf[ATAIDLED_LINE];
+	char *		out;		/* answers not yet written */
+	size_t		outlen;
+	size_t		outsize;
+};
+
+/* finished requests, handed from the device threads to the main thread */
+static pthread_mutex_t donelock = PTHREAD_MUTEX_INITIALIZER;
+static struct request *done = NULL;
+static struct request *donetail = NULL;
+static int donepipe[2];
+
+static volatile sig_atomic_t quit = 0;
+
+static void	usage( void );
+static void	onsignal( int sig );
+static void *	device_thread( void *arg );
+static void	run_request( struct device *dev, struct request *req );
+static void	info_trim( char *s );
+static int	client_line( struct client *cl, char *line,
+		    struct device *devs, int ndevs );
+static void	client_drop( struct client *cl );
+static void	client_flush( struct client *cl );
+static void	client_reply( struct client *clients, int nclients,
+		    unsigned long id, const char *device, const char *op,
+		    int rc, const char *result );
+static int	listen_socket( const char *path );
+
+static void usage( void )
+{
+	printf( "ataidled version " ATAIDLE_VERSION "\n\n"
+			"usage: ataidled [-n] [-s socket] device ...\n\n"
+			"Options:\n"
+			"-n\t\tdon't use cached IDENTIFY data\n"
+			"-s\t\tthe socket to listen on, default "
+			ATAIDLED_SOCKET "\n"
+			"device\t\tthe device nodes to keep open\n\n");
+
+	exit(EX_USAGE);
+}
+
+static void onsignal( int sig )
+{
+	quit = 1;
+}
+
+/* run the requests of one device as they are queued */
+static void * device_thread( void *arg )
+{
+	struct device *dev = arg;
+	struct request *req;
+
+	for (;;) {
+		pthread_mutex_lock(&dev->lock);
+		while (dev->head == NULL && !dev->quit)
+			pthread_cond_wait(&dev->cond, &dev->lock);
+		if (dev->head == NULL) {
+			pthread_mutex_unlock(&dev->lock);
+			break;
+		}
+		req = dev->head;
+		dev->busy = true;
+		pthread_mutex_unlock(&dev->lock);
+
+		run_request(dev, req);
+
+		pthread_mutex_lock(&dev->lock);
+		dev->head = req->next;
+		if (dev->head == NULL)
+			dev->tail = NULL;
+		dev->busy = false;
+		pthread_mutex_unlock(&dev->lock);
+
+		pthread_mutex_lock(&donelock);
+		req->next = NULL;
+		if (donetail != NULL)
+			donetail->next = req;
+		else
+			done = req;
+		donetail = req;
+		pthread_mutex_unlock(&donelock);
+		if (write(donepipe[1], "", 1) == -1 && errno != EAGAIN)
+			break;
+	}
+
+	return NULL;
+}
+
+/* IDENTIFY strings are padded with spaces */
+static void info_trim( char *s )
+{
+	size_t len = strlen(s);
+
+	while (len > 0 && s[len - 1] == ' ')
+		s[--len] = '\0';
+}
+
+/* send a request to the drive, leaving the answer in req->result */
+static void run_request( struct device *dev, struct request *req )
+{
+	ATA *ata = dev->ata;
+	struct ata_ident ident;
+	struct ata_info info;
+	enum ata_power_mode mode;
+	const char *what = NULL;
+	int rc = 0;
+
+	req->result[0] = '\0';
+
+	if (strchr(OPS_NEED_IDENT, req->ch) != NULL) {
+		if (ata_getident(ata, &ident)) {
+			snprintf(req->result, sizeof(req->result),
+			    "identify failed: %s", strerror(errno));
+			req->rc = -1;
+			return;
+		}
+		if ((req->ch == 'A' &&
+		    !(ident.cmd_supp2 & ATA_AAM_SUPPORTED)) ||
+		    (req->ch == 'P' && !(ident.cmd_supp2 & ATA_APM_SUPPORTED)) ||
+		    (strchr("SoI", req->ch) != NULL &&
+		    !(ident.cmd_supp1 & ATA_PM_SUPPORTED))) {
+			snprintf(req->result, sizeof(req->result),
+			    "not supported by the device");
+			req->rc = -1;
+			return;
+		}
+	}
+
+	switch (req->ch) {
+		case 'S':
+			rc = ata_setstandbytimer(ata, req->val);
+			break;
+		case 's':
+			rc = ata_setstandbytimer(ata, ATA_IDLEVAL_IMMEDIATE);
+			break;
+		case 'I':
+			rc = ata_setidletimer(ata, req->val);
+			break;
+		case 'i':
+			rc = ata_setidletimer(ata, ATA_IDLEVAL_IMMEDIATE);
+			break;
+		case 'o':
+			rc = ata_sleep(ata);
+			break;
+		case 'A':
+			rc = ata_setacoustic(ata, req->val);
+			break;
+		case 'P':
+			rc = ata_setapm(ata, req->val);
+			break;
+
+		case 'c':
+		case OP_STATUS:
+			rc = ata_checkpowermode(ata, &mode);
+			/* a drive in sleep mode doesn't answer */
+			if (rc && errno == ETIMEDOUT) {
+				mode = ATA_POWER_SLEEP;
+				rc = 0;
+			}
+			if (rc) {
+				what = "check power mode failed";
+				break;
+			}
+			snprintf(req->result, sizeof(req->result), "%s",
+			    ata_powermodestring(mode));
+
+			/* only from the cache, IDENTIFY may spin the drive up */
+			if (req->ch == OP_STATUS &&
+			    ata_cache_getident(ata, &ident) == 0) {
+				ata_decodeident(&ident, &info);
+				snprintf(req->result + strlen(req->result),
+				    sizeof(req->result) - strlen(req->result),
+				    " apm=%d aam=%d", info.apm_enabled ?
+				    info.apm : 0, info.aam_enabled ? info.aam : 0);
+			}
+			break;
+
+		case OP_IDENTIFY:
+			rc = ata_getident_current(ata, &ident);
+			if (rc) {
+				what = "identify failed";
+				break;
+			}
+			ata_decodeident(&ident, &info);
+			info_trim(info.model);
+			info_trim(info.serial);
+			info_trim(info.firmware);
+			snprintf(req->result, sizeof(req->result),
+			    "model=\"%s\" serial=%s firmware=%s sectors=%lu "
+			    "pm=%d apm=%d aam=%d smart=%d", info.model,
+			    info.serial, info.firmware,
+			    (unsigned long) info.sectors, info.pm_supp,
+			    info.apm_supp ? (info.apm_enabled ? info.apm : 0) : -1,
+			    info.aam_supp ? (info.aam_enabled ? info.aam : 0) : -1,
+			    info.smart_supp ? info.smart_enabled : -1);
+			break;
+	}
+
+	if (rc && errno == EINVAL && what == NULL)
+		snprintf(req->result, sizeof(req->result), "invalid value");
+	else if (rc)
+		snprintf(req->result, sizeof(req->result), "%s%s%s",
+		    what != NULL ? what : "", what != NULL ? ": " : "",
+		    strerror(errno));
+	req->rc = rc;
+}
+
+static void client_drop( struct client *cl )
+{
+	if (cl->fd != -1)
+		close(cl->fd);
+	cl->fd = -1;
+	free(cl->out);
+	cl->out = NULL;
+	cl->outlen = cl->outsize = 0;
+}
+
+/* write as much of a client's pending answers as its socket takes */
+static void client_flush( struct client *cl )
+{
+	ssize_t n;
+
+	while (cl->fd != -1 && cl->outlen > 0) {
+		n = write(cl->fd, cl->out, cl->outlen);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (n <= 0) {
+			client_drop(cl);
+			return;
+		}
+		memmove(cl->out, cl->out + n, cl->outlen - n);
+		cl->outlen -= n;
+	}
+}
+
+/*
+ * Answer a client, if it hasn't gone away meanwhile.  What its socket
+ * doesn't take now is kept until poll() says it can be written.
+ */
+static void client_reply( struct client *clients, int nclients,
+		unsigned long id, const char *device, const char *op,
+		int rc, const char *result )
+{
+	char line[ATAIDLED_LINE + ATAIDLED_RESULT];
+	struct client *cl;
+	size_t size;
+	char *out;
+	int len;
+	int i;
+
+	for (i = 0; i < nclients; i++)
+		if (clients[i].id == id && clients[i].fd != -1)
+			break;
+	if (i == nclients)
+		return;
+
+	len = snprintf(line, sizeof(line), "%s %s %s%s%s\n", device, op,
+	    rc ? "error" : "ok", result[0] != '\0' ? " " : "", result);
+	if (len >= (int) sizeof(line))
+		len = sizeof(line) - 1;
+
+	/* a client which doesn't read its answers is disconnected */
+	cl = &clients[i];
+	if (cl->outlen + len > ATAIDLED_OUTMAX) {
+		client_drop(cl);
+		return;
+	}
+	if (cl->outlen + len > cl->outsize) {
+		size = cl->outsize ? cl->outsize : sizeof(line);
+		while (size < cl->outlen + len)
+			size *= 2;
+		out = realloc(cl->out, size);
+		if (out == NULL) {
+			client_drop(cl);
+			return;
+		}
+		cl->out = out;
+		cl->outsize = size;
+	}
+	memcpy(cl->out + cl->outlen, line, len);
+	cl->outlen += len;
+
+	client_flush(cl);
+}
+
+/*
+ * Queue the request on a line from a client, or answer it straight away
+ * if it can't be run.  Returns -1 if the client should be dropped.
+ */
+static int client_line( struct client *cl, char *line, struct device *devs,
+		int ndevs )
+{
+	char *device, *opname, *value, *extra, *end;
+	struct request *req;
+	struct waiter *w;
+	struct device *dev;
+	bool hasval = false;
+	long val = 0;
+	int ch;
+	int i;
+
+	device = strtok(line, " \t\r\n");
+	opname = strtok(NULL, " \t\r\n");
+	value = strtok(NULL, " \t\r\n");
+	extra = strtok(NULL, " \t\r\n");
+	if (device == NULL)
+		return 0;
+	if (opname == NULL)
+		opname = "-";
+
+	for (dev = NULL, i = 0; i < ndevs; i++)
+		if (strcmp(devs[i].name, device) == 0)
+			dev = &devs[i];
+
+	if (strcmp(opname, "status") == 0)
+		ch = OP_STATUS;
+	else if (strcmp(opname, "identify") == 0)
+		ch = OP_IDENTIFY;
+	else
+		ch = plan_opchar(opname, &hasval);
+
+	if (hasval && value != NULL) {
+		errno = 0;
+		val = strtol(value, &end, 10);
+		if (errno || *end != '\0' || val < 0)
+			value = NULL;
+	}
+
+	if (dev == NULL)
+		client_reply(cl, 1, cl->id, device, opname, -1,
+		    "unknown device");
+	else if (ch == 0)
+		client_reply(cl, 1, cl->id, device, opname, -1,
+		    "unknown operation");
+	else if ((hasval && value == NULL) || (!hasval && value != NULL) ||
+	    extra != NULL)
+		client_reply(cl, 1, cl->id, device, opname, -1,
+		    hasval ? "needs a value" : "takes no value");
+	else {
+		w = malloc(sizeof(struct waiter));
+		if (w == NULL)
+			return -1;
+		w->client = cl->id;
+
+		pthread_mutex_lock(&dev->lock);
+		req = dev->tail;
+		if (req != NULL && !(req == dev->head && dev->busy) &&
+		    req->ch == ch && req->val == val &&
+		    strcmp(req->name, opname) == 0) {
+			w->next = req->waiters;
+			req->waiters = w;
+			pthread_mutex_unlock(&dev->lock);
+			return 0;
+		}
+		pthread_mutex_unlock(&dev->lock);
+
+		req = calloc(1, sizeof(struct request));
+		if (req == NULL) {
+			free(w);
+			return -1;
+		}
+		req->dev = dev;
+		req->ch = ch;
+		req->val = val;
+		snprintf(req->name, sizeof(req->name), "%s", opname);
+		w->next = NULL;
+		req->waiters = w;
+
+		pthread_mutex_lock(&dev->lock);
+		if (dev->tail != NULL)
+			dev->tail->next = req;
+		else
+			dev->head = req;
+		dev->tail = req;
+		pthread_cond_signal(&dev->cond);
+		pthread_mutex_unlock(&dev->lock);
+	}
+
+	return (cl->fd == -1) ? -1 : 0;
+}
+
+/*
+ * Create the socket, replacing one left behind by an earlier daemon, but
+ * not one which a running daemon still answers on.
+ */
+static int listen_socket( const char *path )
+{
+	struct sockaddr_un sun;
+	struct stat sb;
+	int fd;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *) &sun, sizeof(sun)) == 0) {
+		close(fd);
+		errno = EADDRINUSE;
+		return -1;
+	}
+	if (errno == ECONNREFUSED && lstat(path, &sb) == 0 &&
+	    S_ISSOCK(sb.st_mode))
+		unlink(path);
+
+	/* a failed connect() leaves the socket unusable on some systems */
+	close(fd);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+		return -1;
+
+	if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) ||
+	    chmod(path, 0660) || listen(fd, 64) ||
+	    fcntl(fd, F_SETFL, O_NONBLOCK)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int main( int argc, char **argv )
+{
+	const char *sockpath = ATAIDLED_SOCKET;
+	const char *cachedir = ATAIDLE_CACHEDIR;
+	struct device *devs;
+	struct client *clients = NULL;
+	struct pollfd *pfds = NULL;
+	sigset_t sigs, oldsigs;
+	unsigned long nextid = 1;
+	int nclients = 0;
+	int ndevs;
+	int lfd;
+	int ch;
+	int i;
+
+	while ((ch = getopt(argc, argv, "hns:")) != -1) {
+		switch (ch) {
+			case 'n':
+				cachedir = NULL;
+				break;
+			case 's':
+				sockpath = optarg;
+				break;
+			default:
+				usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0)
+		usage();
+
+	ndevs = argc;
+	devs = calloc(ndevs, sizeof(struct device));
+	if (devs == NULL)
+		err(EX_OSERR, NULL);
+
+	for (i = 0; i < ndevs; i++) {
+		struct stat sb;
+
+		devs[i].name = argv[i];
+		if (!sim_isdevice(argv[i]) && !trace_isreplay(argv[i]) &&
+		    (stat(argv[i], &sb) ||
+		    !(S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode))))
+			errx(EX_OSFILE, "%s isn't a device node", argv[i]);
+		if (ata_open(&devs[i].ata, argv[i]) <= 0)
+			err(EX_IOERR, "error opening %s", argv[i]);
+		devs[i].ata->cachedir = cachedir;
+	}
+
+	if (pipe(donepipe) || fcntl(donepipe[0], F_SETFL, O_NONBLOCK) ||
+	    fcntl(donepipe[1], F_SETFL, O_NONBLOCK))
+		err(EX_OSERR, "pipe");
+
+	lfd = listen_socket(sockpath);
+	if (lfd == -1)
+		err(EX_CANTCREAT, "%s", sockpath);
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, onsignal);
+	signal(SIGTERM, onsignal);
+
+	/*
+	 * the device threads inherit the mask, so the signals are only
+	 * delivered to this thread and interrupt its poll()
+	 */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &sigs, &oldsigs);
+	for (i = 0; i < ndevs; i++) {
+		pthread_mutex_init(&devs[i].lock, NULL);
+		pthread_cond_init(&devs[i].cond, NULL);
+		if (pthread_create(&devs[i].thread, NULL, device_thread,
+		    &devs[i]))
+			errx(EX_OSERR, "cannot start a thread for %s",
+			    devs[i].name);
+	}
+	pthread_sigmask(SIG_SETMASK, &oldsigs, NULL);
+
+	while (!quit) {
+		struct request *req;
+		int n = 0;
+
+		pfds = realloc(pfds, (nclients + 2) * sizeof(struct pollfd));
+		if (pfds == NULL)
+			err(EX_OSERR, NULL);
+		pfds[n].fd = lfd;
+		pfds[n++].events = POLLIN;
+		pfds[n].fd = donepipe[0];
+		pfds[n++].events = POLLIN;
+		for (i = 0; i < nclients; i++) {
+			pfds[n].fd = clients[i].fd;
+			pfds[n++].events = POLLIN |
+			    (clients[i].outlen > 0 ? POLLOUT : 0);
+		}
+
+		if (poll(pfds, n, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			err(EX_OSERR, "poll");
+		}
+
+		/* answer everyone waiting for a finished request */
+		if (pfds[1].revents) {
+			char drain[64];
+
+			while (read(donepipe[0], drain, sizeof(drain)) > 0)
+				;
+			pthread_mutex_lock(&donelock);
+			req = done;
+			done = donetail = NULL;
+			pthread_mutex_unlock(&donelock);
+
+			while (req != NULL) {
+				struct request *next = req->next;
+
+				while (req->waiters != NULL) {
+					struct waiter *w = req->waiters;
+
+					client_reply(clients, nclients, w->client,
+					    req->dev->name, req->name, req->rc,
+					    req->result);
+					req->waiters = w->next;
+					free(w);
+				}
+				free(req);
+				req = next;
+			}
+		}
+
+		for (i = 0; i < nclients; i++) {
+			struct client *cl = &clients[i];
+			char *nl;
+			ssize_t got;
+
+			if (cl->fd == -1 || pfds[i + 2].fd != cl->fd ||
+			    pfds[i + 2].revents == 0)
+				continue;
+
+			if (pfds[i + 2].revents & POLLOUT)
+				client_flush(cl);
+			if (cl->fd == -1 || (pfds[i + 2].revents & ~POLLOUT) == 0)
+				continue;
+
+			got = read(cl->fd, cl->buf + cl->len,
+			    sizeof(cl->buf) - cl->len);
+			if (got == -1 && (errno == EAGAIN || errno == EINTR))
+				continue;
+			if (got <= 0) {
+				client_drop(cl);
+				continue;
+			}
+			cl->len += got;
+
+			while (cl->fd != -1 &&
+			    (nl = memchr(cl->buf, '\n', cl->len)) != NULL) {
+				size_t used = nl - cl->buf + 1;
+
+				*nl = '\0';
+				if (client_line(cl, cl->buf, devs, ndevs)) {
+					client_drop(cl);
+					break;
+				}
+				memmove(cl->buf, cl->buf + used, cl->len - used);
+				cl->len -= used;
+			}
+
+			/* lines longer than the buffer aren't requests */
+			if (cl->fd != -1 && cl->len == sizeof(cl->buf))
+				client_drop(cl);
+		}
+
+		/* forget the clients which have gone */
+		for (i = 0, n = 0; i < nclients; i++)
+			if (clients[i].fd != -1)
+				clients[n++] = clients[i];
+		nclients = n;
+
+		if (pfds[0].revents) {
+			int fd;
+
+			while ((fd = accept(lfd, NULL, NULL)) != -1) {
+				struct client *cl;
+
+				cl = realloc(clients,
+				    (nclients + 1) * sizeof(struct client));
+				if (cl == NULL) {
+					close(fd);
+					break;
+				}
+				clients = cl;
+				cl = &clients[nclients++];
+				cl->fd = fd;
+				cl->id = nextid++;
+				cl->len = 0;
+				cl->out = NULL;
+				cl->outlen = cl->outsize = 0;
+				fcntl(fd, F_SETFL, O_NONBLOCK);
+			}
+		}
+	}
+
+	close(lfd);
+	unlink(sockpath);
+
+	for (i = 0; i < ndevs; i++) {
+		pthread_mutex_lock(&devs[i].lock);
+		devs[i].quit = true;
+		pthread_cond_signal(&devs[i].cond);
+		pthread_mutex_unlock(&devs[i].lock);
+	}
+	for (i = 0; i < ndevs; i++) {
+		pthread_join(devs[i].thread, NULL);
+		ata_close(&devs[i].ata);
+	}
+	for (i = 0; i < nclients; i++)
+		client_drop(&clients[i]);
+
+	free(clients);
+	free(pfds);
+	free(devs);
+
+	return 0;
+}
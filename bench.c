@@ -0,0 +1,394 @@
+/*-
+ *
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Benchmarks, run with "make bench".  Each result is printed as a line of
+ * JSON so runs can be compared by scripts: the microbenchmarks report the
+ * time per call, measured over batches of calls, and the end-to-end
+ * benchmarks report the latency of each command sent to simulated drives
+ * through the command queue.  All times are in nanoseconds.
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mi/atadefs.h"
+#include "mi/atagen.h"
+#include "mi/show.h"
+#include "mi/util.h"
+#ifdef __linux__
+#include "linux/sgio.h"
+#endif
+
+/* calls timed together, the clock is too coarse for a single call */
+#define BENCH_BATCH		1000
+#define BENCH_SAMPLES		1000
+#define BENCH_ROUNDS		100
+
+struct bench_e2e
+{
+	struct ata_queue *	queue;
+	uint64_t		start;
+	uint64_t *		samples;
+	int			nsamples;
+	int			errors;
+};
+
+static volatile uint32_t sink;
+
+static uint64_t	bench_now( void );
+static int	bench_cmp( const void *a, const void *b );
+static void	bench_report( const char *name, int devices,
+		    uint64_t *samples, int nsamples, int batch,
+		    uint64_t elapsed );
+static ATA *	bench_open( const char *device );
+static void	bench_getidleval( void );
+static void	bench_cdb( void );
+static void	bench_identstrings( void );
+static void	bench_byteswapdata( void );
+static void	bench_printident( void );
+static void	bench_e2e_done( ATA *ata, int rc, void *arg );
+static void	bench_e2e( int ndevices, const char *options, int rounds );
+
+/* nanoseconds since some unspecified starting point */
+static uint64_t bench_now( void )
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int bench_cmp( const void *a, const void *b )
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Print one result.  Each sample is the time taken by batch operations,
+ * elapsed is the wall clock time of the whole run.  The mean and the
+ * percentiles are of the samples; the wall clock time only gives the
+ * throughput, which with many commands in flight is not the latency.
+ */
+static void bench_report( const char *name, int devices,
+		uint64_t *samples, int nsamples, int batch, uint64_t elapsed )
+{
+	double ops = (double) nsamples * batch;
+	double total = 0;
+	int i;
+
+	for (i = 0; i < nsamples; i++)
+		total += samples[i];
+
+	qsort(samples, nsamples, sizeof(uint64_t), bench_cmp);
+
+	printf("{\"bench\":\"%s\",", name);
+	if (devices > 0)
+		printf("\"devices\":%d,", devices);
+	printf("\"ops\":%.0f,\"ops_per_sec\":%.0f,\"mean_ns\":%.1f,",
+	    ops, ops * 1e9 / elapsed, total / ops);
+	printf("\"p50_ns\":%.1f,\"p99_ns\":%.1f}\n",
+	    (double) samples[(nsamples - 1) * 50 / 100] / batch,
+	    (double) samples[(nsamples - 1) * 99 / 100] / batch);
+	fflush(stdout);
+}
+
+static ATA * bench_open( const char *device )
+{
+	ATA *ata;
+
+	if (ata_open( &ata, device ) <= 0)
+		err(EX_SOFTWARE, "%s", device);
+	return ata;
+}
+
+/* every timeout -I and -S accept */
+static void bench_getidleval( void )
+{
+	static const uint32_t mins[] = {
+		0, 1, 5, 10, 20, 21, 30, 60, 90, 120, 180, 240, 330,
+		ATA_IDLEVAL_IMMEDIATE
+	};
+	uint64_t samples[BENCH_SAMPLES];
+	uint64_t start = bench_now();
+	uint16_t val;
+	int i, j;
+
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t = bench_now();
+
+		for (j = 0; j < BENCH_BATCH; j++) {
+			ata_getidleval(mins[j % (sizeof(mins) / sizeof(mins[0]))],
+			    &val);
+			sink += val;
+		}
+		samples[i] = bench_now() - t;
+	}
+
+	bench_report("getidleval", 0, samples, BENCH_SAMPLES, BENCH_BATCH,
+	    bench_now() - start);
+}
+
+/* build the ATA PASS-THROUGH CDB and SG_IO header of CHECK POWER MODE */
+static void bench_cdb( void )
+{
+#ifdef __linux__
+	uint64_t samples[BENCH_SAMPLES];
+	uint64_t start;
+	union sat_cdb cdb;
+	struct sg_io_hdr io;
+	ATA *ata = bench_open("sim:cdb");
+	int i, j;
+
+	start = bench_now();
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t = bench_now();
+
+		for (j = 0; j < BENCH_BATCH; j++) {
+			ata_setataparams(ata, 0, 0);
+			ata->atacmd.cmd = ATA_CHECK_POWER_MODE;
+			sat_prepare_io(ata, &cdb, &io);
+			sink += cdb.sclong.command;
+		}
+		samples[i] = bench_now() - t;
+	}
+
+	bench_report("sat_cdb", 0, samples, BENCH_SAMPLES, BENCH_BATCH,
+	    bench_now() - start);
+	ata_close(&ata);
+#endif
+}
+
+/* fix up the strings of a raw IDENTIFY buffer, as ata_ident() does */
+static void bench_identstrings( void )
+{
+	uint64_t samples[BENCH_SAMPLES];
+	uint64_t start;
+	char raw[512];
+	char buf[512];
+	char *data;
+	ATA *ata = bench_open("sim:   padded");
+	int i, j;
+
+	/* the raw data, before ata_ident() tidies it up */
+	ata_setataparams(ata, 0, 0);
+	ata_setdataout_params(ata, &data, 512);
+	if (ata_cmd(ata, ATA__IDENTIFY, 0))
+		err(EX_SOFTWARE, "IDENTIFY");
+	memcpy(raw, data, 512);
+	ata_close(&ata);
+
+	start = bench_now();
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t = bench_now();
+
+		for (j = 0; j < BENCH_BATCH; j++) {
+			memcpy(buf, raw, 512);
+			byteswap( buf, 20, 39 );
+			byteswap( buf, 46, 52 );
+			byteswap( buf, 54, 92 );
+			strpack( buf, 20, 39 );
+			sink += buf[20];
+		}
+		samples[i] = bench_now() - t;
+	}
+
+	bench_report("ident_strings", 0, samples, BENCH_SAMPLES, BENCH_BATCH,
+	    bench_now() - start);
+}
+
+static void bench_byteswapdata( void )
+{
+	uint64_t samples[BENCH_SAMPLES];
+	uint64_t start;
+	int16_t buf[256];
+	int i, j;
+
+	for (i = 0; i < 256; i++)
+		buf[i] = i * 0x0101;
+
+	start = bench_now();
+	for (i = 0; i < BENCH_SAMPLES; i++) {
+		uint64_t t = bench_now();
+
+		for (j = 0; j < BENCH_BATCH; j++) {
+			byteswap_ata_data(buf);
+			sink += buf[j & 0xFF];
+		}
+		samples[i] = bench_now() - t;
+	}
+
+	bench_report("byteswap_ata_data", 0, samples, BENCH_SAMPLES,
+	    BENCH_BATCH, bench_now() - start);
+}
+
+/* decode and print IDENTIFY data, with the output thrown away */
+static void bench_printident( void )
+{
+	uint64_t samples[BENCH_SAMPLES / 10];
+	uint64_t start;
+	struct ata_ident ident;
+	ATA *ata = bench_open("sim:print,apm=128,aam=254");
+	int out;
+	int i, j;
+
+	if (ata_ident(ata, &ident))
+		err(EX_SOFTWARE, "IDENTIFY");
+	ata_close(&ata);
+
+	fflush(stdout);
+	out = dup(STDOUT_FILENO);
+	if (out == -1 || freopen("/dev/null", "w", stdout) == NULL)
+		err(EX_OSERR, "/dev/null");
+
+	start = bench_now();
+	for (i = 0; i < BENCH_SAMPLES / 10; i++) {
+		uint64_t t = bench_now();
+
+		for (j = 0; j < BENCH_BATCH; j++)
+			ata_printident(&ident);
+		fflush(stdout);
+		samples[i] = bench_now() - t;
+	}
+	start = bench_now() - start;
+
+	dup2(out, STDOUT_FILENO);
+	close(out);
+	clearerr(stdout);
+
+	bench_report("printident", 0, samples, BENCH_SAMPLES / 10, BENCH_BATCH,
+	    start);
+}
+
+static void bench_e2e_done( ATA *ata, int rc, void *arg )
+{
+	struct bench_e2e *e2e = arg;
+
+	e2e->samples[e2e->nsamples++] = bench_now() - e2e->start;
+	if (rc)
+		e2e->errors++;
+}
+
+/*
+ * Send CHECK POWER MODE to every device at once through the command
+ * queue, as "ataidle -c" does, and time each command from the start of
+ * its round until it completes.
+ */
+static void bench_e2e( int ndevices, const char *options, int rounds )
+{
+	struct bench_e2e e2e;
+	char device[64];
+	uint64_t start;
+	ATA **atas;
+	int i, j;
+
+	atas = calloc(ndevices, sizeof(ATA *));
+	e2e.samples = calloc((size_t) ndevices * rounds, sizeof(uint64_t));
+	e2e.queue = ata_queue_new();
+	if (atas == NULL || e2e.samples == NULL || e2e.queue == NULL)
+		err(EX_OSERR, NULL);
+	e2e.nsamples = 0;
+	e2e.errors = 0;
+
+	for (i = 0; i < ndevices; i++) {
+		snprintf(device, sizeof(device), "sim:bench%d%s", i, options);
+		atas[i] = bench_open(device);
+	}
+
+	start = bench_now();
+	for (i = 0; i < rounds; i++) {
+		e2e.start = bench_now();
+		for (j = 0; j < ndevices; j++) {
+			ata_setataparams(atas[j], 0, 0);
+			if (ata_queue_submit(e2e.queue, atas[j],
+			    ATA_CHECK_POWER_MODE, bench_e2e_done, &e2e))
+				err(EX_OSERR, NULL);
+		}
+		if (ata_queue_run(e2e.queue))
+			err(EX_OSERR, "ata_queue_run");
+	}
+	start = bench_now() - start;
+
+	if (e2e.errors)
+		errx(EX_SOFTWARE, "%d commands failed", e2e.errors);
+	bench_report("check_power_mode", ndevices, e2e.samples, e2e.nsamples,
+	    1, start);
+
+	ata_queue_free(e2e.queue);
+	for (i = 0; i < ndevices; i++)
+		ata_close(&atas[i]);
+	free(atas);
+	free(e2e.samples);
+}
+
+int main( int argc, char **argv )
+{
+	static const int ndevices[] = { 1, 10, 1000 };
+	char options[32] = "";
+	int rounds = BENCH_ROUNDS;
+	int ch;
+	int i;
+
+	while ((ch = getopt(argc, argv, "l:r:")) != -1) {
+		switch (ch) {
+		case 'l':
+			/* command latency of the simulated drives */
+			snprintf(options, sizeof(options), ",latency=%s", optarg);
+			break;
+		case 'r':
+			rounds = strtol(optarg, NULL, 10);
+			if (rounds < 1)
+				errx(EX_USAGE, "invalid number of rounds");
+			break;
+		default:
+			fprintf(stderr, "usage: ataidle_bench [-l latency_ms] "
+			    "[-r rounds]\n");
+			exit(EX_USAGE);
+		}
+	}
+
+	bench_getidleval();
+	bench_cdb();
+	bench_identstrings();
+	bench_byteswapdata();
+	bench_printident();
+
+	for (i = 0; i < (int) (sizeof(ndevices) / sizeof(ndevices[0])); i++)
+		bench_e2e(ndevices[i], options, rounds);
+
+	return 0;
+}
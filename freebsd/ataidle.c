@@ -32,25 +32,41 @@
 #include <string.h>
 #include <fcntl.h>
 #include <limits.h>
-#include <sysexits.h>
 #include <unistd.h>
-#include <err.h>
+#include <dirent.h>
 #include <errno.h>
 
 #include <camlib.h>
+#include <devstat.h>
 #include <cam/scsi/scsi_message.h>
 
 #include <sys/types.h>
 #include <sys/ata.h>
+#include <sys/disk.h>
 #include <sys/ioctl.h>
+#include <sys/sysctl.h>
+#include <sys/time.h>
 
 #include "ataidle.h"
 #include "../mi/atagen.h"
 #include "../mi/atadefs.h"
+#include "../mi/cache.h"
 #include "../mi/util.h"
+#include "../mi/sat.h"
+#include "../mi/sim.h"
+#include "../mi/stats.h"
+#include "../mi/trace.h"
 
 static const char * const scsi_prefix_da = "/dev/da";
 
+static int ata_send(ATA *ata, enum ata_command atacmd, int drivercmd);
+static void sat_taskfile(ATA *ata, struct sat_taskfile *tf);
+static int sat_fill_csio(struct ccb_scsiio *csio, ATA *ata);
+static int sat_getfirmware(ATA *ata, char *firmware, size_t fwlen);
+static int sat_complete_ccb(ATA *ata, union ccb *ccb);
+static int sat_send(ATA *ata);
+static bool is_disk_name( const char *name );
+
 #ifndef TRUE
 #define TRUE 1
 #endif
@@ -67,12 +83,21 @@ int ata_open(ATA **ataptr, const char *device) {
 	{
 		ATA *ata = *ataptr;
 		if (ata == NULL)
-			err(EX_SOFTWARE, NULL);
+			return -1;
+		memset(ata, 0, sizeof(ATA));
 		ata->devhandle.fd = -1;
+		if (ata_allocbuffers(ata)) {
+			rc = -1;
+			goto fail;
+		}
 
 		/* TODO better detection of SCSI/SAT */
 		ata->access_mode = ACCESS_MODE_ATA;
-		if (strncmp(device, scsi_prefix_da, strlen(scsi_prefix_da)) == 0)
+		if (sim_isdevice(device))
+			ata->access_mode = ACCESS_MODE_SIM;
+		else if (trace_isreplay(device))
+			ata->access_mode = ACCESS_MODE_REPLAY;
+		else if (strncmp(device, scsi_prefix_da, strlen(scsi_prefix_da)) == 0)
 			ata->access_mode = ACCESS_MODE_SAT;
 
 		switch (ata->access_mode) {
@@ -80,6 +105,11 @@ int ata_open(ATA **ataptr, const char *device) {
 			rc = open( device, O_RDONLY );
 			if (rc > 0)
 				ata->devhandle.fd = rc;
+			/* only needed to find the devstat entry */
+			if (cam_get_device( device, ata->devhandle.camdevname,
+					    DEV_IDLEN,
+					    &(ata->devhandle.camunit) ) != 0)
+				ata->devhandle.camdevname[0] = '\0';
 			break;
 		case ACCESS_MODE_SAT:
 			rc = cam_get_device( device, ata->devhandle.camdevname,
@@ -92,16 +122,37 @@ int ata_open(ATA **ataptr, const char *device) {
 				ata->devhandle.camunit,	O_RDONLY, NULL );
 			if (ata->devhandle.camdev == NULL) {
 				rc = -1;
-				warnx("%s", cam_errbuf);
+				errno = ENXIO;
+				goto fail;
+			}
+			ata->devhandle.ccb = cam_getccb(ata->devhandle.camdev);
+			if (ata->devhandle.ccb == NULL) {
+				cam_close_device(ata->devhandle.camdev);
+				rc = -1;
 				goto fail;
 			}
-			
+			sat_setpdt(ata,
+			    SID_TYPE(&ata->devhandle.camdev->inq_data));
+			break;
+		case ACCESS_MODE_SIM:
+			rc = sim_open(ata, device);
+			if (rc != 0)
+				goto fail;
+			rc = 1;
+			break;
+		case ACCESS_MODE_REPLAY:
+			rc = ata_replay_open(ata, device);
+			if (rc != 0)
+				goto fail;
+			rc = 1;
 			break;
 		}
 	}
 	return rc;
 fail:
+	ata_freebuffers(*ataptr);
 	free(*ataptr);
+	*ataptr = NULL;
 	return rc;
 }
 
@@ -117,11 +168,27 @@ void ata_close(ATA **ataptr) {
 				ata->devhandle.fd = -1;
 				break;
 			case ACCESS_MODE_SAT:
+				if (ata->devhandle.ccb != NULL)
+					cam_freeccb(ata->devhandle.ccb);
+				ata->devhandle.ccb = NULL;
 				if (ata->devhandle.camdev != NULL)
 					cam_close_device(ata->devhandle.camdev);
 				ata->devhandle.camdev = NULL;
 				break;
+			case ACCESS_MODE_SIM:
+				sim_close(ata);
+				break;
+			case ACCESS_MODE_REPLAY:
+				ata_replay_close(ata);
+				break;
+			}
+			ata_stats_free(ata);
+			ata_trace_free(ata);
+			if (ata->devhandle.dinfo != NULL) {
+				free(ata->devhandle.dinfo->mem_ptr);
+				free(ata->devhandle.dinfo);
 			}
+			ata_freebuffers(ata);
 			free(ata);
 		}
 		*ataptr = NULL;
@@ -138,127 +205,199 @@ int ata_is_opened(ATA *ata)
 		return ata->devhandle.fd > 0;
 	case ACCESS_MODE_SAT:
 		return ata->devhandle.camdev != NULL;
+	case ACCESS_MODE_SIM:
+		return ata->sim != NULL;
+	case ACCESS_MODE_REPLAY:
+		return ata->replay != NULL;
 	default:
-		err(EX_SOFTWARE, "unknown access mode %d", ata->access_mode);
-		return FALSE; /* UNREACHABLE */
+		return FALSE;
 	};
 }
 
-/* TODO move generic ATA <-> SAT CDB conversion code to mi */
-
-void sat_cdb_set_command(union sat_cdb* cdb, enum ata_command atacmd)
+/* describe the pending request as a taskfile for the SAT translator */
+static void sat_taskfile(ATA *ata, struct sat_taskfile *tf)
 {
-	switch (cdb->sc_h.opcode) {
-	case SAT_ATA_PASSTHROUGH_12:
-		cdb->scshort.command = atacmd;
-		break;
-	case SAT_ATA_PASSTHROUGH_16:
-		cdb->sclong.command = atacmd;
-		break;
+	struct ata_ioc_request *req = &ata->atacmd.ata_cmd;
+
+	memset(tf, 0, sizeof(struct sat_taskfile));
+	tf->command = req->u.ata.command;
+	tf->feature = req->u.ata.feature;
+	tf->count = req->u.ata.count;
+	tf->lba = req->u.ata.lba;
+	if (req->flags & ATA_CMD_READ) {
+		tf->protocol = ATA_PROT_PIO_DATA_IN;
+		tf->datalen = req->count;
+	} else if (req->flags & ATA_CMD_WRITE) {
+		tf->protocol = ATA_PROT_PIO_DATA_OUT;
+		tf->write = true;
+		tf->datalen = req->count;
+	} else {
+		tf->protocol = ATA_PROT_NON_DATA;
 	}
 }
 
-static
-int translate_ata_to_csio(struct ccb_scsiio *csio, ATA *ata, enum ata_command atacmd, int drivercmd)
+/* fill in the CCB for the pending request as an ATA PASS-THROUGH */
+static int sat_fill_csio(struct ccb_scsiio *csio, ATA *ata)
 {
-	int rc = 0;
-	int cmdlen = 16;
-	union sat_cdb* cdb = (union sat_cdb*) csio->cdb_io.cdb_bytes;
+	struct sat_taskfile tf;
+	int len;
 
 	bzero(&(&csio->ccb_h)[1], sizeof(struct ccb_scsiio) - sizeof(struct ccb_hdr));
 
+	sat_taskfile(ata, &tf);
+	len = sat_build_cdb(ata, &tf, csio->cdb_io.cdb_bytes);
+	if (len == -1)
+		return -1;
+
 	/* cam_fill_csio() sucks */
 
 	csio->ccb_h.func_code = XPT_SCSI_IO;
-	csio->ccb_h.flags = 0;
+	csio->ccb_h.flags = CAM_DIR_NONE;
 	csio->ccb_h.retry_count = 1;
 	csio->ccb_h.cbfcnp = NULL;
-	csio->ccb_h.timeout = ata->atacmd.ata_cmd.timeout * 1000; /* ATA_CMD_TIMEOUT * 1000; */
+	csio->ccb_h.timeout = ata->atacmd.ata_cmd.timeout * 1000;
 	csio->data_ptr = NULL;
 	csio->dxfer_len = 0;
-	csio->sense_len = 32;
-	csio->cdb_len = cmdlen;
+	csio->sense_len = ATA_SENSE_BUFSIZE;
+	csio->cdb_len = len;
 	csio->tag_action = MSG_SIMPLE_Q_TAG;
 
-	cdb->sc_h.opcode = SAT_ATA_PASSTHROUGH_16;
-
-	switch (ata->atacmd.ata_cmd.flags) {
-	case ATA_CMD_READ:
-		csio->ccb_h.flags = CAM_DIR_IN;
+	if (tf.datalen) {
+		csio->ccb_h.flags = tf.write ? CAM_DIR_OUT : CAM_DIR_IN;
 		csio->data_ptr = (u_int8_t*) ata->atacmd.ata_cmd.data;
-		csio->dxfer_len = ata->atacmd.ata_cmd.count;
-		cdb->sc_h.protocol = ATA_PROT_PIO_DATA_IN;
-		cdb->sc_h.extend = 1;
-		break;
-#if 0
-	case ATA_CMD_CONTROL:
-		csio->ccb_h.flags = CAM_DIR_NONE;
-		break;
-#endif
-	default:
-		err(EX_SOFTWARE, "unknown ata command flag %d", ata->atacmd.ata_cmd.flags);
-		return -1; /* UNREACHABLE */
+		csio->dxfer_len = tf.datalen;
 	}
 
-	sat_cdb_set_command(cdb, atacmd);
+	return 0;
+}
 
-	switch (atacmd) {
-	case ATA__IDENTIFY:
+/* work out the result of a finished CCB, 0 if the command worked */
+static int sat_complete_ccb(ATA *ata, union ccb *ccb)
+{
+	struct ccb_scsiio *csio = &ccb->csio;
+	int len;
+
+	memset(ata->sense, 0, ATA_SENSE_BUFSIZE);
+	ata->senselen = 0;
+
+	switch (ccb->ccb_h.status & CAM_STATUS_MASK) {
+	case CAM_REQ_CMP:
+		return 0;
+	case CAM_SCSI_STATUS_ERROR:
+		/* CHECK CONDITION, which ck_cond asks for */
+		if ((ccb->ccb_h.status & CAM_AUTOSNS_VALID) == 0)
+			break;
+		len = csio->sense_len - csio->sense_resid;
+		if (len > ATA_SENSE_BUFSIZE)
+			len = ATA_SENSE_BUFSIZE;
+		memcpy(ata->sense, &csio->sense_data, len);
+		ata->senselen = len;
+		return sat_decode_sense(ata, ata->sense, len);
+	case CAM_CMD_TIMEOUT:
+		/* a drive in sleep mode doesn't answer until it is reset */
+		errno = ETIMEDOUT;
+		return -1;
+	default:
 		break;
-	case ATA__ATAPI_IDENTIFY:
-	case ATA__SETFEATURES:
-	case ATA_IDLE:
-	case ATA_STANDBY:
-		err(EX_SOFTWARE, "unknown ata command %x", atacmd);
-		return -1; /* UNREACHABLE */
 	}
 
+	errno = EIO;
+	return -1;
+}
+
+/* send the pending request to a SAT device through CAM */
+static int sat_send(ATA *ata)
+{
+	union ccb *ccb = ata->devhandle.ccb;
+	int rc;
+
+	/* before the CCB is filled in, finding the device may use it */
+	ata_cache_loadsat(ata);
+	do {
+		if (sat_fill_csio(&ccb->csio, ata))
+			return -1;
+		if (cam_send_ccb(ata->devhandle.camdev, ccb))
+			return -1;
+		rc = sat_complete_ccb(ata, ccb);
+	} while (rc && sat_fallback(ata));
+
 	return rc;
 }
 
-/* send a command to the drive */
+/* send a command to the drive, timing it if statistics are kept */
 int ata_cmd(ATA *ata, enum ata_command atacmd, int drivercmd)
+{
+	uint64_t start, tstart;
+	int rc;
+
+	if (drivercmd != 0)
+		return ata_send(ata, atacmd, drivercmd);
+
+	start = ata_stats_begin(ata, atacmd);
+	tstart = ata_trace_begin(ata);
+	rc = ata_send(ata, atacmd, drivercmd);
+	ata_stats_end(ata, atacmd, rc, start);
+	ata_trace_end(ata, atacmd, ata->atacmd.ata_cmd.u.ata.feature,
+	    ata->atacmd.ata_cmd.u.ata.count, ata->atacmd.ata_cmd.u.ata.lba,
+	    (ata->atacmd.ata_cmd.flags & ATA_CMD_READ) ?
+	    ata->atacmd.ata_cmd.count : 0, rc, tstart);
+
+	return rc;
+}
+
+static int ata_send(ATA *ata, enum ata_command atacmd, int drivercmd)
 {
 	int rc = 0;
 
 	if (atacmd > 0)
 		ata->atacmd.ata_cmd.u.ata.command = atacmd;
+	memset(&ata->regs, 0, sizeof(struct ata_regs));
 
 	switch (ata->access_mode) {
 	case ACCESS_MODE_ATA:
 		if (drivercmd == IOCATAGMAXCHANNEL) {
 			int maxchan = 0;
 			rc = ioctl( ata->devhandle.fd, drivercmd, &maxchan );
-			ata->atacmd.ata_cmd.data = malloc(sizeof(int));
-			*ata->atacmd.ata_cmd.data = maxchan;
+			memcpy(ata->data, &maxchan, sizeof(int));
+			ata->atacmd.ata_cmd.data = (caddr_t) ata->data;
 		} else {
 			rc = ioctl( ata->devhandle.fd, IOCATAREQUEST, &(ata->atacmd.ata_cmd) );
+#ifdef ATA_CMD_READ_TF
+			/* the driver copied the taskfile back for us */
+			if (rc == 0) {
+				ata->regs.valid = true;
+				ata->regs.status = ata->atacmd.ata_cmd.u.ata.command;
+				ata->regs.error = ata->atacmd.ata_cmd.u.ata.feature;
+				ata->regs.count = ata->atacmd.ata_cmd.u.ata.count;
+			}
+#endif
 		}
 		break;
 	case ACCESS_MODE_SAT:
 		if (drivercmd == IOCATAGMAXCHANNEL) {
 			/* XXX hardcoded to 1 channel */
+			int maxchan = 1;
 			rc = 0;
-			ata->atacmd.ata_cmd.data = malloc(sizeof(int)); /* memory leak (above too) */
-			*ata->atacmd.ata_cmd.data = 1;
+			memcpy(ata->data, &maxchan, sizeof(int));
+			ata->atacmd.ata_cmd.data = (caddr_t) ata->data;
 		} else {
-			union ccb * ccb;
-			struct ccb_scsiio * csio;
-
-			ccb = cam_getccb(ata->devhandle.camdev);
-			if (!ccb)
-				return -1;
-
-			csio = &ccb->csio;
-
-			rc = translate_ata_to_csio(csio, ata, atacmd, drivercmd);
-			if (rc) return rc;
-
-			rc = cam_send_ccb(ata->devhandle.camdev, ccb);
-			cam_freeccb(ccb);
-			if (rc) return rc;
+			rc = sat_send(ata);
 		}
 		break;
+	case ACCESS_MODE_SIM:
+		rc = sim_cmd(ata, atacmd, ata->atacmd.ata_cmd.u.ata.feature,
+		    ata->atacmd.ata_cmd.u.ata.count,
+		    (ata->atacmd.ata_cmd.flags & ATA_CMD_READ) ?
+		    ata->atacmd.ata_cmd.count : 0);
+		break;
+	case ACCESS_MODE_REPLAY:
+		rc = ata_replay_cmd(ata, atacmd,
+		    ata->atacmd.ata_cmd.u.ata.feature,
+		    ata->atacmd.ata_cmd.u.ata.count,
+		    ata->atacmd.ata_cmd.u.ata.lba,
+		    (ata->atacmd.ata_cmd.flags & ATA_CMD_READ) ?
+		    ata->atacmd.ata_cmd.count : 0);
+		break;
 	}
 
 	return rc;
@@ -271,6 +410,9 @@ int ata_setataparams( ATA *ata, int seccount, int count)
 	memset(& ata->atacmd, 0, sizeof(struct ata_cmd));
 	ata->atacmd.ata_cmd.u.ata.command = (uint8_t) IOCATAREQUEST;
 	ata->atacmd.ata_cmd.flags = ATA_CMD_CONTROL;
+#ifdef ATA_CMD_READ_TF
+	ata->atacmd.ata_cmd.flags |= ATA_CMD_READ_TF;
+#endif
 	ata->atacmd.ata_cmd.timeout = ATA_CMD_TIMEOUT;
 	ata->atacmd.ata_cmd.count = count;
 	ata->atacmd.ata_cmd.u.ata.count = seccount;
@@ -283,20 +425,269 @@ void ata_setfeature_param( ATA *ata, enum ata_feature feature_val)
 	ata->atacmd.ata_cmd.u.ata.feature = feature_val;
 }
 
-void ata_setdataout_params( ATA *ata, char ** databuf, int nbytes)
+void ata_setlba_param( ATA *ata, uint32_t lba )
 {
-	*databuf = malloc(nbytes);
+	ata->atacmd.ata_cmd.u.ata.lba = lba;
+}
 
-	if(*databuf == 0)
-	{
-		/* malloc failed, there's no way to recover here */
-		fprintf(stderr, "malloc failed. aborting\n");
-		exit(EXIT_FAILURE);
-	}
+void ata_setdataout_params( ATA *ata, char ** databuf, int nbytes)
+{
+	if (nbytes > ATA_DATA_BUFSIZE)
+		nbytes = ATA_DATA_BUFSIZE;
 
+	*databuf = (char *) ata->data;
 	memset(*databuf, 0, nbytes);
 	ata->atacmd.ata_cmd.data = *databuf;
 	ata->atacmd.ata_cmd.count = nbytes;
 	ata->atacmd.ata_cmd.flags = ATA_CMD_READ;
 }
 
+
+/*
+ * Name the controller the device hangs off: the CAM SIM of a SAT device,
+ * e.g. mps0.  Drives behind ata(4) can't be told apart this way.
+ */
+int ata_getcontroller( ATA *ata, char *name, size_t len )
+{
+	switch (ata->access_mode) {
+	case ACCESS_MODE_SIM:
+		return sim_getcontroller(ata, name, len);
+	case ACCESS_MODE_SAT:
+		snprintf(name, len, "%s%u", ata->devhandle.camdev->sim_name,
+		    ata->devhandle.camdev->sim_unit_number);
+		return 0;
+	default:
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+}
+
+/* arrays are only found on Linux, others have to be given with --group */
+int ata_getarray( ATA *ata, char *name, size_t len )
+{
+	if (ata->access_mode == ACCESS_MODE_SIM)
+		return sim_getarray(ata, name, len);
+
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+/* enclosure slots are only found on Linux */
+int ata_getslot( ATA *ata, char *name, size_t len )
+{
+	if (ata->access_mode == ACCESS_MODE_SIM)
+		return sim_getslot(ata, name, len);
+
+	errno = EOPNOTSUPP;
+	return -1;
+}
+
+/*
+ * ada(4) and ata(4) devices are ATA, a da(4) device is SAT when the SCSI
+ * vendor is "ATA" or it sits behind umass(4), otherwise a SCSI disk.
+ */
+int ata_gettransport( ATA *ata, enum ata_transport *transport )
+{
+	struct cam_device *camdev = ata->devhandle.camdev;
+
+	switch (ata->access_mode) {
+	case ACCESS_MODE_ATA:
+		*transport = ATA_TRANSPORT_ATA;
+		return 0;
+	case ACCESS_MODE_SIM:
+		*transport = ATA_TRANSPORT_SIM;
+		return 0;
+	case ACCESS_MODE_SAT:
+		if (strncmp(camdev->inq_data.vendor, "ATA", 3) == 0 ||
+		    strcmp(camdev->sim_name, "umass-sim") == 0)
+			*transport = ATA_TRANSPORT_SAT;
+		else
+			*transport = ATA_TRANSPORT_SAS;
+		return 0;
+	default:
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+}
+
+/* ada0, da12: the prefix and nothing but the unit number */
+static bool is_disk_name( const char *name )
+{
+	size_t n;
+
+	if (strncmp(name, "ada", 3) == 0)
+		n = 3;
+	else if (strncmp(name, "da", 2) == 0)
+		n = 2;
+	else if (strncmp(name, "ad", 2) == 0)
+		n = 2;
+	else
+		return false;
+
+	return name[n] != '\0' && strspn(name + n, "0123456789") ==
+	    strlen(name + n);
+}
+
+/* list the whole disks in /dev which can be sent ATA commands */
+int ata_listdevices( char ***devices, int *ndevices )
+{
+	struct dirent **names;
+	char **list;
+	int n, i;
+	int count = 0;
+
+	n = scandir("/dev", &names, NULL, alphasort);
+	if (n < 0)
+		return -1;
+	list = calloc(n + 1, sizeof(char *));
+
+	for (i = 0; i < n; i++) {
+		const char *name = names[i]->d_name;
+
+		if (list == NULL || !is_disk_name(name))
+			continue;
+		list[count] = malloc(strlen("/dev/") + strlen(name) + 1);
+		if (list[count] == NULL) {
+			ata_freedevices(list, count);
+			list = NULL;
+			continue;
+		}
+		sprintf(list[count++], "/dev/%s", name);
+	}
+
+	for (i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+	if (list == NULL)
+		return -1;
+
+	*devices = list;
+	*ndevices = count;
+	return 0;
+}
+
+/* when the system was booted, in seconds since the epoch */
+int ata_getboottime( uint64_t *boottime )
+{
+	struct timeval tv;
+	size_t len = sizeof(tv);
+
+	if (sysctlbyname("kern.boottime", &tv, &len, NULL, 0) == -1)
+		return -1;
+
+	*boottime = tv.tv_sec;
+	return 0;
+}
+
+/* find the devstat(3) entry of the device and return its statistics */
+int ata_getiostat( ATA *ata, struct ata_iostat *stat )
+{
+	struct statinfo stats;
+	struct devinfo *dinfo;
+	int rc = -1;
+	int i;
+
+	if (ata->access_mode == ACCESS_MODE_SIM)
+		return sim_getiostat(ata, stat);
+	if (ata->access_mode == ACCESS_MODE_REPLAY) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	/* devstat_getdevs() only reallocates this when the device list changes */
+	if (ata->devhandle.dinfo == NULL) {
+		ata->devhandle.dinfo = calloc(1, sizeof(struct devinfo));
+		if (ata->devhandle.dinfo == NULL)
+			return -1;
+	}
+	dinfo = ata->devhandle.dinfo;
+
+	memset(&stats, 0, sizeof(struct statinfo));
+	stats.dinfo = dinfo;
+
+	if (devstat_getdevs(NULL, &stats) == -1)
+		return -1;
+
+	for (i = 0; i < dinfo->numdevs; i++) {
+		struct devstat *ds = &dinfo->devices[i];
+
+		if (ds->unit_number != ata->devhandle.camunit ||
+		    strcmp(ds->device_name, ata->devhandle.camdevname) != 0)
+			continue;
+
+		stat->reads = ds->operations[DEVSTAT_READ];
+		stat->writes = ds->operations[DEVSTAT_WRITE];
+		stat->sectors = (ds->bytes[DEVSTAT_READ] +
+		    ds->bytes[DEVSTAT_WRITE]) / 512;
+		stat->in_flight = ds->start_count - ds->end_count;
+		stat->io_ticks = ds->busy_time.sec * 1000 +
+		    ((ds->busy_time.frac >> 32) * 1000 >> 32);
+		rc = 0;
+		break;
+	}
+
+	if (rc)
+		errno = ENXIO;
+
+	return rc;
+}
+
+/*
+ * Read the drive's firmware revision from the ATA Information VPD page;
+ * the revision in the standard INQUIRY data is the bridge's.
+ */
+static int sat_getfirmware(ATA *ata, char *firmware, size_t fwlen)
+{
+	union ccb *ccb = ata->devhandle.ccb;
+	struct ccb_scsiio *csio = &ccb->csio;
+	uint8_t page[SAT_VPD_ATA_INFO_LEN];
+
+	/* not ata->data, which may hold the data of a command being sent */
+	bzero(&(&csio->ccb_h)[1], sizeof(struct ccb_scsiio) - sizeof(struct ccb_hdr));
+	scsi_inquiry(csio, 1, NULL, MSG_SIMPLE_Q_TAG, page,
+	    SAT_VPD_ATA_INFO_LEN, 1, SAT_VPD_ATA_INFO, SSD_FULL_SIZE, 5000);
+
+	if (cam_send_ccb(ata->devhandle.camdev, ccb) ||
+	    (ccb->ccb_h.status & CAM_STATUS_MASK) != CAM_REQ_CMP)
+		return -1;
+
+	return sat_vpd_firmware(page,
+	    SAT_VPD_ATA_INFO_LEN - csio->resid, firmware, fwlen);
+}
+
+/*
+ * Get a stable identity of the device, and its firmware revision, without
+ * sending anything to the drive; behind a SAT bridge only the bridge is
+ * asked.  The ATA driver doesn't tell us the firmware revision, so only
+ * the serial number is used there.
+ */
+int ata_getdevid( ATA *ata, char *devid, size_t idlen,
+		char *firmware, size_t fwlen )
+{
+	char ident[DISK_IDENT_SIZE];
+
+	firmware[0] = '\0';
+
+	switch (ata->access_mode) {
+	case ACCESS_MODE_SIM:
+		return sim_getdevid(ata, devid, idlen, firmware, fwlen);
+	case ACCESS_MODE_REPLAY:
+		return ata_replay_getdevid(ata, devid, idlen, firmware, fwlen);
+	case ACCESS_MODE_ATA:
+		memset(ident, 0, sizeof(ident));
+		if (ioctl(ata->devhandle.fd, DIOCGIDENT, ident) == -1)
+			return -1;
+		strlcpy(devid, ident, idlen);
+		break;
+	case ACCESS_MODE_SAT:
+		strlcpy(devid, ata->devhandle.camdev->serial_num, idlen);
+		if (sat_getfirmware(ata, firmware, fwlen) == 0)
+			break;
+		cam_strvis((u_char *) firmware,
+		    ata->devhandle.camdev->inq_data.revision,
+		    sizeof(ata->devhandle.camdev->inq_data.revision), fwlen);
+		break;
+	}
+
+	return 0;
+}
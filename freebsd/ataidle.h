@@ -34,17 +34,24 @@
 #include <sys/types.h>
 #include <sys/ata.h>
 
+/* where the IDENTIFY cache is kept */
+#define ATAIDLE_CACHEDIR	"/var/db/ataidle"
+
 struct ata_cmd
 {
 	struct ata_ioc_request ata_cmd;
 };
 
+struct devinfo;
+
 struct ata_dev_handle
 {
 	int			fd;
 	char		camdevname[DEV_IDLEN];
 	int			camunit;
 	struct cam_device *	camdev;
+	union ccb *		ccb;		/* reused by every SAT command */
+	struct devinfo *	dinfo;		/* reused by ata_getiostat() */
 };
 
 #endif /* ATAIDLE_H */
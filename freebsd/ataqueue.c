@@ -0,0 +1,119 @@
+/*-
+ *
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Command queue for ata_queue_submit().  CAM has no asynchronous
+ * pass-through interface usable from userland, so the commands are sent
+ * one at a time with ata_cmd() in the order they were submitted.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ataidle.h"
+#include "../mi/atagen.h"
+#include "../mi/atadefs.h"
+
+struct ata_qreq
+{
+	struct ata_qreq *	next;
+	ATA *			ata;
+	struct ata_cmd		atacmd;
+	enum ata_command	cmd;
+	ata_done_t		done;
+	void *			arg;
+};
+
+struct ata_queue
+{
+	struct ata_qreq *	head;
+	struct ata_qreq *	tail;
+};
+
+struct ata_queue * ata_queue_new( void )
+{
+	return calloc(1, sizeof(struct ata_queue));
+}
+
+int ata_queue_submit( struct ata_queue *queue, ATA *ata,
+		enum ata_command atacmd, ata_done_t done, void *arg )
+{
+	struct ata_qreq *req;
+
+	req = malloc(sizeof(struct ata_qreq));
+	if (req == NULL)
+		return -1;
+	req->next = NULL;
+	req->ata = ata;
+	memcpy(&req->atacmd, &ata->atacmd, sizeof(struct ata_cmd));
+	req->cmd = atacmd;
+	req->done = done;
+	req->arg = arg;
+
+	if (queue->tail != NULL)
+		queue->tail->next = req;
+	else
+		queue->head = req;
+	queue->tail = req;
+
+	return 0;
+}
+
+int ata_queue_run( struct ata_queue *queue )
+{
+	struct ata_qreq *req;
+	int rc;
+
+	while ((req = queue->head) != NULL) {
+		queue->head = req->next;
+		if (queue->head == NULL)
+			queue->tail = NULL;
+
+		memcpy(&req->ata->atacmd, &req->atacmd, sizeof(struct ata_cmd));
+		rc = ata_cmd(req->ata, req->cmd, 0);
+		if (req->done != NULL)
+			req->done(req->ata, rc, req->arg);
+		free(req);
+	}
+
+	return 0;
+}
+
+void ata_queue_free( struct ata_queue *queue )
+{
+	struct ata_qreq *req;
+
+	if (queue == NULL)
+		return;
+
+	while ((req = queue->head) != NULL) {
+		queue->head = req->next;
+		free(req);
+	}
+	free(queue);
+}
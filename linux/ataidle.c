@@ -34,50 +34,881 @@
 #include <limits.h>
 #include <unistd.h>
 #include <errno.h>
+#include <dirent.h>
 #include <math.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <linux/hdreg.h>
+#include <scsi/sg.h>
 
 /* application-specific includes */
 #include "ataidle.h"
+#include "sgio.h"
 #include "../mi/atagen.h"
 #include "../mi/atadefs.h"
+#include "../mi/cache.h"
 #include "../mi/util.h"	
+#include "../mi/sat.h"
+#include "../mi/sim.h"
+#include "../mi/stats.h"
+#include "../mi/trace.h"
+
+#define SCSI_STATUS_CHECK_CONDITION	0x02
+#define SG_DRIVER_SENSE			0x08
+#define SG_DRIVER_TIMEOUT		0x06
+#define SG_HOST_TIMEOUT			0x03
+
+static int hdio_cmd(ATA *ata);
+static int sysfs_devattr(ATA *ata, const char *attr, char *buf, size_t len);
+static int sat_cmd(ATA *ata, bool *nosgio);
+static void sat_taskfile(ATA *ata, struct sat_taskfile *tf);
+
+/* open ata device */
+int ata_open(ATA **ataptr, const char *device)
+{
+	int rc;
+	int version = 0;
+	char type[16];
+	ATA *ata;
+
+	*ataptr = malloc(sizeof(ATA));
+	ata = *ataptr;
+	if (ata == NULL)
+		return -1;
+	memset(ata, 0, sizeof(ATA));
+	if (ata_allocbuffers(ata)) {
+		free(ata);
+		*ataptr = NULL;
+		return -1;
+	}
+
+	ata->devhandle.fd = -1;
+	if (sim_isdevice(device)) {
+		if (sim_open(ata, device)) {
+			ata_freebuffers(ata);
+			free(ata);
+			*ataptr = NULL;
+			return -1;
+		}
+		return 1;
+	}
+	if (trace_isreplay(device)) {
+		if (ata_replay_open(ata, device)) {
+			ata_freebuffers(ata);
+			free(ata);
+			*ataptr = NULL;
+			return -1;
+		}
+		return 1;
+	}
+
+	rc = open( device, O_RDONLY | O_NONBLOCK );
+	if (rc <= 0) {
+		ata_freebuffers(ata);
+		free(ata);
+		*ataptr = NULL;
+		return rc;
+	}
+	ata->devhandle.fd = rc;
+
+	/*
+	 * Prefer ATA PASS-THROUGH whenever the device speaks SG_IO, it works
+	 * behind SAS HBAs and USB bridges and returns the ATA registers.
+	 * Old IDE devices only understand HDIO_DRIVE_CMD.
+	 */
+	ata->access_mode = ACCESS_MODE_ATA;
+	if (ioctl(ata->devhandle.fd, SG_GET_VERSION_NUM, &version) == 0 &&
+			version >= 30000) {
+		ata->access_mode = ACCESS_MODE_SAT;
+		/* PASS-THROUGH(16) unless the device is known to be a disk */
+		ata->satlen = SAT_CDB_LONG;
+		if (sysfs_devattr(ata, "type", type, sizeof(type)) == 0)
+			sat_setpdt(ata, atoi(type));
+	}
+
+	return rc;
+}
+
+/* close ata device and free memory, set pointer to NULL */
+void ata_close(ATA **ataptr)
+{
+	if (ataptr != NULL) {
+		ATA *ata = *ataptr;
+		if (ata != NULL) {
+			if (ata->devhandle.fd > 0)
+				close(ata->devhandle.fd);
+			ata->devhandle.fd = -1;
+			if (ata->sim != NULL)
+				sim_close(ata);
+			ata_replay_close(ata);
+			ata_stats_free(ata);
+			ata_trace_free(ata);
+			ata_freebuffers(ata);
+			free(ata);
+		}
+		*ataptr = NULL;
+	}
+}
+
+/* check if ata points to opened device */
+int ata_is_opened(ATA *ata)
+{
+	if (ata == NULL)
+		return 0;
+	return ata->devhandle.fd > 0 || ata->sim != NULL || ata->replay != NULL;
+}
 
 /* send a command to the drive */
-int ata_cmd(ATA *ata, int cmd, int drivercmd)
+int ata_cmd(ATA *ata, enum ata_command atacmd, int drivercmd)
 {
 	int rc = 0;
-	
+	bool nosgio = false;
+	uint64_t start, tstart;
+	/* the old ioctl overwrites these with the result */
+	uint8_t feature = ata->atacmd.feature;
+	uint8_t count = ata->atacmd.sector_number;
+	size_t datalen = ata->atacmd.sector_count * 512;
+
+	(void) drivercmd;
+
+	start = ata_stats_begin(ata, atacmd);
+	tstart = ata_trace_begin(ata);
+	ata->atacmd.cmd = atacmd;
+	memset(&ata->regs, 0, sizeof(struct ata_regs));
+
+	switch (ata->access_mode) {
+	case ACCESS_MODE_SAT:
+		rc = sat_cmd(ata, &nosgio);
+		/*
+		 * the driver doesn't do SG_IO after all, use the old ioctl;
+		 * not once a command has gone through, that was something else
+		 */
+		if (rc && nosgio && !ata->satworked) {
+			ata->access_mode = ACCESS_MODE_ATA;
+			rc = hdio_cmd(ata);
+		} else if (rc == 0) {
+			ata->satworked = true;
+		}
+		break;
+	case ACCESS_MODE_SIM:
+		rc = sim_cmd(ata, atacmd, feature, count, datalen);
+		break;
+	case ACCESS_MODE_REPLAY:
+		rc = ata_replay_cmd(ata, atacmd, feature, count,
+		    ata->atacmd.lba, datalen);
+		break;
+	case ACCESS_MODE_ATA:
+	default:
+		rc = hdio_cmd(ata);
+		break;
+	}
+
+	ata_stats_end(ata, atacmd, rc, start);
+	ata_trace_end(ata, atacmd, feature, count, ata->atacmd.lba, datalen,
+	    rc, tstart);
+	return rc;
+}
+
+static int hdio_cmd(ATA *ata)
+{
+	int rc;
+	unsigned char cmd = ata->atacmd.cmd;
+	unsigned char count = ata->atacmd.sector_number;
+
+	/* the kernel reads data straight after the four byte header */
+	if (ata->atacmd.sector_count > 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	rc = ioctl( ata->devhandle.fd, HDIO_DRIVE_CMD, &ata->atacmd );
+	if (rc == 0 && ata->atacmd.sector_count)
+		memcpy(ata->data, ata->atacmd.buf, sizeof(ata->atacmd.buf));
+
+	/* the kernel returns status, error and count in the first three bytes */
+	ata->regs.valid = true;
+	ata->regs.status = ata->atacmd.cmd;
+	ata->regs.error = ata->atacmd.sector_number;
+	ata->regs.count = ata->atacmd.feature;
 	ata->atacmd.cmd = cmd;
-	rc = ioctl( ata->fd, HDIO_DRIVE_CMD, &ata->atacmd );
-	
+	ata->atacmd.sector_number = count;
+
+	return rc;
+}
+
+/* describe the pending command as a taskfile for the SAT translator */
+static void sat_taskfile(ATA *ata, struct sat_taskfile *tf)
+{
+	memset(tf, 0, sizeof(struct sat_taskfile));
+	tf->protocol = ata->atacmd.sector_count ?
+	    ATA_PROT_PIO_DATA_IN : ATA_PROT_NON_DATA;
+	tf->command = ata->atacmd.cmd;
+	tf->feature = ata->atacmd.feature;
+	tf->count = ata->atacmd.sector_number;
+	tf->lba = ata->atacmd.lba & 0x0FFFFFFF;
+	tf->datalen = ata->atacmd.sector_count * 512;
+}
+
+/*
+ * Set up an SG_IO request header for the pending command, using the
+ * buffers of the handle.  cdb has to stay around until it completes.
+ * Fails with EINVAL if the command can't be translated.
+ */
+int sat_prepare_io(ATA *ata, union sat_cdb *cdb, struct sg_io_hdr *io)
+{
+	struct sat_taskfile tf;
+	int len;
+
+	ata_cache_loadsat(ata);
+	sat_taskfile(ata, &tf);
+	len = sat_build_cdb(ata, &tf, (uint8_t *) cdb);
+	if (len == -1)
+		return -1;
+
+	memset(io, 0, sizeof(struct sg_io_hdr));
+	memset(ata->sense, 0, ATA_SENSE_BUFSIZE);
+	ata->senselen = 0;
+	memset(&ata->regs, 0, sizeof(struct ata_regs));
+	io->interface_id = 'S';
+	io->cmd_len = len;
+	io->cmdp = (unsigned char *) cdb;
+	io->mx_sb_len = ATA_SENSE_BUFSIZE;
+	io->sbp = ata->sense;
+	io->timeout = (ata->atacmd.timeout ? ata->atacmd.timeout :
+			ATA_CMD_TIMEOUT) * 1000;
+	if (ata->atacmd.sector_count) {
+		io->dxfer_direction = SG_DXFER_FROM_DEV;
+		io->dxfer_len = ata->atacmd.sector_count * 512;
+		io->dxferp = ata->data;
+	} else {
+		io->dxfer_direction = SG_DXFER_NONE;
+	}
+
+	return 0;
+}
+
+/* work out the result of a finished SG_IO request, 0 if the command worked */
+int sat_complete_io(ATA *ata, const struct sg_io_hdr *io)
+{
+	ata->senselen = io->sb_len_wr;
+
+	/* a drive in sleep mode doesn't answer until it is reset */
+	if (io->host_status == SG_HOST_TIMEOUT ||
+			(io->driver_status & 0x0F) == SG_DRIVER_TIMEOUT) {
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	if (io->host_status != 0 ||
+			(io->driver_status & ~SG_DRIVER_SENSE) != 0) {
+		errno = EIO;
+		return -1;
+	}
+
+	if (io->status == SCSI_STATUS_CHECK_CONDITION || io->sb_len_wr > 0)
+		return sat_decode_sense(ata, ata->sense, io->sb_len_wr);
+
+	if (io->status != 0) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Send the pending command as an ATA PASS-THROUGH via SG_IO.  nosgio is
+ * set if the SG_IO ioctl itself was refused, as drivers without it do.
+ */
+static int sat_cmd(ATA *ata, bool *nosgio)
+{
+	int rc;
+	union sat_cdb cdb;
+	struct sg_io_hdr io;
+
+	do {
+		if (sat_prepare_io(ata, &cdb, &io))
+			return -1;
+		rc = ioctl(ata->devhandle.fd, SG_IO, &io);
+		if (rc) {
+			*nosgio = (errno == ENOTTY || errno == EINVAL);
+			return rc;
+		}
+		rc = sat_complete_io(ata, &io);
+	} while (rc && sat_fallback(ata));
+
 	return rc;
 }
 
 /* initialize the ata_cmd structure with supplied values */
 int ata_setataparams(ATA *ata, int seccount, int count)
 {
+	(void) count;
+
 	/* clear the structure to remove any random values */
 	memset(&ata->atacmd, 0, sizeof(struct ata_cmd));
 	
-	if(seccount != 0)
-		ata->atacmd.sector_number = seccount;
-	else
-		ata->atacmd.sector_count = 1;
+	ata->atacmd.sector_number = seccount;
+	ata->atacmd.timeout = ATA_CMD_TIMEOUT;
 	
 	return 0;
 }
 
 void ata_setdataout_params(ATA *ata, char ** databuf, int nbytes)
 {
-	*databuf = (char*) ata->atacmd.buf;
+	if (nbytes > ATA_DATA_BUFSIZE)
+		nbytes = ATA_DATA_BUFSIZE;
+	memset(ata->data, 0, nbytes);
+	ata->atacmd.sector_count = (nbytes + 511) / 512;
+	*databuf = (char*) ata->data;
 }
 
 
-void ata_setfeature_param(ATA *ata, int feature)
+void ata_setfeature_param(ATA *ata, enum ata_feature feature)
 {
 	ata->atacmd.feature = feature;
 }
+
+void ata_setlba_param(ATA *ata, uint32_t lba)
+{
+	ata->atacmd.lba = lba;
+}
+
+/* the path of a sysfs attribute of the device's SCSI device */
+static int sysfs_devpath(ATA *ata, const char *attr, char *path, size_t len)
+{
+	struct stat sb;
+
+	if (fstat(ata->devhandle.fd, &sb))
+		return -1;
+
+	snprintf(path, len, "/sys/dev/%s/%u:%u/device/%s",
+	    S_ISBLK(sb.st_mode) ? "block" : "char",
+	    major(sb.st_rdev), minor(sb.st_rdev), attr);
+	return 0;
+}
+
+/* read the first line of a sysfs attribute of the device's SCSI device */
+static int sysfs_devattr(ATA *ata, const char *attr, char *buf, size_t len)
+{
+	char path[PATH_MAX];
+	char *p;
+
+	if (sysfs_devpath(ata, attr, path, sizeof(path)))
+		return -1;
+
+	if (ata_readfile(path, buf, len) < 0)
+		return -1;
+
+	/* strip trailing whitespace and the newline */
+	p = strchr(buf, '\n');
+	if (p != NULL)
+		*p = '\0';
+	p = buf + strlen(buf);
+	while (p > buf && (p[-1] == '\n' || p[-1] == ' '))
+		*--p = '\0';
+
+	return 0;
+}
+
+/*
+ * Get a stable identity of the device, and its firmware revision, from
+ * what the kernel learned when it probed the device. The firmware comes
+ * from the copy of the ATA Information VPD page the kernel keeps, as the
+ * INQUIRY revision is the bridge's behind a SAT bridge; kernels that
+ * don't export the page get the INQUIRY revision.
+ */
+int ata_getdevid(ATA *ata, char *devid, size_t idlen,
+		char *firmware, size_t fwlen)
+{
+	char path[PATH_MAX];
+	char page[SAT_VPD_ATA_INFO_LEN + 1];
+	int len;
+
+	if (ata->access_mode == ACCESS_MODE_SIM)
+		return sim_getdevid(ata, devid, idlen, firmware, fwlen);
+	if (ata->access_mode == ACCESS_MODE_REPLAY)
+		return ata_replay_getdevid(ata, devid, idlen, firmware, fwlen);
+
+	if (sysfs_devattr(ata, "wwid", devid, idlen))
+		return -1;
+	if (sysfs_devpath(ata, "vpd_pg89", path, sizeof(path)) == 0 &&
+	    (len = ata_readfile(path, page, sizeof(page))) > 0 &&
+	    sat_vpd_firmware((uint8_t *) page, len, firmware, fwlen) == 0)
+		return 0;
+	if (sysfs_devattr(ata, "rev", firmware, fwlen))
+		firmware[0] = '\0';
+
+	return 0;
+}
+
+/*
+ * Name the controller or enclosure the device hangs off, from where the
+ * kernel put it in the sysfs device tree: the last SAS expander on the
+ * way to it if there is one, otherwise its SCSI host.
+ */
+int ata_getcontroller(ATA *ata, char *name, size_t len)
+{
+	char path[PATH_MAX];
+	char real[PATH_MAX];
+	struct stat sb;
+	const char *p, *found = NULL;
+	size_t n = 0;
+
+	if (ata->access_mode == ACCESS_MODE_SIM)
+		return sim_getcontroller(ata, name, len);
+	if (ata->access_mode == ACCESS_MODE_REPLAY) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	if (fstat(ata->devhandle.fd, &sb))
+		return -1;
+	snprintf(path, sizeof(path), "/sys/dev/%s/%u:%u/device",
+	    S_ISBLK(sb.st_mode) ? "block" : "char",
+	    major(sb.st_rdev), minor(sb.st_rdev));
+	if (realpath(path, real) == NULL)
+		return -1;
+
+	for (p = real; *p != '\0'; p += strcspn(p, "/")) {
+		size_t plen;
+
+		p += strspn(p, "/");
+		plen = strcspn(p, "/");
+		if (strncmp(p, "expander-", 9) == 0 ||
+		    (strncmp(p, "host", 4) == 0 && plen > 4 &&
+		    strspn(p + 4, "0123456789") == plen - 4 &&
+		    (found == NULL || strncmp(found, "expander-", 9) != 0))) {
+			found = p;
+			n = plen;
+		}
+	}
+	if (found == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	snprintf(name, len, "%.*s", (int) n, found);
+	return 0;
+}
+
+/*
+ * Find the name of the whole disk a sysfs block device directory belongs
+ * to, which is the directory itself unless it is a partition.
+ */
+static int sysfs_diskname(const char *dir, char *name, size_t len)
+{
+	char real[PATH_MAX];
+	char path[PATH_MAX];
+	char *p;
+
+	if (realpath(dir, real) == NULL)
+		return -1;
+	snprintf(path, sizeof(path), "%s/partition", real);
+	if (access(path, F_OK) == 0 && (p = strrchr(real, '/')) != NULL)
+		*p = '\0';
+
+	p = strrchr(real, '/');
+	snprintf(name, len, "%s", (p != NULL) ? p + 1 : real);
+	return 0;
+}
+
+/*
+ * Find the md array the device, or one of its partitions, is a member of.
+ * A disk in several arrays is reported in the first by name.
+ */
+int ata_getarray(ATA *ata, char *name, size_t len)
+{
+	char disk[NAME_MAX + 1];
+	char member[NAME_MAX + 1];
+	char path[PATH_MAX];
+	struct dirent **arrays;
+	struct stat sb;
+	int narrays, i;
+	int rc = -1;
+
+	if (ata->access_mode == ACCESS_MODE_SIM)
+		return sim_getarray(ata, name, len);
+	if (ata->access_mode == ACCESS_MODE_REPLAY) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	if (fstat(ata->devhandle.fd, &sb))
+		return -1;
+	if (S_ISBLK(sb.st_mode)) {
+		snprintf(path, sizeof(path), "/sys/dev/block/%u:%u",
+		    major(sb.st_rdev), minor(sb.st_rdev));
+	} else {
+		DIR *dir;
+		struct dirent *de;
+
+		snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/block",
+		    major(sb.st_rdev), minor(sb.st_rdev));
+		dir = opendir(path);
+		if (dir == NULL)
+			return -1;
+		while ((de = readdir(dir)) != NULL && de->d_name[0] == '.')
+			;
+		if (de == NULL) {
+			closedir(dir);
+			errno = ENOENT;
+			return -1;
+		}
+		snprintf(path, sizeof(path), "/sys/class/block/%s", de->d_name);
+		closedir(dir);
+	}
+	if (sysfs_diskname(path, disk, sizeof(disk)))
+		return -1;
+
+	narrays = scandir("/sys/block", &arrays, NULL, alphasort);
+	if (narrays < 0)
+		return -1;
+
+	for (i = 0; i < narrays; i++) {
+		DIR *dir;
+		struct dirent *de;
+
+		if (rc == 0 || strncmp(arrays[i]->d_name, "md", 2) != 0)
+			continue;
+		snprintf(path, sizeof(path), "/sys/block/%s/slaves",
+		    arrays[i]->d_name);
+		dir = opendir(path);
+		if (dir == NULL)
+			continue;
+		while (rc != 0 && (de = readdir(dir)) != NULL) {
+			if (de->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "/sys/class/block/%s",
+			    de->d_name);
+			if (sysfs_diskname(path, member, sizeof(member)) == 0 &&
+			    strcmp(member, disk) == 0) {
+				snprintf(name, len, "%s", arrays[i]->d_name);
+				rc = 0;
+			}
+		}
+		closedir(dir);
+	}
+
+	for (i = 0; i < narrays; i++)
+		free(arrays[i]);
+	free(arrays);
+
+	if (rc)
+		errno = ENOENT;
+	return rc;
+}
+
+/* strip the newline and padding off a value read from sysfs */
+static void sysfs_trim(char *buf)
+{
+	char *p = buf + strlen(buf);
+
+	while (p > buf && (p[-1] == '\n' || p[-1] == ' '))
+		*--p = '\0';
+}
+
+/*
+ * Find the enclosure slot the device sits in, from the link the SES driver
+ * puts next to it, as the logical id of the enclosure and the slot number.
+ * Both survive reboots and recabling, unlike the names of the devices.
+ */
+int ata_getslot(ATA *ata, char *name, size_t len)
+{
+	char path[PATH_MAX];
+	char real[PATH_MAX];
+	char id[64];
+	char slot[32];
+	struct stat sb;
+	DIR *dir;
+	struct dirent *de;
+	char *p;
+
+	if (ata->access_mode == ACCESS_MODE_SIM)
+		return sim_getslot(ata, name, len);
+	if (ata->access_mode == ACCESS_MODE_REPLAY) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	if (fstat(ata->devhandle.fd, &sb))
+		return -1;
+	snprintf(path, sizeof(path), "/sys/dev/%s/%u:%u/device",
+	    S_ISBLK(sb.st_mode) ? "block" : "char",
+	    major(sb.st_rdev), minor(sb.st_rdev));
+	dir = opendir(path);
+	if (dir == NULL)
+		return -1;
+	while ((de = readdir(dir)) != NULL &&
+	    strncmp(de->d_name, "enclosure_device:", 17) != 0)
+		;
+	if (de == NULL) {
+		closedir(dir);
+		errno = ENOENT;
+		return -1;
+	}
+	snprintf(path + strlen(path), sizeof(path) - strlen(path), "/%s",
+	    de->d_name);
+	snprintf(slot, sizeof(slot), "%s", de->d_name + 17);
+	closedir(dir);
+
+	/* .../enclosure/H:C:T:L/component */
+	if (realpath(path, real) == NULL)
+		return -1;
+	snprintf(path, sizeof(path), "%s/slot", real);
+	if (ata_readfile(path, slot, sizeof(slot)) >= 0)
+		sysfs_trim(slot);
+	p = strrchr(real, '/');
+	if (p != NULL)
+		*p = '\0';
+	snprintf(path, sizeof(path), "%s/id", real);
+	if (ata_readfile(path, id, sizeof(id)) >= 0) {
+		sysfs_trim(id);
+		p = (strncmp(id, "0x", 2) == 0) ? id + 2 : id;
+	} else {
+		p = strrchr(real, '/');
+		p = (p != NULL) ? p + 1 : real;
+	}
+
+	snprintf(name, len, "%s/%s", p, slot);
+	return 0;
+}
+
+/*
+ * Tell how the device is attached from where the kernel put it: behind
+ * libata there is an ataN port on the way, behind a USB bridge a USB
+ * device.  Otherwise the SCSI vendor is "ATA" when a SAS HBA translates
+ * for a SATA drive, anything else is a SCSI disk.
+ */
+int ata_gettransport(ATA *ata, enum ata_transport *transport)
+{
+	char path[PATH_MAX];
+	char real[PATH_MAX];
+	char vendor[16];
+	struct stat sb;
+	const char *p;
+
+	switch (ata->access_mode) {
+	case ACCESS_MODE_SIM:
+		*transport = ATA_TRANSPORT_SIM;
+		return 0;
+	case ACCESS_MODE_REPLAY:
+		errno = EOPNOTSUPP;
+		return -1;
+	case ACCESS_MODE_ATA:
+		*transport = ATA_TRANSPORT_ATA;
+		return 0;
+	default:
+		break;
+	}
+
+	if (fstat(ata->devhandle.fd, &sb))
+		return -1;
+	snprintf(path, sizeof(path), "/sys/dev/%s/%u:%u/device",
+	    S_ISBLK(sb.st_mode) ? "block" : "char",
+	    major(sb.st_rdev), minor(sb.st_rdev));
+	if (realpath(path, real) == NULL)
+		return -1;
+
+	*transport = ATA_TRANSPORT_UNKNOWN;
+	for (p = real; *p != '\0'; p += strcspn(p, "/")) {
+		size_t plen;
+
+		p += strspn(p, "/");
+		plen = strcspn(p, "/");
+		if (strncmp(p, "ata", 3) == 0 && plen > 3 &&
+		    strspn(p + 3, "0123456789") == plen - 3)
+			*transport = ATA_TRANSPORT_ATA;
+		else if (strncmp(p, "usb", 3) == 0 &&
+		    *transport == ATA_TRANSPORT_UNKNOWN)
+			*transport = ATA_TRANSPORT_SAT;
+	}
+	if (*transport != ATA_TRANSPORT_UNKNOWN)
+		return 0;
+
+	if (sysfs_devattr(ata, "vendor", vendor, sizeof(vendor)))
+		return -1;
+	*transport = (strcmp(vendor, "ATA") == 0) ?
+	    ATA_TRANSPORT_SAT : ATA_TRANSPORT_SAS;
+	return 0;
+}
+
+/* sda, sdb, ..., sdz, sdaa: shorter names first, as the kernel hands them out */
+static int devnamecmp(const void *a, const void *b)
+{
+	const char *sa = *(const char * const *) a;
+	const char *sb = *(const char * const *) b;
+	size_t la = strlen(sa), lb = strlen(sb);
+
+	if (la != lb)
+		return (la < lb) ? -1 : 1;
+	return strcmp(sa, sb);
+}
+
+/*
+ * List the disks worth trying ATA commands on: the whole disks in
+ * /sys/class/block that are SCSI direct access devices, which is what
+ * libata, SAT bridges and SAS HBAs all show up as.  Partitions, md, dm,
+ * loop and NVMe devices are left out.  Only sysfs is read, none of the
+ * devices are opened.
+ */
+int ata_listdevices(char ***devices, int *ndevices)
+{
+	char path[PATH_MAX];
+	char real[PATH_MAX];
+	char type[8];
+	struct dirent **names;
+	char **list;
+	int n, i;
+	int count = 0;
+
+	n = scandir("/sys/class/block", &names, NULL, NULL);
+	if (n < 0)
+		return -1;
+	list = calloc(n + 1, sizeof(char *));
+
+	for (i = 0; i < n; i++) {
+		const char *name = names[i]->d_name;
+
+		if (list == NULL || name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/block/%s/partition",
+		    name);
+		if (access(path, F_OK) == 0)
+			continue;
+
+		/* the device is on /sys/bus/scsi, and is a disk or RBC disk */
+		snprintf(path, sizeof(path),
+		    "/sys/class/block/%s/device/subsystem", name);
+		if (realpath(path, real) == NULL ||
+		    strcmp(real, "/sys/bus/scsi") != 0)
+			continue;
+		snprintf(path, sizeof(path), "/sys/class/block/%s/device/type",
+		    name);
+		if (ata_readfile(path, type, sizeof(type)) < 0)
+			continue;
+		if (atoi(type) != 0 && atoi(type) != 14)
+			continue;
+
+		list[count] = malloc(strlen("/dev/") + strlen(name) + 1);
+		if (list[count] == NULL) {
+			ata_freedevices(list, count);
+			list = NULL;
+			continue;
+		}
+		sprintf(list[count++], "/dev/%s", name);
+	}
+
+	for (i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+	if (list == NULL)
+		return -1;
+
+	qsort(list, count, sizeof(char *), devnamecmp);
+	*devices = list;
+	*ndevices = count;
+	return 0;
+}
+
+/* when the system was booted, in seconds since the epoch */
+int ata_getboottime(uint64_t *boottime)
+{
+	char line[256];
+	unsigned long btime;
+	FILE *fp;
+	int rc = -1;
+
+	fp = fopen("/proc/stat", "r");
+	if (fp == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "btime %lu", &btime) == 1) {
+			*boottime = btime;
+			rc = 0;
+			break;
+		}
+	}
+	fclose(fp);
+
+	if (rc)
+		errno = ENOENT;
+	return rc;
+}
+
+/*
+ * Read the block layer statistics of the device from sysfs.  For SCSI
+ * generic devices the statistics of the matching disk are used.
+ */
+int ata_getiostat(ATA *ata, struct ata_iostat *stat)
+{
+	char path[PATH_MAX];
+	char buf[256];
+	struct stat sb;
+	uint64_t field[10];
+	char *p;
+	int n;
+
+	if (ata->access_mode == ACCESS_MODE_SIM)
+		return sim_getiostat(ata, stat);
+	if (ata->access_mode == ACCESS_MODE_REPLAY) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+
+	if (fstat(ata->devhandle.fd, &sb))
+		return -1;
+
+	if (S_ISBLK(sb.st_mode)) {
+		snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/stat",
+		    major(sb.st_rdev), minor(sb.st_rdev));
+	} else {
+		DIR *dir;
+		struct dirent *de;
+
+		snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/block",
+		    major(sb.st_rdev), minor(sb.st_rdev));
+		dir = opendir(path);
+		if (dir == NULL)
+			return -1;
+		while ((de = readdir(dir)) != NULL && de->d_name[0] == '.')
+			;
+		if (de == NULL) {
+			closedir(dir);
+			errno = ENOENT;
+			return -1;
+		}
+		snprintf(path, sizeof(path), "/sys/class/block/%s/stat",
+		    de->d_name);
+		closedir(dir);
+	}
+
+	if (ata_readfile(path, buf, sizeof(buf)) < 0)
+		return -1;
+
+	/*
+	 * reads, read merges, read sectors, read ticks, the same for
+	 * writes, requests in flight and I/O ticks
+	 */
+	p = buf;
+	for (n = 0; n < 10; n++) {
+		char *end;
+
+		field[n] = strtoull(p, &end, 10);
+		if (end == p) {
+			errno = EINVAL;
+			return -1;
+		}
+		p = end;
+	}
+
+	stat->reads = field[0];
+	stat->writes = field[4];
+	stat->sectors = field[2] + field[6];
+	stat->in_flight = field[8];
+	stat->io_ticks = field[9];
+
+	return 0;
+}
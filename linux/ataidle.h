@@ -33,12 +33,30 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+/* where the IDENTIFY cache is kept */
+#define ATAIDLE_CACHEDIR	"/var/cache/ataidle"
+
+/*
+ * The first part is the HDIO_DRIVE_CMD argument block, its layout is fixed
+ * by the kernel: sector_number is the ATA count register and sector_count
+ * the number of 512-byte sectors to read into buf.  The SG_IO backend
+ * translates the same fields into an ATA PASS-THROUGH CDB, and transfers
+ * straight into the data buffer of the handle instead of buf.
+ */
 struct ata_cmd {
 	unsigned char cmd;
 	unsigned char sector_number;
 	unsigned char feature;
 	unsigned char sector_count;
 	unsigned char buf[512];
+	/* SG_IO only */
+	unsigned int timeout;		/* seconds */
+	unsigned int lba;		/* 28 bits, the kernel sets it for SMART */
+};
+
+struct ata_dev_handle
+{
+	int			fd;
 };
 
 #endif /* ATAIDLE_H */
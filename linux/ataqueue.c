@@ -0,0 +1,368 @@
+/*-
+ *  
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ */
+
+/*
+ * Asynchronous command queue using the write()/poll()/read() interface of
+ * the sg driver.  Each handle gets its own file descriptor on the matching
+ * /dev/sgN node, with at most one command in flight, so a single thread
+ * can keep a command running on every drive at once.  Handles which can't
+ * be reached through sg run their commands synchronously instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <scsi/sg.h>
+
+#include "ataidle.h"
+#include "sgio.h"
+#include "../mi/atagen.h"
+#include "../mi/atadefs.h"
+#include "../mi/util.h"
+#include "../mi/sat.h"
+#include "../mi/stats.h"
+#include "../mi/trace.h"
+
+#define SCSI_GENERIC_MAJOR	21
+
+struct ata_qreq
+{
+	struct ata_qreq *	next;
+	struct ata_cmd		atacmd;
+	enum ata_command	cmd;
+	ata_done_t		done;
+	void *			arg;
+};
+
+struct ata_qdev
+{
+	ATA *			ata;
+	int			sgfd;	/* -1 to run synchronously */
+	bool			busy;
+	struct ata_qreq *	head;	/* head is in flight when busy */
+	struct ata_qreq *	tail;
+	union sat_cdb		cdb;
+	struct sg_io_hdr	io;
+	uint64_t		start;	/* for ata_stats_end() */
+	uint64_t		tstart;	/* for ata_trace_end() */
+};
+
+struct ata_queue
+{
+	struct ata_qdev **	devs;
+	int			ndevs;
+	struct pollfd *		pfds;
+	struct ata_qdev **	polled;
+	int			inflight;
+};
+
+static int	sg_open( ATA *ata );
+static struct ata_qdev *	queue_dev( struct ata_queue *queue, ATA *ata );
+static void	queue_trace( struct ata_qdev *qd, int rc );
+static void	queue_finish( struct ata_qdev *qd, int rc );
+static int	queue_start( struct ata_queue *queue );
+
+/* open the sg node belonging to the device for reading and writing */
+static int sg_open( ATA *ata )
+{
+	char path[PATH_MAX];
+	struct stat sb;
+
+	if (ata->access_mode != ACCESS_MODE_SAT ||
+	    fstat(ata->devhandle.fd, &sb))
+		return -1;
+
+	if (S_ISCHR(sb.st_mode) && major(sb.st_rdev) == SCSI_GENERIC_MAJOR) {
+		snprintf(path, sizeof(path), "/dev/sg%u", minor(sb.st_rdev));
+	} else if (S_ISBLK(sb.st_mode)) {
+		DIR *dir;
+		struct dirent *de;
+
+		snprintf(path, sizeof(path),
+		    "/sys/dev/block/%u:%u/device/scsi_generic",
+		    major(sb.st_rdev), minor(sb.st_rdev));
+		dir = opendir(path);
+		if (dir == NULL)
+			return -1;
+		while ((de = readdir(dir)) != NULL && de->d_name[0] == '.')
+			;
+		if (de == NULL) {
+			closedir(dir);
+			return -1;
+		}
+		snprintf(path, sizeof(path), "/dev/%s", de->d_name);
+		closedir(dir);
+	} else {
+		return -1;
+	}
+
+	return open(path, O_RDWR | O_NONBLOCK);
+}
+
+struct ata_queue * ata_queue_new( void )
+{
+	return calloc(1, sizeof(struct ata_queue));
+}
+
+/* find the queue of a handle, setting it up the first time it is used */
+static struct ata_qdev * queue_dev( struct ata_queue *queue, ATA *ata )
+{
+	struct ata_qdev **devs;
+	struct ata_qdev *qd;
+	struct pollfd *pfds;
+	int i;
+
+	for (i = 0; i < queue->ndevs; i++)
+		if (queue->devs[i]->ata == ata)
+			return queue->devs[i];
+
+	qd = calloc(1, sizeof(struct ata_qdev));
+	if (qd == NULL)
+		return NULL;
+	qd->ata = ata;
+	qd->sgfd = sg_open(ata);
+
+	devs = realloc(queue->devs, (queue->ndevs + 1) * sizeof(*devs));
+	if (devs == NULL)
+		goto fail;
+	queue->devs = devs;
+	devs = realloc(queue->polled, (queue->ndevs + 1) * sizeof(*devs));
+	if (devs == NULL)
+		goto fail;
+	queue->polled = devs;
+	pfds = realloc(queue->pfds, (queue->ndevs + 1) * sizeof(*pfds));
+	if (pfds == NULL)
+		goto fail;
+	queue->pfds = pfds;
+
+	queue->devs[queue->ndevs++] = qd;
+	return qd;
+
+fail:
+	if (qd->sgfd != -1)
+		close(qd->sgfd);
+	free(qd);
+	return NULL;
+}
+
+/* queue the command prepared on the handle, it is sent by ata_queue_run() */
+int ata_queue_submit( struct ata_queue *queue, ATA *ata,
+		enum ata_command atacmd, ata_done_t done, void *arg )
+{
+	struct ata_qdev *qd;
+	struct ata_qreq *req;
+
+	qd = queue_dev(queue, ata);
+	if (qd == NULL)
+		return -1;
+
+	req = malloc(sizeof(struct ata_qreq));
+	if (req == NULL)
+		return -1;
+	req->next = NULL;
+	memcpy(&req->atacmd, &ata->atacmd, sizeof(struct ata_cmd));
+	req->cmd = atacmd;
+	req->done = done;
+	req->arg = arg;
+
+	if (qd->tail != NULL)
+		qd->tail->next = req;
+	else
+		qd->head = req;
+	qd->tail = req;
+
+	return 0;
+}
+
+/* add the command at the head of the queue to the trace of its handle */
+static void queue_trace( struct ata_qdev *qd, int rc )
+{
+	struct ata_cmd *c = &qd->head->atacmd;
+
+	ata_trace_end(qd->ata, qd->head->cmd, c->feature, c->sector_number,
+	    c->lba, c->sector_count * 512, rc, qd->tstart);
+}
+
+/* remove the command at the head of the queue and tell the caller */
+static void queue_finish( struct ata_qdev *qd, int rc )
+{
+	struct ata_qreq *req = qd->head;
+	int saved_errno = errno;
+
+	qd->head = req->next;
+	if (qd->head == NULL)
+		qd->tail = NULL;
+	qd->busy = false;
+
+	errno = saved_errno;
+	if (req->done != NULL)
+		req->done(qd->ata, rc, req->arg);
+	free(req);
+}
+
+/* send the next command of every idle handle, returns how many were sent */
+static int queue_start( struct ata_queue *queue )
+{
+	int started = 0;
+	int i;
+
+	for (i = 0; i < queue->ndevs; i++) {
+		struct ata_qdev *qd = queue->devs[i];
+
+		while (!qd->busy && qd->head != NULL) {
+			ATA *ata = qd->ata;
+			ssize_t rc = -1;
+
+			memcpy(&ata->atacmd, &qd->head->atacmd,
+			    sizeof(struct ata_cmd));
+
+			if (qd->sgfd == -1) {
+				queue_finish(qd, ata_cmd(ata, qd->head->cmd, 0));
+				continue;
+			}
+
+			qd->start = ata_stats_begin(ata, qd->head->cmd);
+			qd->tstart = ata_trace_begin(ata);
+			ata->atacmd.cmd = qd->head->cmd;
+			memset(&ata->regs, 0, sizeof(struct ata_regs));
+			if (sat_prepare_io(ata, &qd->cdb, &qd->io) == 0) {
+				qd->io.usr_ptr = qd;
+				rc = write(qd->sgfd, &qd->io,
+				    sizeof(struct sg_io_hdr));
+			}
+			if (rc != sizeof(struct sg_io_hdr)) {
+				ata_stats_end(ata, qd->head->cmd, -1, qd->start);
+				queue_trace(qd, -1);
+				queue_finish(qd, -1);
+				continue;
+			}
+
+			qd->busy = true;
+			queue->inflight++;
+			started++;
+		}
+	}
+
+	return started;
+}
+
+/*
+ * Send queued commands and wait for them to complete, until there is
+ * nothing left to do.
+ */
+int ata_queue_run( struct ata_queue *queue )
+{
+	int i, n;
+
+	for (;;) {
+		queue_start(queue);
+		if (queue->inflight == 0)
+			break;
+
+		for (i = 0, n = 0; i < queue->ndevs; i++) {
+			if (!queue->devs[i]->busy)
+				continue;
+			queue->pfds[n].fd = queue->devs[i]->sgfd;
+			queue->pfds[n].events = POLLIN;
+			queue->pfds[n].revents = 0;
+			queue->polled[n++] = queue->devs[i];
+		}
+
+		if (poll(queue->pfds, n, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		for (i = 0; i < n; i++) {
+			struct ata_qdev *qd = queue->polled[i];
+			int rc;
+
+			if (queue->pfds[i].revents == 0)
+				continue;
+
+			if (read(qd->sgfd, &qd->io, sizeof(struct sg_io_hdr)) ==
+			    sizeof(struct sg_io_hdr))
+				rc = sat_complete_io(qd->ata, &qd->io);
+			else if (errno == EAGAIN)
+				continue;
+			else
+				rc = -1;
+
+			queue->inflight--;
+			/* send it again as PASS-THROUGH(16) */
+			if (rc && sat_fallback(qd->ata)) {
+				qd->busy = false;
+				continue;
+			}
+			if (rc == 0)
+				qd->ata->satworked = true;
+			ata_stats_end(qd->ata, qd->head->cmd, rc, qd->start);
+			queue_trace(qd, rc);
+			queue_finish(qd, rc);
+		}
+	}
+
+	return 0;
+}
+
+void ata_queue_free( struct ata_queue *queue )
+{
+	int i;
+
+	if (queue == NULL)
+		return;
+
+	for (i = 0; i < queue->ndevs; i++) {
+		struct ata_qdev *qd = queue->devs[i];
+
+		while (qd->head != NULL) {
+			struct ata_qreq *req = qd->head;
+
+			qd->head = req->next;
+			free(req);
+		}
+		if (qd->sgfd != -1)
+			close(qd->sgfd);
+		free(qd);
+	}
+
+	free(queue->devs);
+	free(queue->polled);
+	free(queue->pfds);
+	free(queue);
+}
@@ -0,0 +1,12 @@
+#ifndef SGIO_H
+#define SGIO_H
+
+#include <scsi/sg.h>
+
+#include "../mi/atagen.h"
+
+/* shared by the SG_IO ioctl and the asynchronous sg queue */
+int	sat_prepare_io( ATA *ata, union sat_cdb *cdb, struct sg_io_hdr *io );
+int	sat_complete_io( ATA *ata, const struct sg_io_hdr *io );
+
+#endif /* SGIO_H */
@@ -30,6 +30,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <glob.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,10 +39,26 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
+#include "mi/adaptive.h"
+#include "mi/apply.h"
 #include "mi/atadefs.h"
 #include "mi/util.h"
 #include "mi/atagen.h"
+#include "mi/cache.h"
+#include "mi/cycles.h"
+#include "mi/discover.h"
+#include "mi/inventory.h"
+#include "mi/metrics.h"
+#include "mi/plan.h"
+#include "mi/profile.h"
+#include "mi/show.h"
+#include "mi/sim.h"
+#include "mi/spindown.h"
+#include "mi/stats.h"
+#include "mi/trace.h"
+#include "mi/wake.h"
 
 #ifdef __FreeBSD__
 	#include <osreldate.h>
@@ -51,126 +68,1127 @@
 	#endif
 #endif
 
-int main( int argc, char ** argv )
+/* default number of devices worked on at the same time */
+#define ATAIDLE_DEFAULT_JOBS	16
+
+/* options without a short form */
+enum {
+	OPT_STATS = 256,
+	OPT_METRICS,
+	OPT_INTERVAL,
+	OPT_PROFILE,
+	OPT_BUDGET,
+	OPT_CYCLES,
+	OPT_INVENTORY,
+	OPT_TRACE,
+	OPT_WAKE,
+	OPT_POWERTABLE,
+	OPT_GROUP,
+	OPT_APMSWITCH,
+	OPT_DISCOVER,
+	OPT_APPLY
+};
+
+/* options which check the IDENTIFY data before doing anything */
+#define ATA_OPS_NEED_IDENT	"SoIAP"
+
+/* options which can be sent to many devices at once from one process */
+#define ATA_OPS_ASYNC	"cis"
+
+/* a device being worked on by a child process */
+struct ata_job
+{
+	const char *	device;
+	pid_t		pid;
+	FILE *		out;
+	FILE *		err;
+	FILE *		stats;
+};
+
+/* a device being worked on through the command queue */
+struct ata_async
+{
+	const struct ata_target *	target;
+	struct ata_queue *	queue;
+	ATA *			ata;
+	int			next;	/* the operation in flight */
+	int			rc;
+};
+
+/* the device guard_op() is relaxing the operations of, for --apply */
+struct guard_arg
+{
+	const char *	device;
+	int		over;
+};
+
+/* IDENTIFY cache directory, NULL if -n was given */
+static const char *cachedir = ATAIDLE_CACHEDIR;
+
+/* ratings the standby timers and APM levels are kept within */
+static struct cycles_limits cyclelimits = {
+	CYCLES_DEFAULT_LOAD, CYCLES_DEFAULT_STARTSTOP, CYCLES_DEFAULT_HOURS
+};
+
+/* --stats, where the command times of each device are printed */
+static bool showstats = false;
+static bool statsjson = false;
+static bool statsprobe = false;
+static FILE *statsout = NULL;
+/* --trace, the file every command is recorded in */
+static int tracefd = -1;
+/* --apply, where only the settings which differ are sent */
+static bool applying = false;
+static bool applycheck = false;
+
+static ATA *	open_device( const char *device, int *exitval );
+static void	close_device( ATA **ata, const char *device );
+static void	usage( void );
+static void	timer_error( long mins, const char *what );
+static int	run_op( ATA *ata, const struct ata_ident *ident,
+		    const struct ata_op *op );
+static void	guard_op( ATA *ata, const char *device, struct ata_op *op,
+		    int live, int *over );
+static void	guard_apply( ATA *ata, struct ata_op *op, bool live,
+		    void *arg );
+static int	run_device( const struct ata_target *target );
+static int	run_parallel( const struct ata_target *targets, int ntargets,
+		    int maxjobs );
+static bool	can_run_async( const struct ata_target *targets,
+		    int ntargets );
+static int	run_async( const struct ata_target *targets, int ntargets );
+static void	async_submit( struct ata_async *dev );
+static void	async_done( ATA *ata, int rc, void *arg );
+static ATA **	open_devices( char **devices, int ndevices,
+		    int *exitval );
+static void	close_devices( ATA **atas, char **devices, int ndevices );
+static int	run_spindown( char **devices, int ndevices,
+		    uint32_t timeout, uint32_t budget, char **groups,
+		    int ngroups, const struct apm_policy *apm );
+static int	run_metrics( char **devices, int ndevices,
+		    const char *path, uint32_t interval );
+static int	run_profile( char **devices, int ndevices, int rounds );
+static int	run_wake( char **devices, int ndevices, double budget,
+		    const char *table );
+static void	copy_prefixed( FILE *from, FILE *to, const char *prefix );
+static int	find_devices( char **args, int nargs, int maxjobs,
+		    struct discover_dev **devs );
+static int	run_discover( char **args, int nargs, int maxjobs,
+		    bool json );
+
+/* show the options and exit */
+static void usage( void )
+{
+	printf( "ataidle version " ATAIDLE_VERSION "\n\n"
+			"usage: \n"
+			"ataidle [-h] [-c] [-n] [-i] [-s] [-o] [-I idle] [-S standby] [-A acoustic] [-P apm]\n"
+			"\t[-j jobs] [-D spindown|auto [--latency-budget time] [--group devices]]\n"
+			"\t[--apm-switch level[:MB/s]] [--stats[=json]] [--metrics file [--interval time]]\n"
+			"\t[--profile-resume rounds] [--cycle-limit load[:startstop[:hours]]] [--trace file]\n"
+			"\t[--wake watts [--power-table file]] [--apply[=check]] device ...\n");
+	printf(
+			"ataidle [-n] [-j jobs] [-D spindown] [--stats[=json]] [--trace file]\n"
+			"\t[--apply[=check]] -f plan\n"
+			"ataidle --inventory[=json] dump ...\n"
+			"ataidle --discover[=json] [-n] [-j jobs] [device ...]\n\n"
+			"Options:\n");
+	printf(
+			"-h\t\tdisplay this help and exit\n"
+			"-I\t\tset the idle timeout in minutes\n"
+			"-i\t\tput the drive into idle mode\n"
+			"-S\t\tset the standby timeout in minutes\n"
+			"-s\t\tput the drive into standby mode\n"
+			"-o\t\tput the drive into sleep mode\n"
+			"-c\t\tshow the power mode without waking the drive\n"
+			"-A\t\tset the acoustic level, values 1-127\n"
+			"-P\t\tset the power management level, values 1-254\n");
+	printf(
+			"-n\t\tdon't use cached IDENTIFY data\n"
+			"-j\t\tnumber of devices to work on at once\n"
+			"-f\t\tread 'device operation [value]' lines from a file\n"
+			"-D\t\tstay running and put the drives into standby mode\n"
+			"\t\tafter this many minutes (or Ns, Nm, Nh) without I/O,\n"
+			"\t\tor auto to choose the time from each drive's I/O\n"
+			"--latency-budget spin-up wait allowed per hour with -D auto\n");
+	printf(
+			"--group\t\tcomma separated devices which -D spins down and\n"
+			"\t\tup together, as it does the members of md arrays\n"
+			"--apm-switch\tstay running and set APM to this level while the\n"
+			"\t\tdrive is quiet, and 254 while it does over MB/s (16)\n");
+	printf(
+			"--stats\t\tshow how long each command took, as text or json;\n"
+			"\t\tprobe sends CHECK POWER MODE to tell spin-ups apart\n"
+			"--trace\t\trecord every command and its result in a file,\n"
+			"\t\twhich can be played back with replay:file\n"
+			"--apply\t\tonly send the settings which differ from the\n"
+			"\t\tdrive's, printing each, or with check only print them\n");
+	printf(
+			"--cycle-limit\trated load and start/stop cycles and service\n"
+			"\t\thours; -S, -I, -P and -D are relaxed for drives which\n"
+			"\t\twould exceed them, 0 turns this off\n");
+	printf(
+			"--metrics\tstay running and write Prometheus metrics to a file\n"
+			"--interval\thow often to update the metrics, default 60s\n"
+			"--profile-resume\ttime the wake-up from each power mode\n");
+	printf(
+			"--wake\t\tspin the drives up, overlapping them while the\n"
+			"\t\tdrives on each controller draw at most this many watts\n"
+			"--power-table\tthe watts drawn by each drive model, and the\n"
+			"\t\tbudget of each controller, for --wake\n"
+			"--inventory\tdecode files, or directories of files, of raw\n"
+			"\t\tIDENTIFY data as CSV or json\n");
+	printf(
+			"--discover\tlist the devices given, or every disk found,\n"
+			"\t\twith how they are attached and who they are\n"
+			"device\t\tthe device node e.g /dev/ad0, or a pattern, or\n"
+			"\t\twwn:name, model:pattern or slot:enclosure/slot to\n"
+			"\t\tpick disks by what --discover shows\n\n"
+			"if no options are specified, information\n"
+			"about the device will be displayed\n\n");
+
+	exit(EX_USAGE);
+}
+
+/* explain why a timer value was refused */
+static void timer_error( long mins, const char *what )
+{
+	if (errno != EINVAL)
+		warn("%s", what);
+	else if (mins > 21 && mins < 30)
+		warnx("cannot set timeout for values 20-30 minutes");
+	else
+		warnx("idle value must be a multiple of 30 minutes, "
+		    "up to 5 hours");
+}
+
+/* apply a single option to an opened device */
+static int run_op( ATA *ata, const struct ata_ident *ident,
+		const struct ata_op *op )
+{
+	int rc = 0;
+
+	switch(op->ch)
+	{
+		/* S = Standby */
+		case 'S':
+			if (!(ident->cmd_supp1 & ATA_PM_SUPPORTED)) {
+				warnx("the device does not support power management");
+				break;
+			}
+			rc = ata_setstandbytimer( ata, op->val );
+			if (rc)
+				timer_error(op->val, "error setting idle timeout");
+			else if (op->val == 0)
+				printf("turned off standby timer\n");
+			else
+				printf("standby timer set to %ld minutes\n", op->val);
+			break;
+
+		case 's':
+			rc = ata_setstandbytimer( ata, ATA_IDLEVAL_IMMEDIATE );
+			if (rc)
+				warn("error setting idle timeout");
+			else
+				printf("drive set to standby immediately\n");
+			break;
+
+		/* o = Sleep (off) */
+		case 'o':
+			if (!(ident->cmd_supp1 & ATA_PM_SUPPORTED)) {
+				warnx("the device does not support power management");
+				break;
+			}
+			rc = ata_sleep( ata );
+			if (rc)
+				warn("error setting sleep mode");
+			else
+				printf("drive set to sleep\n");
+			break;
+
+		/* I = Idle */
+		case 'I':
+			if (!(ident->cmd_supp1 & ATA_PM_SUPPORTED)) {
+				warnx("the device does not support power management");
+				break;
+			}
+			rc = ata_setidletimer( ata, op->val );
+			if (rc)
+				timer_error(op->val, "error setting idle timeout");
+			else if (op->val == 0)
+				printf("turned off idle timer\n");
+			else
+				printf("idle timer set to %ld minutes\n", op->val);
+			break;
+
+		case 'i':
+			rc = ata_setidletimer(ata, ATA_IDLEVAL_IMMEDIATE);
+			if (rc)
+				warn("error setting idle timeout");
+			else
+				printf("drive set to idle immediately\n");
+			break;
+
+		/* c = Check power mode */
+		case 'c':
+			{
+				enum ata_power_mode mode;
+
+				rc = ata_checkpowermode( ata, &mode );
+				/* a drive in sleep mode doesn't answer */
+				if (rc && errno == ETIMEDOUT) {
+					mode = ATA_POWER_SLEEP;
+					rc = 0;
+				}
+				if (rc)
+					warn("check power mode failed");
+				else
+					printf("power mode: %s\n",
+					    ata_powermodestring(mode));
+			}
+			break;
+
+		/* A = AutoAcoustic */
+		case 'A':
+			if (!(ident->cmd_supp2 & ATA_AAM_SUPPORTED)) {
+				warnx("the device does not support acoustic management");
+				break;
+			}
+			rc = ata_setacoustic( ata, op->val );
+			if (rc && errno == EINVAL)
+				warnx("invalid acoustic value: must be %d-%d", 1,
+				    ATA_AUTOACOUSTIC_MAXPERF - 127);
+			else if (rc)
+				warn("set AAM failed");
+			else {
+				printf("AAM set to %ld\n", op->val);
+				if (op->val + 127 == ATA_AUTOACOUSTIC_MAXPERF)
+					printf("AAM set to maximum performance\n");
+				else if (op->val + 127 == ATA_AUTOACOUSTIC_MINPERF)
+					printf("AAM set to quietest setting\n");
+				else if (op->val == 0)
+					printf("AAM disabled\n");
+			}
+			break;
+
+		/* P = Power (APM) */
+		case 'P':
+			if (!(ident->cmd_supp2 & ATA_APM_SUPPORTED)) {
+				warnx("the device does not support advanced power management");
+				break;
+			}
+			rc = ata_setapm( ata, op->val );
+			if (rc && errno == EINVAL)
+				warnx("invalid APM value: must be %d-%d",
+				    ATA_APM_MINPERF, ATA_APM_MAXPERF);
+			else if (rc)
+				warn("set APM failed");
+			else {
+				printf("APM set to %ld\n", op->val);
+				if (op->val == ATA_APM_MAXPERF)
+					printf("APM set to highest power consumption\n");
+				else if (op->val == ATA_APM_MINPERF)
+					printf("APM set to lowest power consumption\n");
+				else if (op->val == 0)
+					printf("APM Disabled\n");
+			}
+			break;
+	}
+
+	return rc;
+}
+
+/*
+ * Relax a standby timer or APM level which would make the drive wear out
+ * its rated load or start/stop cycles early.  over caches the verdict for
+ * the device, -1 until it is known.  The drive is asked for its counters
+ * if live is 1, or if it is -1 and CHECK POWER MODE finds it spinning, as
+ * reading them spins it up; otherwise the counters recorded before are
+ * used.
+ */
+static void guard_op( ATA *ata, const char *device, struct ata_op *op,
+		int live, int *over )
+{
+	struct cycles_status st;
+	uint32_t relaxed;
+
+	if (cyclelimits.load == 0 || op->val <= 0)
+		return;
+
+	switch (op->ch) {
+		case 'S':
+		case 'I':
+			relaxed = cycles_relax_standby( op->val );
+			break;
+		case 'P':
+			relaxed = cycles_relax_apm( op->val );
+			break;
+		default:
+			return;
+	}
+	if (relaxed == op->val)
+		return;
+
+	if (*over < 0) {
+		if (live < 0) {
+			enum ata_power_mode mode;
+
+			live = (ata_checkpowermode( ata, &mode ) == 0 &&
+			    (mode == ATA_POWER_ACTIVE || mode == ATA_POWER_IDLE));
+		}
+		if (live)
+			*over = (cycles_check( ata, &cyclelimits, &st ) == 0 &&
+			    st.over);
+		else
+			*over = (cycles_check_saved( ata, &cyclelimits,
+			    &st ) == 0 && st.over);
+		if (*over)
+			cycles_warn( device, &cyclelimits, &st );
+	}
+	if (*over) {
+		warnx("%s: using -%c %lu instead of %ld", device, op->ch,
+		    (unsigned long) relaxed, op->val);
+		op->val = relaxed;
+	}
+}
+
+/* guard_op() for apply_device(), which says when the drive may be asked */
+static void guard_apply( ATA *ata, struct ata_op *op, bool live, void *arg )
+{
+	struct guard_arg *guard = arg;
+
+	guard_op( ata, guard->device, op, live, &guard->over );
+}
+
+/* check that device is a device node, or simulated, and open it */
+static ATA * open_device( const char *device, int *exitval )
+{
+	int rc;
+	ATA *ata = NULL;
+	struct stat sb;
+
+	if (!sim_isdevice( device ) && !trace_isreplay( device )) {
+		rc = stat( device, &sb );
+		if (rc) {
+			warn("%s", device);
+			*exitval = EX_OSFILE;
+			return NULL;
+		}
+
+		if (!S_ISBLK(sb.st_mode) && !S_ISCHR(sb.st_mode)) {
+			warnx("%s isn't a device node", device);
+			*exitval = EX_OSFILE;
+			return NULL;
+		}
+	}
+
+	rc = ata_open( &ata, device );
+	if (rc <= 0) {
+		warn("error opening %s", device);
+		*exitval = EX_IOERR;
+		return NULL;
+	}
+	ata->cachedir = cachedir;
+	if (showstats && ata_stats_enable( ata, statsprobe ))
+		err(EX_OSERR, NULL);
+	if (tracefd != -1 && ata_trace_enable( ata, tracefd, device ))
+		err(EX_OSERR, NULL);
+
+	return ata;
+}
+
+/* show the command times of a device, if asked to, and close it */
+static void close_device( ATA **ata, const char *device )
+{
+	if (showstats)
+		ata_stats_print( statsout, device, ata_stats_get( *ata ),
+		    statsjson );
+	ata_close( ata );
+}
+
+/* open a device and apply all its operations, returns an exit status */
+static int run_device( const struct ata_target *target )
 {
 	int rc = 0;
+	int i;
 	ATA *ata;
-	long opt_val;
-	int ch;
 	struct ata_ident ident;
-	const char * const optstr = "hA:S:sI:iP:o";
+	int over = -1;
+	const char *device = target->device;
+	const struct ata_op *ops = target->ops;
+	int nops = target->nops;
 
-	/* need more than just the executable name */
-	if( argc == 1 )
-		usage();
+	ata = open_device( device, &rc );
+	if (ata == NULL)
+		return rc;
+
+	/* no options, so just show what we know about the device */
+	if (nops == 0) {
+		ata_showdeviceinfo(ata);
+		close_device( &ata, device );
+		return 0;
+	}
 
-	/* now we've done all the checking of parameters etc.,
-	 * let's see what the user wants us to do.
+	/* compare with the drive and send only what differs */
+	if (applying) {
+		struct guard_arg guard;
+
+		guard.device = device;
+		guard.over = -1;
+		rc = apply_device( ata, ops, nops, applycheck, guard_apply,
+		    &guard, stdout );
+		close_device( &ata, device );
+		return (rc ? EX_IOERR : 0);
+	}
+
+	/*
+	 * IDENTIFY is only needed to check what the device supports, and
+	 * some drives spin up for it, so skip it if nothing needs checking.
 	 */
+	memset(&ident, 0, sizeof(struct ata_ident));
+	for (i = 0; i < nops; i++)
+		if (strchr(ATA_OPS_NEED_IDENT, ops[i].ch) != NULL)
+			break;
+
+	if (i < nops) {
+		rc = ata_getident( ata, &ident );
+		if (rc) {
+			warnx("an error occurred identifying the device %s", device);
+			close_device( &ata, device );
+			return EX_SOFTWARE;
+		}
+	}
+
+	for (i = 0; i < nops; i++) {
+		struct ata_op op = ops[i];
+
+		guard_op( ata, device, &op, -1, &over );
+		rc = run_op( ata, &ident, &op );
+	}
+
+	close_device( &ata, device );
+
+	return (rc & 0xFF);
+}
+
+/*
+ * write each line of a captured output file, prefixed with the device
+ * unless prefix is NULL
+ */
+static void copy_prefixed( FILE *from, FILE *to, const char *prefix )
+{
+	char line[1024];
+	bool bol = true;
+
+	rewind(from);
+	while (fgets(line, sizeof(line), from) != NULL) {
+		if (bol && prefix != NULL)
+			fprintf(to, "%s: ", prefix);
+		fputs(line, to);
+		bol = (strchr(line, '\n') != NULL);
+	}
+	if (!bol)
+		fputc('\n', to);
+	fclose(from);
+}
+
+/*
+ * Work on up to maxjobs devices at once, each in its own process so a slow
+ * or spun down drive doesn't hold up the others.  The output of each device
+ * is collected and printed when it's done.  The exit status is the highest
+ * exit status of any device.
+ */
+static int run_parallel( const struct ata_target *targets, int ntargets,
+		int maxjobs )
+{
+	struct ata_job *jobs;
+	int next = 0;
+	int running = 0;
+	int rc = 0;
+	int i;
+
+	jobs = calloc(ntargets, sizeof(struct ata_job));
+	if (jobs == NULL)
+		err(EX_OSERR, NULL);
+
+	while (next < ntargets || running > 0) {
+		pid_t pid;
+		int status;
+		int exitval;
+
+		while (running < maxjobs && next < ntargets) {
+			struct ata_job *job = &jobs[next++];
+
+			job->device = targets[next-1].device;
+			job->out = tmpfile();
+			job->err = tmpfile();
+			job->stats = tmpfile();
+			if (job->out == NULL || job->err == NULL ||
+			    job->stats == NULL)
+				err(EX_OSERR, "tmpfile");
+
+			fflush(stdout);
+			fflush(stderr);
+			job->pid = fork();
+			if (job->pid == -1)
+				err(EX_OSERR, "fork");
 
-	/* if we've got a non-option string, 
-	 * see if it's a device node */
-	if (argv[argc-1][0] != '-') {
-		struct stat sb;
-		rc = stat( argv[argc-1], &sb );
-		if (rc)
-			err(EX_OSFILE, "%s", argv[argc-1]);
+			if (job->pid == 0) {
+				dup2(fileno(job->out), STDOUT_FILENO);
+				dup2(fileno(job->err), STDERR_FILENO);
+				/* already tagged with the device */
+				statsout = job->stats;
+				exit(run_device(&targets[next-1]));
+			}
+			running++;
+		}
+
+		pid = waitpid(-1, &status, 0);
+		if (pid == -1) {
+			if (errno == EINTR)
+				continue;
+			err(EX_OSERR, "waitpid");
+		}
+
+		for (i = 0; i < next; i++)
+			if (jobs[i].pid == pid)
+				break;
+		if (i == next)
+			continue;
+		running--;
+
+		exitval = WIFEXITED(status) ? WEXITSTATUS(status) : EX_SOFTWARE;
+		copy_prefixed(jobs[i].out, stdout, jobs[i].device);
+		copy_prefixed(jobs[i].err, stderr, jobs[i].device);
+		copy_prefixed(jobs[i].stats, stdout, NULL);
+		if (exitval)
+			fprintf(stderr, "%s: failed with exit status %d\n",
+			    jobs[i].device, exitval);
+		fflush(stdout);
+		fflush(stderr);
+
+		if (exitval > rc)
+			rc = exitval;
+	}
+
+	free(jobs);
+
+	return rc;
+}
+
+/* check whether every operation of every target can go through the queue */
+static bool can_run_async( const struct ata_target *targets, int ntargets )
+{
+	int i, j;
+
+	for (i = 0; i < ntargets; i++) {
+		if (targets[i].nops == 0)
+			return false;
+		for (j = 0; j < targets[i].nops; j++)
+			if (strchr(ATA_OPS_ASYNC, targets[i].ops[j].ch) == NULL)
+				return false;
+	}
+
+	return true;
+}
+
+/* queue the next operation of a device */
+static void async_submit( struct ata_async *dev )
+{
+	enum ata_command cmd;
+
+	switch (dev->target->ops[dev->next].ch)
+	{
+		case 'c':
+			cmd = ATA_CHECK_POWER_MODE;
+			break;
+		case 'i':
+			cmd = ATA_IDLE_IMMEDIATE;
+			break;
+		case 's':
+		default:
+			cmd = ATA_STANDBY_IMMEDIATE;
+			break;
+	}
+
+	ata_setataparams( dev->ata, 0, 0 );
+	if (ata_queue_submit( dev->queue, dev->ata, cmd, async_done, dev ))
+		err(EX_OSERR, NULL);
+}
+
+/* report a completed operation and queue the device's next one */
+static void async_done( ATA *ata, int rc, void *arg )
+{
+	struct ata_async *dev = arg;
+	const char *device = dev->target->device;
+	int ch = dev->target->ops[dev->next].ch;
+
+	if (rc && ch == 'c' && errno == ETIMEDOUT) {
+		/* a drive in sleep mode doesn't answer until it is reset */
+		printf("%s: power mode: %s\n", device,
+		    ata_powermodestring(ATA_POWER_SLEEP));
+		rc = 0;
+	} else if (rc)
+		warn("%s: %s failed", device, (ch == 'c') ? "check power mode" :
+		    (ch == 'i') ? "idle" : "standby");
+	else if (ch == 'c')
+		printf("%s: power mode: %s\n", device,
+		    ata_powermodestring(ata_decodepowermode(&ata->regs)));
+	else
+		printf("%s: drive set to %s immediately\n", device,
+		    (ch == 'i') ? "idle" : "standby");
+	dev->rc = rc & 0xFF;
+
+	if (++dev->next < dev->target->nops)
+		async_submit( dev );
+}
+
+/*
+ * Send the operations of every device from this process through the
+ * command queue, so the commands for all drives are in flight at once
+ * without a process per device.  Only used for the commands which need
+ * no checks or replies beyond the result registers.
+ */
+static int run_async( const struct ata_target *targets, int ntargets )
+{
+	struct ata_async *devs;
+	struct ata_queue *queue;
+	int rc = 0;
+	int i;
+
+	devs = calloc(ntargets, sizeof(struct ata_async));
+	queue = ata_queue_new();
+	if (devs == NULL || queue == NULL)
+		err(EX_OSERR, NULL);
+
+	for (i = 0; i < ntargets; i++) {
+		devs[i].target = &targets[i];
+		devs[i].queue = queue;
+		devs[i].ata = open_device( targets[i].device, &devs[i].rc );
+		if (devs[i].ata != NULL)
+			async_submit( &devs[i] );
+	}
 
-		if (S_ISBLK(sb.st_mode) || S_ISCHR(sb.st_mode))
-			rc = ata_open( &ata, argv[argc-1] );
+	if (ata_queue_run( queue ))
+		err(EX_OSERR, "poll");
+	ata_queue_free( queue );
+
+	for (i = 0; i < ntargets; i++) {
+		if (devs[i].ata != NULL)
+			close_device( &devs[i].ata, targets[i].device );
+		if (devs[i].rc > rc)
+			rc = devs[i].rc;
+	}
+	free(devs);
+
+	return rc;
+}
+
+/* open every device for one of the long running modes */
+static ATA ** open_devices( char **devices, int ndevices, int *exitval )
+{
+	ATA **atas;
+	int i;
+
+	atas = calloc(ndevices, sizeof(ATA *));
+	if (atas == NULL)
+		err(EX_OSERR, NULL);
+
+	for (i = 0; i < ndevices; i++) {
+		atas[i] = open_device( devices[i], exitval );
+		if (atas[i] == NULL) {
+			close_devices( atas, devices, i );
+			return NULL;
+		}
+	}
+
+	return atas;
+}
+
+static void close_devices( ATA **atas, char **devices, int ndevices )
+{
+	int i;
+
+	for (i = 0; i < ndevices; i++)
+		close_device( &atas[i], devices[i] );
+	free(atas);
+}
+
+/* keep every device open and spin them down after the idle time */
+static int run_spindown( char **devices, int ndevices, uint32_t timeout,
+		uint32_t budget, char **groups, int ngroups,
+		const struct apm_policy *apm )
+{
+	ATA **atas;
+	int rc = 0;
+
+	atas = open_devices( devices, ndevices, &rc );
+	if (atas == NULL)
+		return rc;
+
+	if (spindown_run( atas, devices, ndevices, timeout, budget,
+	    &cyclelimits, groups, ngroups, apm ))
+		rc = EX_OSERR;
+
+	close_devices( atas, devices, ndevices );
+
+	return rc;
+}
+
+/* keep every device open and export their metrics */
+static int run_metrics( char **devices, int ndevices, const char *path,
+		uint32_t interval )
+{
+	ATA **atas;
+	int rc = 0;
+
+	atas = open_devices( devices, ndevices, &rc );
+	if (atas == NULL)
+		return rc;
+
+	if (metrics_run( atas, devices, ndevices, path, interval ))
+		rc = EX_OSERR;
+
+	close_devices( atas, devices, ndevices );
+
+	return rc;
+}
+
+/* spin every device up within the power budget of its controller */
+static int run_wake( char **devices, int ndevices, double budget,
+		const char *table )
+{
+	ATA **atas;
+	int rc = 0;
+
+	atas = open_devices( devices, ndevices, &rc );
+	if (atas == NULL)
+		return rc;
+
+	if (wake_run( atas, devices, ndevices, budget, table ))
+		rc = (errno == EIO) ? EX_IOERR : EX_DATAERR;
+
+	close_devices( atas, devices, ndevices );
+
+	return rc;
+}
+
+/* measure how long each device takes to come out of each power mode */
+static int run_profile( char **devices, int ndevices, int rounds )
+{
+	ATA **atas;
+	int rc = 0;
+	int i;
+
+	atas = open_devices( devices, ndevices, &rc );
+	if (atas == NULL)
+		return rc;
+
+	/* one at a time, so the drives don't slow each other's spin-up */
+	for (i = 0; i < ndevices; i++)
+		if (profile_resume( atas[i], devices[i], rounds, stdout ))
+			rc = EX_IOERR;
+
+	close_devices( atas, devices, ndevices );
+
+	return rc;
+}
+
+/*
+ * Discover the devices given, or every disk if none are, and keep those
+ * matching any of the wwn:, model: and slot: selectors among them.
+ * Returns how many were kept.
+ */
+static int find_devices( char **args, int nargs, int maxjobs,
+		struct discover_dev **devs )
+{
+	glob_t paths;
+	char **selectors;
+	int nselectors = 0;
+	int ndevs, kept, i, j;
+
+	selectors = calloc(nargs + 1, sizeof(char *));
+	if (selectors == NULL)
+		err(EX_OSERR, NULL);
+	memset(&paths, 0, sizeof(glob_t));
+	for (i = 0; i < nargs; i++) {
+		if (discover_isselector(args[i]))
+			selectors[nselectors++] = args[i];
 		else
-			errx(EX_OSFILE, "%s isn't a device node", argv[argc-1]);
+			glob(args[i], GLOB_NOCHECK |
+			    (paths.gl_pathc > 0 ? GLOB_APPEND : 0), NULL, &paths);
+	}
 
-		if (rc <= 0)
-			err(EX_IOERR, "error opening %s", argv[argc-1]);
+	ndevs = discover_run(paths.gl_pathv, paths.gl_pathc, maxjobs,
+	    cachedir, devs);
+	globfree(&paths);
+	if (ndevs == -1)
+		err(EX_OSERR, "can't list the disks");
 
-		if (argc == 2)
-			ata_showdeviceinfo(ata);
-	}	
+	for (j = 0; j < nselectors; j++) {
+		for (i = 0; i < ndevs; i++)
+			if (discover_match(&(*devs)[i], selectors[j]))
+				break;
+		if (i == ndevs)
+			warnx("no device matches %s", selectors[j]);
+	}
 
-	optind = 1;
-	opterr = 1;
+	kept = ndevs;
+	if (nselectors > 0) {
+		kept = 0;
+		for (i = 0; i < ndevs; i++) {
+			struct discover_dev dev = (*devs)[i];
 
-	if (ata_is_opened( ata )) {
-		rc = ata_ident( ata, &ident );
-		if (rc)
-			errx(EX_SOFTWARE, "an error occurred identifying the device %s\n", argv[argc-1]);
+			for (j = 0; j < nselectors; j++)
+				if (discover_match(&dev, selectors[j]))
+					break;
+			if (j == nselectors) {
+				free(dev.device);
+				continue;
+			}
+			(*devs)[kept++] = dev;
+		}
 	}
 
+	free(selectors);
+	return kept;
+}
+
+/* show what is known about the devices, or every disk found */
+static int run_discover( char **args, int nargs, int maxjobs, bool json )
+{
+	struct discover_dev *devs;
+	int ndevs, i;
+	int rc = 0;
+
+	ndevs = find_devices(args, nargs, maxjobs, &devs);
+	discover_print(stdout, devs, ndevs, json);
+	for (i = 0; i < ndevs; i++)
+		if (devs[i].error)
+			rc = EX_IOERR;
+	discover_free(devs, ndevs);
+
+	return (rc);
+}
+
+int main( int argc, char ** argv )
+{
+	int rc = 0;
+	long opt_val;
+	int ch;
+	int i;
+	int nops = 0;
+	int maxjobs = ATAIDLE_DEFAULT_JOBS;
+	uint32_t spindown = 0;
+	uint32_t budget = 0;
+	bool adaptive = false;
+	const char *metricsfile = NULL;
+	uint32_t interval = METRICS_DEFAULT_INTERVAL;
+	int profile = 0;
+	double wake = 0;
+	const char *powertable = NULL;
+	char **groups;
+	int ngroups = 0;
+	struct apm_policy apmpolicy;
+	bool apmswitch = false;
+	bool inventory = false;
+	bool inventoryjson = false;
+	bool discover = false;
+	bool discoverjson = false;
+	struct discover_dev *found = NULL;
+	int nfound = 0;
+	bool daemon;
+	struct ata_op *ops;
+	struct ata_target *targets;
+	int ntargets = 0;
+	const char *planfile = NULL;
+	char *opt;
+	char **devices;
+	glob_t paths;
+	const char * const optstr = "hA:S:sI:iP:ocnj:D:f:";
+	static const struct option longopts[] = {
+		{ "stats",	optional_argument,	NULL,	OPT_STATS },
+		{ "metrics",	required_argument,	NULL,	OPT_METRICS },
+		{ "interval",	required_argument,	NULL,	OPT_INTERVAL },
+		{ "profile-resume", required_argument,	NULL,	OPT_PROFILE },
+		{ "latency-budget", required_argument,	NULL,	OPT_BUDGET },
+		{ "cycle-limit", required_argument,	NULL,	OPT_CYCLES },
+		{ "inventory",	optional_argument,	NULL,	OPT_INVENTORY },
+		{ "trace",	required_argument,	NULL,	OPT_TRACE },
+		{ "wake",	required_argument,	NULL,	OPT_WAKE },
+		{ "power-table", required_argument,	NULL,	OPT_POWERTABLE },
+		{ "group",	required_argument,	NULL,	OPT_GROUP },
+		{ "apm-switch",	required_argument,	NULL,	OPT_APMSWITCH },
+		{ "discover",	optional_argument,	NULL,	OPT_DISCOVER },
+		{ "apply",	optional_argument,	NULL,	OPT_APPLY },
+		{ NULL,		0,			NULL,	0 }
+	};
 
-	while ((ch = getopt(argc, argv, optstr)) != -1)
+	/* need more than just the executable name */
+	if( argc == 1 )
+		usage();
+
+	ops = calloc(argc, sizeof(struct ata_op));
+	groups = calloc(argc, sizeof(char *));
+	if (ops == NULL || groups == NULL)
+		err(EX_OSERR, NULL);
+
+	opterr = 1;
+
+	statsout = stdout;
+
+	while ((ch = getopt_long(argc, argv, optstr, longopts, NULL)) != -1)
 	{
 		switch(ch)
 		{
-			/* S = Standby */
 			case 'S':
+			case 'I':
+			case 'A':
+			case 'P':
 				opt_val = strtol( optarg, NULL, 10 );
-				if(opt_val == LONG_MIN || opt_val == LONG_MAX)
-					warnx("invalid standby value");
-				else {
-					if (ident.cmd_supp1 & ATA_PM_SUPPORTED)
-						rc = ata_setstandbytimer( ata, opt_val );
-					else
-						warnx("the device does not support power management");
+				if(opt_val == LONG_MIN || opt_val == LONG_MAX) {
+					warnx("invalid %s value",
+					    (ch == 'S') ? "standby" :
+					    (ch == 'I') ? "idle" :
+					    (ch == 'A') ? "acoustic" : "apm");
+					break;
 				}
+				ops[nops].ch = ch;
+				ops[nops++].val = opt_val;
 				break;
 
 			case 's':
-			      rc = ata_setstandbytimer( ata, ATA_IDLEVAL_IMMEDIATE );
+			case 'o':
+			case 'i':
+			case 'c':
+				ops[nops++].ch = ch;
 				break;
 
-			/* o = Sleep (off) */
-			case 'o':
-				if (ident.cmd_supp1 & ATA_PM_SUPPORTED)
-					rc = ata_sleep( ata );
-				else
-					warnx("the device does not support power management");
+			case 'j':
+				maxjobs = strtol( optarg, NULL, 10 );
+				if (maxjobs < 1)
+					errx(EX_USAGE, "invalid number of jobs");
 				break;
 
-			/* I = Idle */
-			case 'I':
-				opt_val = strtol( optarg, NULL, 10 );
+			case 'n':
+				cachedir = NULL;
+				break;
 
-				if(opt_val == LONG_MIN || opt_val == LONG_MAX)
-					warnx("invalid idle value");
-				else {
-					if (ident.cmd_supp1 & ATA_PM_SUPPORTED)
-						rc = ata_setidletimer( ata, opt_val );
-					else
-						warnx("the device does not support power management");
-				}
+			case 'D':
+				if (strcmp(optarg, "auto") == 0) {
+					adaptive = true;
+					spindown = ADAPTIVE_INITIAL;
+				} else if (ata_parsetime( optarg, &spindown ) ||
+				    spindown == 0)
+					errx(EX_USAGE, "invalid spindown time");
 				break;
 
-			case 'i':
-				rc = ata_setidletimer(ata, ATA_IDLEVAL_IMMEDIATE);
+			case 'f':
+				planfile = optarg;
 				break;
 
-			/* A = AutoAcoustic */
-			case 'A':
-				opt_val = strtol( optarg, NULL, 10 );
-				if(opt_val == LONG_MIN || opt_val == LONG_MAX)
-					warnx("invalid acoustic value");
-				else {
-					if (ident.cmd_supp2 & ATA_AAM_SUPPORTED)
-						rc = ata_setacoustic( ata, opt_val );
+			case OPT_STATS:
+				showstats = true;
+				opt = (optarg != NULL) ? strtok(optarg, ",") : NULL;
+				for (; opt != NULL; opt = strtok(NULL, ",")) {
+					if (strcmp(opt, "text") == 0)
+						statsjson = false;
+					else if (strcmp(opt, "json") == 0)
+						statsjson = true;
+					else if (strcmp(opt, "probe") == 0)
+						statsprobe = true;
 					else
-						warnx("the device does not support acoustic management");
+						errx(EX_USAGE, "--stats takes text or "
+						    "json, and probe");
 				}
 				break;
 
-			/* P = Power (APM) */
-			case 'P':
-				opt_val = strtol( optarg, NULL, 10 );
-				if(opt_val == LONG_MIN ||  opt_val == LONG_MAX)
-					warnx("invalid apm value");
-				else {
-					if (ident.cmd_supp2 & ATA_APM_SUPPORTED)
-						rc = ata_setapm( ata, opt_val );
-					else
-						warnx("the device does not support advanced power management");
+			case OPT_METRICS:
+				metricsfile = optarg;
+				break;
+
+			case OPT_INTERVAL:
+				if (ata_parsetime( optarg, &interval ) ||
+				    interval == 0)
+					errx(EX_USAGE, "invalid interval");
+				break;
+
+			case OPT_BUDGET:
+				if (ata_parsetime( optarg, &budget ) ||
+				    budget == 0)
+					errx(EX_USAGE, "invalid latency budget");
+				break;
+
+			case OPT_CYCLES:
+				if (cycles_parselimits( optarg, &cyclelimits ))
+					errx(EX_USAGE, "invalid cycle limit");
+				break;
+
+			case OPT_TRACE:
+				tracefd = ata_trace_create( optarg );
+				if (tracefd == -1)
+					err(EX_CANTCREAT, "%s", optarg);
+				break;
+
+			case OPT_INVENTORY:
+				inventory = true;
+				if (optarg == NULL || strcmp(optarg, "csv") == 0)
+					inventoryjson = false;
+				else if (strcmp(optarg, "json") == 0)
+					inventoryjson = true;
+				else
+					errx(EX_USAGE, "--inventory takes csv or json");
+				break;
+
+			case OPT_DISCOVER:
+				discover = true;
+				if (optarg == NULL || strcmp(optarg, "csv") == 0)
+					discoverjson = false;
+				else if (strcmp(optarg, "json") == 0)
+					discoverjson = true;
+				else
+					errx(EX_USAGE, "--discover takes csv or json");
+				break;
+
+			case OPT_APPLY:
+				applying = true;
+				if (optarg == NULL)
+					applycheck = false;
+				else if (strcmp(optarg, "check") == 0)
+					applycheck = true;
+				else
+					errx(EX_USAGE, "--apply takes check");
+				break;
+
+			case OPT_WAKE:
+				{
+					char *end;
+
+					wake = strtod( optarg, &end );
+					if (*end != '\0' || end == optarg || wake <= 0)
+						errx(EX_USAGE, "invalid power budget");
 				}
 				break;
 
+			case OPT_POWERTABLE:
+				powertable = optarg;
+				break;
+
+			case OPT_GROUP:
+				groups[ngroups++] = optarg;
+				break;
+
+			case OPT_APMSWITCH:
+				if (apmswitch_parse( optarg, &apmpolicy ))
+					errx(EX_USAGE, "invalid APM level");
+				apmswitch = true;
+				break;
+
+			case OPT_PROFILE:
+				profile = strtol( optarg, NULL, 10 );
+				if (profile < 1)
+					errx(EX_USAGE, "invalid number of rounds");
+				break;
+
 			case 'h':
 			default:
 				usage();
@@ -178,8 +1196,135 @@ int main( int argc, char ** argv )
 		}
 	}
 
-	ata_close( &ata );
+	/* decoding captured IDENTIFY data needs no devices */
+	if (inventory) {
+		if (planfile != NULL || nops > 0 || spindown ||
+		    metricsfile != NULL || profile || wake || apmswitch ||
+		    applying)
+			errx(EX_USAGE, "--inventory can't be used with other "
+			    "operations");
+		if (optind == argc)
+			usage();
+		rc = inventory_run(argv + optind, argc - optind,
+		    inventoryjson, stdout);
+		free(groups);
+		free(ops);
+		return (rc ? EX_NOINPUT : 0);
+	}
+
+	if (discover) {
+		if (planfile != NULL || nops > 0 || spindown ||
+		    metricsfile != NULL || profile || wake || apmswitch ||
+		    applying)
+			errx(EX_USAGE, "--discover can't be used with other "
+			    "operations");
+		rc = run_discover(argv + optind, argc - optind, maxjobs,
+		    discoverjson);
+		free(groups);
+		free(ops);
+		return (rc);
+	}
+
+	memset(&paths, 0, sizeof(glob_t));
+
+	if (planfile != NULL) {
+		/* every device and operation comes from the plan */
+		FILE *fp = stdin;
+
+		if (optind != argc || nops > 0)
+			errx(EX_USAGE, "devices and operations can't be "
+			    "given with -f");
+		if (strcmp(planfile, "-") != 0)
+			fp = fopen(planfile, "r");
+		if (fp == NULL)
+			err(EX_NOINPUT, "%s", planfile);
+		if (plan_read(fp, planfile, &targets, &ntargets))
+			exit(EX_DATAERR);
+		if (fp != stdin)
+			fclose(fp);
+	} else {
+		if (optind == argc)
+			usage();
+
+		for (i = optind; i < argc; i++)
+			if (discover_isselector(argv[i]))
+				break;
+
+		if (i < argc) {
+			/* pick the disks by name, model or slot */
+			nfound = find_devices(argv + optind, argc - optind,
+			    maxjobs, &found);
+			if (nfound == 0)
+				errx(EX_NOINPUT, "no devices selected");
+		} else {
+			/* expand any patterns the shell didn't, e.g. from rc.conf */
+			for (i = optind; i < argc; i++)
+				glob(argv[i], GLOB_NOCHECK |
+				    (i > optind ? GLOB_APPEND : 0), NULL, &paths);
+		}
+
+		/* the same operations for every device */
+		ntargets = (found != NULL) ? nfound : (int) paths.gl_pathc;
+		targets = calloc(ntargets, sizeof(struct ata_target));
+		if (targets == NULL)
+			err(EX_OSERR, NULL);
+		for (i = 0; i < ntargets; i++) {
+			targets[i].device = (found != NULL) ? found[i].device :
+			    paths.gl_pathv[i];
+			targets[i].ops = ops;
+			targets[i].nops = nops;
+		}
+	}
+
+	devices = calloc(ntargets + 1, sizeof(char *));
+	if (devices == NULL)
+		err(EX_OSERR, NULL);
+	for (i = 0; i < ntargets; i++)
+		devices[i] = targets[i].device;
+
+	if ((spindown != 0 || apmswitch) + (metricsfile != NULL) +
+	    (profile != 0) + (wake != 0) > 1)
+		errx(EX_USAGE, "only one of -D or --apm-switch, --metrics, "
+		    "--profile-resume and --wake can be used");
+	if (applying && planfile == NULL && nops == 0)
+		errx(EX_USAGE, "--apply needs settings to apply");
+	if (powertable != NULL && wake == 0)
+		errx(EX_USAGE, "--power-table needs --wake");
+	if (ngroups > 0 && spindown == 0)
+		errx(EX_USAGE, "--group needs -D");
+	daemon = (spindown || apmswitch || metricsfile != NULL || profile ||
+	    wake);
+	if (budget != 0 && !adaptive)
+		errx(EX_USAGE, "--latency-budget needs -D auto");
+	if (adaptive && budget == 0)
+		budget = ADAPTIVE_DEFAULT_BUDGET;
+
+	if (ntargets == 1 && (targets[0].nops > 0 || !daemon))
+		rc = run_device(&targets[0]);
+	else if (ntargets > 1 && !applying && can_run_async(targets, ntargets))
+		rc = run_async(targets, ntargets);
+	else if (ntargets > 0 && (planfile != NULL || nops > 0 || !daemon))
+		rc = run_parallel(targets, ntargets, maxjobs);
+
+	if ((spindown || apmswitch) && rc == 0)
+		rc = run_spindown(devices, ntargets, spindown, budget, groups,
+		    ngroups, apmswitch ? &apmpolicy : NULL);
+	else if (metricsfile != NULL && rc == 0)
+		rc = run_metrics(devices, ntargets, metricsfile, interval);
+	else if (profile && rc == 0)
+		rc = run_profile(devices, ntargets, profile);
+	else if (wake && rc == 0)
+		rc = run_wake(devices, ntargets, wake, powertable);
+
+	free(devices);
+	if (planfile != NULL)
+		plan_free(targets, ntargets);
+	else
+		free(targets);
+	globfree(&paths);
+	discover_free(found, nfound);
+	free(groups);
+	free(ops);
 	
 	return (rc);
 }
-
@@ -0,0 +1,140 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Choosing a standby timeout from the idle periods a drive has had.  Each
+ * candidate timeout is tried against the remembered gaps between I/O: a
+ * gap longer than the timeout costs the idle power up to the timeout, the
+ * standby power after it and a spin-up at the end, which counts both its
+ * energy and the wear of a load cycle.  The cheapest timeout whose spin-ups
+ * keep the time spent waiting for the drive within the budget wins.  The
+ * power figures are those of a typical 3.5" drive; only their ratios
+ * matter.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "adaptive.h"
+#include "util.h"
+
+/* watts */
+#define ADAPTIVE_IDLE_WATTS	5.0
+#define ADAPTIVE_STANDBY_WATTS	0.8
+#define ADAPTIVE_SPINUP_WATTS	15.0
+/* what a load cycle is counted as, in joules, so spin-ups aren't free */
+#define ADAPTIVE_CYCLE_JOULES	100.0
+
+/*
+ * Timeouts tried, in seconds.  Multiples of 5 seconds up to 20 minutes,
+ * 21 minutes and multiples of 30 minutes up to 5.5 hours can be set in
+ * the drive (see ata_getidlesecs()), the others need the host-side timer.
+ */
+static const uint32_t adaptive_timeouts[] = {
+	10, 20, 30, 45, 60, 90, 120, 180, 240, 300, 420, 600, 900, 1200,
+	1800, 3600, 7200, 10800, 14400, 19800
+};
+
+#define ADAPTIVE_NTIMEOUTS \
+	(sizeof(adaptive_timeouts) / sizeof(adaptive_timeouts[0]))
+
+void adaptive_addgap( struct adaptive_gaps *gaps, uint64_t now, uint32_t len )
+{
+	gaps->len[gaps->next] = len;
+	gaps->end[gaps->next] = now;
+	gaps->next = (gaps->next + 1) % ADAPTIVE_NGAPS;
+	if (gaps->n < ADAPTIVE_NGAPS)
+		gaps->n++;
+}
+
+/*
+ * Pick the standby timeout for a drive which spins up in spinup_ms and may
+ * keep I/O waiting for budget seconds an hour.  Returns 0 if no timeout
+ * is worth it, i.e. the drive should be left spinning.
+ */
+uint32_t adaptive_choose( const struct adaptive_gaps *gaps, uint64_t now,
+		uint32_t spinup_ms, uint32_t budget )
+{
+	double spinup = spinup_ms / 1000.0;
+	double cycle = spinup * ADAPTIVE_SPINUP_WATTS + ADAPTIVE_CYCLE_JOULES;
+	double best = 0;
+	double hours;
+	uint32_t choice = 0;
+	uint64_t first = now;
+	unsigned int t;
+	int i;
+
+	if (gaps->n == 0)
+		return 0;
+
+	/* the time the remembered gaps were seen over */
+	for (i = 0; i < gaps->n; i++)
+		if (gaps->end[i] - gaps->len[i] < first)
+			first = gaps->end[i] - gaps->len[i];
+	hours = (now - first) / 3600.0;
+	if (hours <= 0)
+		return 0;
+
+	/* never spinning down */
+	for (i = 0; i < gaps->n; i++)
+		best += ADAPTIVE_IDLE_WATTS * gaps->len[i];
+
+	for (t = 0; t < ADAPTIVE_NTIMEOUTS; t++) {
+		uint32_t timeout = adaptive_timeouts[t];
+		double energy = 0;
+		int spinups = 0;
+
+		for (i = 0; i < gaps->n; i++) {
+			uint32_t len = gaps->len[i];
+
+			if (len <= timeout) {
+				energy += ADAPTIVE_IDLE_WATTS * len;
+				continue;
+			}
+			energy += ADAPTIVE_IDLE_WATTS * timeout +
+			    ADAPTIVE_STANDBY_WATTS * (len - timeout) + cycle;
+			spinups++;
+		}
+
+		if (spinups * spinup / hours > budget)
+			continue;
+		if (energy < best) {
+			best = energy;
+			choice = timeout;
+		}
+	}
+
+	return choice;
+}
+
+/* whether the drive's own timer can be set to exactly timeout seconds */
+bool adaptive_firmware( uint32_t timeout )
+{
+	uint16_t count;
+
+	return timeout != 0 && ata_getidlesecs(timeout, &count) == 0;
+}
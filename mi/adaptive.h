@@ -0,0 +1,35 @@
+#ifndef ADAPTIVE_H
+#define ADAPTIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* idle periods remembered for each drive */
+#define ADAPTIVE_NGAPS		1024
+/* idle periods seen before the timeout is first chosen */
+#define ADAPTIVE_MIN_GAPS	8
+/* how often the timeout is chosen again, in seconds */
+#define ADAPTIVE_PERIOD		(30 * 60)
+/* timeout used until enough has been seen, in seconds */
+#define ADAPTIVE_INITIAL	(20 * 60)
+/* spin-up time of drives which haven't been profiled, in milliseconds */
+#define ADAPTIVE_DEFAULT_SPINUP	8000
+/* seconds per hour allowed to be spent waiting for spin-ups */
+#define ADAPTIVE_DEFAULT_BUDGET	60
+
+/* the most recent idle periods of a drive, oldest overwritten first */
+struct adaptive_gaps
+{
+	uint32_t	len[ADAPTIVE_NGAPS];	/* seconds */
+	uint64_t	end[ADAPTIVE_NGAPS];	/* when the gap ended */
+	int		n;
+	int		next;
+};
+
+void	adaptive_addgap( struct adaptive_gaps *gaps, uint64_t now,
+	    uint32_t len );
+uint32_t	adaptive_choose( const struct adaptive_gaps *gaps, uint64_t now,
+	    uint32_t spinup_ms, uint32_t budget );
+bool	adaptive_firmware( uint32_t timeout );
+
+#endif /* ADAPTIVE_H */
@@ -0,0 +1,111 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Switching the APM level with the workload.  Low APM levels save power
+ * by unloading the heads between requests, which costs a streaming reader
+ * a good part of its throughput, while the highest level wastes power
+ * when the drive has little to do.  So the drive is kept at a low level
+ * while it is quiet, and moved to ATA_APM_MAXPERF while it is busy, going
+ * by the throughput and the number of requests in flight seen in its I/O
+ * statistics.  The levels only change once the drive has been busy, or
+ * quiet, for a while, and what counts as quiet is well below what counts
+ * as busy, so a drive near the threshold doesn't flap between them.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "apmswitch.h"
+#include "atadefs.h"
+#include "atagen.h"
+
+/* parse level[:MB/s] */
+int apmswitch_parse( const char *str, struct apm_policy *policy )
+{
+	unsigned long level;
+	char *end;
+
+	level = strtoul(str, &end, 10);
+	if (end == str || level < ATA_APM_MINPERF || level > ATA_APM_MAXPERF)
+		return -1;
+	policy->low = level;
+	policy->mbps = APMSWITCH_DEFAULT_MBPS;
+
+	if (*end == ':') {
+		str = end + 1;
+		policy->mbps = strtod(str, &end);
+		if (end == str || policy->mbps <= 0)
+			return -1;
+	}
+
+	return (*end != '\0') ? -1 : 0;
+}
+
+/*
+ * Take the statistics of a drive secs seconds after the last ones, and
+ * return whether it should be at ATA_APM_MAXPERF rather than its low level.
+ */
+bool apmswitch_sample( const struct apm_policy *policy,
+		struct apm_switch *sw, const struct ata_iostat *st,
+		uint32_t secs )
+{
+	double mbps;
+	bool busy, quiet;
+
+	if (!sw->primed || secs == 0 || st->sectors < sw->sectors) {
+		sw->primed = true;
+		sw->sectors = st->sectors;
+		return sw->perf;
+	}
+
+	mbps = (st->sectors - sw->sectors) * 512.0 / 1e6 / secs;
+	sw->sectors = st->sectors;
+
+	busy = (mbps >= policy->mbps || st->in_flight >= APMSWITCH_DEPTH);
+	quiet = (mbps < policy->mbps / APMSWITCH_BAND &&
+	    st->in_flight < APMSWITCH_DEPTH / 2);
+
+	if (busy) {
+		sw->busy += secs;
+		sw->quiet = 0;
+	} else if (quiet) {
+		sw->quiet += secs;
+		sw->busy = 0;
+	} else {
+		sw->busy = 0;
+		sw->quiet = 0;
+	}
+
+	if (!sw->perf && sw->busy >= APMSWITCH_RISE)
+		sw->perf = true;
+	else if (sw->perf && sw->quiet >= APMSWITCH_HOLD)
+		sw->perf = false;
+
+	return sw->perf;
+}
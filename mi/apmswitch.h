@@ -0,0 +1,41 @@
+#ifndef APMSWITCH_H
+#define APMSWITCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "atagen.h"
+
+/* throughput, in MB/s, above which a drive is busy */
+#define APMSWITCH_DEFAULT_MBPS	16.0
+/* requests in flight at which a drive is busy whatever its throughput */
+#define APMSWITCH_DEPTH		2
+/* a drive is only quiet below the busy throughput divided by this */
+#define APMSWITCH_BAND		4
+/* seconds busy before switching to ATA_APM_MAXPERF */
+#define APMSWITCH_RISE		3
+/* seconds quiet before switching back to the low level */
+#define APMSWITCH_HOLD		300
+
+struct apm_policy
+{
+	uint8_t		low;		/* level while quiet */
+	double		mbps;		/* busy threshold */
+};
+
+/* what has been seen of a drive */
+struct apm_switch
+{
+	bool		primed;
+	uint64_t	sectors;
+	uint32_t	busy;		/* seconds busy in a row */
+	uint32_t	quiet;
+	bool		perf;		/* busy, ATA_APM_MAXPERF wanted */
+};
+
+int	apmswitch_parse( const char *str, struct apm_policy *policy );
+bool	apmswitch_sample( const struct apm_policy *policy,
+	    struct apm_switch *sw, const struct ata_iostat *st,
+	    uint32_t secs );
+
+#endif /* APMSWITCH_H */
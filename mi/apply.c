@@ -0,0 +1,502 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Desired state.  Instead of sending every setting it is given, --apply
+ * finds out what the drive is set to and only sends the commands which
+ * would change something, printing each difference, so it can be run
+ * every few minutes from cron or configuration management.  Every command
+ * but CHECK POWER MODE restarts a drive's standby timer, and IDENTIFY may
+ * spin it up, so asking the drive each time would keep it from ever
+ * spinning down.  The drive is instead asked for its IDENTIFY data, which
+ * has the APM and AAM levels, once after each boot, when it may have lost
+ * its settings, and whenever it is found busy anyway; otherwise the
+ * IDENTIFY cache, which follows every SET FEATURES, is used.  A drive
+ * which is spun down is never asked.
+ *
+ * The standby timer can't be read back from a drive at all, so the one
+ * last set is kept in a file next to the IDENTIFY cache and believed
+ * until the next boot.  Whether it was asked for with -S or -I, the timer
+ * is set with the command which leaves the drive in the power mode it is
+ * in, STANDBY if it is spun down and IDLE otherwise; only -s, -i and -o
+ * change the power mode.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "apply.h"
+#include "atadefs.h"
+#include "atagen.h"
+#include "cache.h"
+#include "util.h"
+
+/* operations which are checked against the IDENTIFY data */
+#define APPLY_OPS_IDENT		"AIPSo"
+
+/* what is known of the drive */
+struct apply_state
+{
+	enum ata_power_mode	mode;
+	uint64_t	boot;		/* when the system booted, 0 if unknown */
+	bool		identok;
+	struct ata_info	info;
+	uint64_t	identboot;	/* boot the drive was last asked in */
+	bool		live;		/* and it was asked this time */
+	bool		timerknown;
+	uint16_t	timer;		/* as sent in the count register */
+	uint32_t	mins;
+	bool		dirty;		/* the state file needs writing */
+};
+
+static bool	apply_spinning( enum ata_power_mode mode );
+static bool	apply_hasop( const struct ata_op *ops, int nops,
+		    const char *chars );
+static void	apply_load( ATA *ata, struct apply_state *st );
+static int	apply_save( ATA *ata, const struct apply_state *st );
+static int	apply_read( ATA *ata, const struct ata_op *ops, int nops,
+		    struct apply_state *st );
+static void	apply_level( char *buf, size_t len, bool known, long level );
+static void	apply_mins( char *buf, size_t len, bool known, long mins );
+static int	apply_apm( ATA *ata, struct apply_state *st, long val,
+		    bool check, FILE *out );
+static int	apply_aam( ATA *ata, struct apply_state *st, long val,
+		    bool check, FILE *out );
+static int	apply_timer( ATA *ata, struct apply_state *st, long val,
+		    bool check, FILE *out );
+static int	apply_mode( ATA *ata, struct apply_state *st, int ch,
+		    bool check, FILE *out );
+
+/* whether the drive is spinning, so commands won't wake it */
+static bool apply_spinning( enum ata_power_mode mode )
+{
+	return (mode == ATA_POWER_ACTIVE || mode == ATA_POWER_IDLE);
+}
+
+static bool apply_hasop( const struct ata_op *ops, int nops,
+		const char *chars )
+{
+	int i;
+
+	for (i = 0; i < nops; i++)
+		if (strchr(chars, ops[i].ch) != NULL)
+			return true;
+	return false;
+}
+
+/*
+ * Read the state file of the device, which has the lines
+ *
+ *	ident BOOT
+ *	timer BOOT COUNT MINS
+ *
+ * saying when the IDENTIFY data was last read from the drive and which
+ * timer was last set, each with the boot time of the system then.
+ */
+static void apply_load( ATA *ata, struct apply_state *st )
+{
+	char path[1100];
+	char line[128];
+	unsigned long boot, timer, mins;
+	FILE *fp;
+
+	if (ata_cache_devpath(ata, "apply", path, sizeof(path)))
+		return;
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "ident %lu", &boot) == 1)
+			st->identboot = boot;
+		else if (sscanf(line, "timer %lu %lu %lu", &boot, &timer,
+		    &mins) == 3 && timer <= UINT16_MAX && st->boot != 0 &&
+		    boot == st->boot) {
+			st->timerknown = true;
+			st->timer = timer;
+			st->mins = mins;
+		}
+	}
+	fclose(fp);
+}
+
+static int apply_save( ATA *ata, const struct apply_state *st )
+{
+	char path[1100];
+	char tmppath[1140];
+	FILE *fp;
+	int fd;
+
+	if (ata_cache_devpath(ata, "apply", path, sizeof(path)))
+		return -1;
+
+	fd = ata_cache_mktemp(ata, path, tmppath, sizeof(tmppath));
+	if (fd == -1)
+		return -1;
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		unlink(tmppath);
+		return -1;
+	}
+	if (st->identboot != 0)
+		fprintf(fp, "ident %lu\n", (unsigned long) st->identboot);
+	if (st->timerknown)
+		fprintf(fp, "timer %lu %lu %lu\n", (unsigned long) st->boot,
+		    (unsigned long) st->timer, (unsigned long) st->mins);
+	if (fclose(fp) != 0 || rename(tmppath, path) != 0) {
+		unlink(tmppath);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* find out what the operations are compared with */
+static int apply_read( ATA *ata, const struct ata_op *ops, int nops,
+		struct apply_state *st )
+{
+	struct ata_ident ident;
+	int rc;
+
+	memset(st, 0, sizeof(struct apply_state));
+
+	rc = ata_checkpowermode(ata, &st->mode);
+	/* a drive in sleep mode doesn't answer */
+	if (rc && errno == ETIMEDOUT) {
+		st->mode = ATA_POWER_SLEEP;
+		rc = 0;
+	}
+	if (rc) {
+		fprintf(stderr, "check power mode failed: %s\n",
+		    strerror(errno));
+		return -1;
+	}
+	if (ata_getboottime(&st->boot))
+		st->boot = 0;
+	apply_load(ata, st);
+
+	if (!apply_hasop(ops, nops, APPLY_OPS_IDENT))
+		return 0;
+
+	if (apply_spinning(st->mode) && (st->mode == ATA_POWER_ACTIVE ||
+	    st->boot == 0 || st->identboot != st->boot)) {
+		rc = ata_cache_refresh(ata, &ident);
+		st->live = true;
+		if (rc == 0 && st->boot != 0 && st->identboot != st->boot) {
+			st->identboot = st->boot;
+			st->dirty = true;
+		}
+	} else if (apply_spinning(st->mode)) {
+		rc = ata_getident(ata, &ident);
+	} else {
+		/*
+		 * Without cached data the settings are sent blind, as SET
+		 * FEATURES doesn't need the platters.
+		 */
+		if (ata_cache_getident(ata, &ident) == 0) {
+			ata_decodeident(&ident, &st->info);
+			st->identok = true;
+		}
+		return 0;
+	}
+
+	if (rc) {
+		fprintf(stderr, "an error occurred identifying the device\n");
+		return -1;
+	}
+	ata_decodeident(&ident, &st->info);
+	st->identok = true;
+	return 0;
+}
+
+/* a level for the report, 0 meaning disabled */
+static void apply_level( char *buf, size_t len, bool known, long level )
+{
+	if (!known)
+		snprintf(buf, len, "unknown");
+	else if (level == 0)
+		snprintf(buf, len, "off");
+	else
+		snprintf(buf, len, "%ld", level);
+}
+
+static void apply_mins( char *buf, size_t len, bool known, long mins )
+{
+	if (!known)
+		snprintf(buf, len, "unknown");
+	else if (mins == 0)
+		snprintf(buf, len, "off");
+	else
+		snprintf(buf, len, "%ld minutes", mins);
+}
+
+/* APM, 0 disables it */
+static int apply_apm( ATA *ata, struct apply_state *st, long val,
+		bool check, FILE *out )
+{
+	char from[16], to[16];
+	long cur = 0;
+
+	if (val < 0 || val > ATA_APM_MAXPERF) {
+		fprintf(stderr, "invalid APM value: must be %d-%d\n",
+		    ATA_APM_MINPERF, ATA_APM_MAXPERF);
+		return -1;
+	}
+	if (st->identok && !st->info.apm_supp) {
+		fprintf(stderr, "the device does not support advanced power "
+		    "management\n");
+		return 0;
+	}
+
+	if (st->identok && st->info.apm_enabled)
+		cur = st->info.apm;
+	apply_level(from, sizeof(from), st->identok, cur);
+	apply_level(to, sizeof(to), true, val);
+	if (st->identok && cur == val) {
+		fprintf(out, "apm: %s (unchanged)\n", from);
+		return 0;
+	}
+	fprintf(out, "apm: %s -> %s%s\n", from, to, check ? " (check)" : "");
+	if (check)
+		return 0;
+
+	if (ata_setapm(ata, val)) {
+		fprintf(stderr, "set APM failed: %s\n", strerror(errno));
+		return -1;
+	}
+	st->info.apm_enabled = (val != 0);
+	st->info.apm = val;
+	return 0;
+}
+
+/* AAM as -A takes it, 0 disables it */
+static int apply_aam( ATA *ata, struct apply_state *st, long val,
+		bool check, FILE *out )
+{
+	char from[16], to[16];
+	long cur = 0;
+
+	if (val < 0 || val + 127 > ATA_AUTOACOUSTIC_MAXPERF) {
+		fprintf(stderr, "invalid acoustic value: must be %d-%d\n", 1,
+		    ATA_AUTOACOUSTIC_MAXPERF - 127);
+		return -1;
+	}
+	if (st->identok && !st->info.aam_supp) {
+		fprintf(stderr, "the device does not support acoustic "
+		    "management\n");
+		return 0;
+	}
+
+	if (st->identok && st->info.aam_enabled)
+		cur = st->info.aam;
+	apply_level(from, sizeof(from), st->identok, cur);
+	apply_level(to, sizeof(to), true, val);
+	if (st->identok && cur == val) {
+		fprintf(out, "aam: %s (unchanged)\n", from);
+		return 0;
+	}
+	fprintf(out, "aam: %s -> %s%s\n", from, to, check ? " (check)" : "");
+	if (check)
+		return 0;
+
+	if (ata_setacoustic(ata, val)) {
+		fprintf(stderr, "set AAM failed: %s\n", strerror(errno));
+		return -1;
+	}
+	st->info.aam_enabled = (val != 0);
+	st->info.aam = val;
+	return 0;
+}
+
+/* the standby timer, from -S or -I */
+static int apply_timer( ATA *ata, struct apply_state *st, long val,
+		bool check, FILE *out )
+{
+	char from[32], to[32];
+	uint16_t timer;
+	bool standby;
+	int rc;
+
+	if (val < 0 || ata_getidleval(val, &timer) ||
+	    timer == ATA_IDLEVAL_IMMEDIATE) {
+		fprintf(stderr, "invalid standby timer: %ld minutes\n", val);
+		return -1;
+	}
+	if (st->identok && !st->info.pm_supp) {
+		fprintf(stderr, "the device does not support power "
+		    "management\n");
+		return 0;
+	}
+
+	apply_mins(from, sizeof(from), st->timerknown, st->mins);
+	apply_mins(to, sizeof(to), true, val);
+	if (st->timerknown && st->timer == timer) {
+		fprintf(out, "standby timer: %s (unchanged)\n", from);
+		return 0;
+	}
+	fprintf(out, "standby timer: %s -> %s%s\n", from, to,
+	    check ? " (check)" : "");
+	if (check)
+		return 0;
+
+	/* IDLE with a timer would spin the drive up, STANDBY spin it down */
+	standby = !apply_spinning(st->mode) && st->mode != ATA_POWER_UNKNOWN;
+	if (standby)
+		rc = ata_setstandbytimer(ata, val);
+	else
+		rc = ata_setidletimer(ata, val);
+	if (rc) {
+		fprintf(stderr, "error setting the standby timer: %s\n",
+		    strerror(errno));
+		return -1;
+	}
+
+	st->mode = standby ? ATA_POWER_STANDBY : ATA_POWER_IDLE;
+	st->timerknown = true;
+	st->timer = timer;
+	st->mins = val;
+	if (st->boot != 0)
+		st->dirty = true;
+	return 0;
+}
+
+/* the power mode, from -s, -i or -o */
+static int apply_mode( ATA *ata, struct apply_state *st, int ch,
+		bool check, FILE *out )
+{
+	enum ata_power_mode want;
+	bool same;
+	int rc;
+
+	switch (ch) {
+	case 's':
+		want = ATA_POWER_STANDBY;
+		same = (st->mode == ATA_POWER_STANDBY);
+		break;
+	case 'i':
+		/* an active drive is as spun up as an idle one */
+		want = ATA_POWER_IDLE;
+		same = apply_spinning(st->mode);
+		break;
+	default:
+		if (st->identok && !st->info.pm_supp) {
+			fprintf(stderr, "the device does not support power "
+			    "management\n");
+			return 0;
+		}
+		want = ATA_POWER_SLEEP;
+		same = (st->mode == ATA_POWER_SLEEP);
+		break;
+	}
+
+	if (same) {
+		fprintf(out, "power mode: %s (unchanged)\n",
+		    ata_powermodestring(st->mode));
+		return 0;
+	}
+	fprintf(out, "power mode: %s -> %s%s\n", ata_powermodestring(st->mode),
+	    ata_powermodestring(want), check ? " (check)" : "");
+	if (check)
+		return 0;
+
+	if (want == ATA_POWER_STANDBY)
+		rc = ata_setstandbytimer(ata, ATA_IDLEVAL_IMMEDIATE);
+	else if (want == ATA_POWER_IDLE)
+		rc = ata_setidletimer(ata, ATA_IDLEVAL_IMMEDIATE);
+	else
+		rc = ata_sleep(ata);
+	if (rc) {
+		fprintf(stderr, "error setting %s mode: %s\n",
+		    ata_powermodestring(want), strerror(errno));
+		return -1;
+	}
+
+	st->mode = want;
+	return 0;
+}
+
+/*
+ * Bring the drive to the state the operations describe, sending only the
+ * commands whose effect differs from what it is set to, or with check
+ * only print the differences.  Each operation is first passed to guard,
+ * if not NULL.  Every setting is printed to out, changed or not.
+ * Returns -1 if something couldn't be read or set.
+ */
+int apply_device( ATA *ata, const struct ata_op *ops, int nops,
+		bool check, apply_guard_t guard, void *arg, FILE *out )
+{
+	struct apply_state st;
+	int rc = 0;
+	int i;
+
+	if (apply_read(ata, ops, nops, &st))
+		return -1;
+
+	for (i = 0; i < nops; i++) {
+		struct ata_op op = ops[i];
+
+		if (guard != NULL)
+			guard(ata, &op, st.live, arg);
+
+		switch (op.ch) {
+		case 'P':
+			if (apply_apm(ata, &st, op.val, check, out))
+				rc = -1;
+			break;
+		case 'A':
+			if (apply_aam(ata, &st, op.val, check, out))
+				rc = -1;
+			break;
+		case 'S':
+		case 'I':
+			if (apply_timer(ata, &st, op.val, check, out))
+				rc = -1;
+			break;
+		case 's':
+		case 'i':
+		case 'o':
+			if (apply_mode(ata, &st, op.ch, check, out))
+				rc = -1;
+			break;
+		case 'c':
+			fprintf(out, "power mode: %s\n",
+			    ata_powermodestring(st.mode));
+			break;
+		}
+	}
+
+	if (st.dirty && !check)
+		apply_save(ata, &st);
+
+	return rc;
+}
@@ -0,0 +1,20 @@
+#ifndef APPLY_H
+#define APPLY_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "atagen.h"
+#include "plan.h"
+
+/*
+ * adjusts an operation before it is compared with the drive; live if the
+ * drive is being asked anyway, so it may be sent more commands
+ */
+typedef void (*apply_guard_t)( ATA *ata, struct ata_op *op, bool live,
+    void *arg );
+
+int	apply_device( ATA *ata, const struct ata_op *ops, int nops,
+	    bool check, apply_guard_t guard, void *arg, FILE *out );
+
+#endif /* APPLY_H */
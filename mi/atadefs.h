@@ -12,10 +12,17 @@ enum ata_command {
 #ifndef __FreeBSD__
     ATA_STANDBY_IMMEDIATE	= 0xE0,
     ATA_IDLE_IMMEDIATE		= 0xE1,
+#endif
+#ifndef ATA_CHECK_POWER_MODE
+    ATA_CHECK_POWER_MODE	= 0xE5,
+#endif
+#ifndef ATA_READ_VERIFY
+    ATA_READ_VERIFY		= 0x40,
 #endif
     ATA__SETFEATURES		= 0xEF,
     ATA__IDENTIFY		= 0xEC,
     ATA__ATAPI_IDENTIFY		= 0xA1,
+    ATA__SMART			= 0xB0,
     ATA_IDLE			= 0xE3,
     ATA_STANDBY			= 0xE2
 };
@@ -24,7 +31,8 @@ enum ata_feature {
     ATA_AUTOACOUSTIC_ENABLE 	= 0x42,
     ATA_AUTOACOUSTIC_DISABLE	= 0xC2,
     ATA_APM_ENABLE		= 0x05,
-    ATA_APM_DISABLE		= 0x85
+    ATA_APM_DISABLE		= 0x85,
+    ATA__SMART_READ_DATA	= 0xD0
 };
 
 enum ata_constant {
@@ -34,7 +42,28 @@ enum ata_constant {
     ATA_APM_MINPERF		= 0x01,
     ATA_APM_MAXPERF		= 0xFE,
     ATA_CMD_TIMEOUT		= 10,
-    ATA_IDLEVAL_IMMEDIATE	= 900
+    ATA_IDLEVAL_IMMEDIATE	= 900,
+    ATA_SMART_LBA		= 0xC24F00	/* LBA mid and high of SMART */
+};
+
+/* count register values returned by CHECK POWER MODE */
+enum ata_power_count {
+    ATA_POWER_COUNT_STANDBY	= 0x00,
+    ATA_POWER_COUNT_NV_STANDBY	= 0x40,
+    ATA_POWER_COUNT_NV_ACTIVE	= 0x41,
+    ATA_POWER_COUNT_IDLE	= 0x80,
+    ATA_POWER_COUNT_IDLE_A	= 0x81,
+    ATA_POWER_COUNT_IDLE_B	= 0x82,
+    ATA_POWER_COUNT_IDLE_C	= 0x83,
+    ATA_POWER_COUNT_ACTIVE	= 0xFF
+};
+
+enum ata_power_mode {
+    ATA_POWER_UNKNOWN		= 0,
+    ATA_POWER_ACTIVE		= 1,
+    ATA_POWER_IDLE		= 2,
+    ATA_POWER_STANDBY		= 3,
+    ATA_POWER_SLEEP		= 4
 };
 
 enum ata_protocol {
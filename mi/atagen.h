@@ -31,6 +31,7 @@
 #ifndef ATAGEN_H
 #define ATAGEN_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -109,6 +110,33 @@ struct ata_ident
 	uint16_t	integrity;
 };
 
+/* the IDENTIFY data decoded, see ata_decodeident() */
+struct ata_info
+{
+	char		model[41];
+	char		serial[21];
+	char		firmware[9];
+	char		version[16];	/* highest ATA version, "" if pre ATA-2 */
+	uint16_t	cylinders;
+	uint16_t	heads;
+	uint16_t	sectors_per_track;
+	uint64_t	sectors;	/* logical sectors */
+	uint32_t	logical_sector;	/* bytes */
+	uint32_t	physical_sector;
+	uint16_t	rotation;	/* rpm, 1 if solid state, 0 if unknown */
+	bool		lba48;
+	bool		smart_supp;
+	bool		smart_enabled;
+	bool		pm_supp;
+	bool		apm_supp;
+	bool		apm_enabled;
+	bool		aam_supp;
+	bool		aam_enabled;
+	int		apm;		/* APM level, if enabled */
+	int		aam;		/* AAM level as -A takes it, if enabled */
+	int		aam_recommended;
+};
+
 #define ATA_PM_SUPPORTED	0x0008
 
 #define ATA_APM_SUPPORTED	0x0008
@@ -120,6 +148,9 @@ struct ata_ident
 #define ATA_SMART_SUPPORTED	0x0001
 #define ATA_SMART_ENABLED	0x0001
 
+/* word 84 and 87, words 108-111 hold the world wide name */
+#define ATA_WWN_SUPPORTED	0x0100
+
 /*
  * Relevant documents:
  *
@@ -145,9 +176,24 @@ enum sat_cdb_opcode {
 	SAT_ATA_PASSTHROUGH_16	= 0x85
 };
 
+/*
+ * Bit fields are allocated from the least significant bit on little endian
+ * machines, so the fields inside each byte are listed in reverse order there.
+ */
 #pragma pack(1)
 struct sat_cdb_header {
 	uint32_t	opcode		: 8; /* A1h for short, 85h for rest */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint32_t	extend		: 1; /* 1 for extended, 0 for rest */
+	uint32_t	protocol	: 4;
+	uint32_t	mult_count	: 3;
+	uint32_t	t_length	: 2;
+	uint32_t	byte_block	: 1;
+	uint32_t	t_dir		: 1;
+	uint32_t	reserved0	: 1;
+	uint32_t	ck_cond		: 1;
+	uint32_t	offline		: 2;
+#else
 	uint32_t	mult_count	: 3;
 	uint32_t	protocol	: 4;
 	uint32_t	extend		: 1; /* 1 for extended, 0 for rest */
@@ -157,6 +203,7 @@ struct sat_cdb_header {
 	uint32_t	t_dir		: 1;
 	uint32_t	byte_block	: 1;
 	uint32_t	t_length	: 2;
+#endif
 };
 #pragma pack()
 ASSERT_SIZEOF_TYPE(struct, sat_cdb_header, 3);
@@ -227,9 +274,97 @@ union sat_cdb {
 };
 ASSERT_SIZEOF_TYPE(union, sat_cdb, 16);
 
+/* values for sat_cdb_header.t_length */
+enum sat_t_length {
+	SAT_T_LENGTH_NONE	= 0,
+	SAT_T_LENGTH_FEATURES	= 1,
+	SAT_T_LENGTH_COUNT	= 2,
+	SAT_T_LENGTH_STPSIU	= 3
+};
+
+/* sense data returned by ATA PASS-THROUGH */
+enum sat_sense {
+	SAT_SENSE_FIXED			= 0x70,
+	SAT_SENSE_FIXED_DEFERRED	= 0x71,
+	SAT_SENSE_DESC			= 0x72,
+	SAT_SENSE_DESC_DEFERRED		= 0x73,
+	SAT_SENSE_DESC_ATA_STATUS	= 0x09,
+	SAT_SENSE_KEY_NO_SENSE		= 0x00,
+	SAT_SENSE_KEY_RECOVERED		= 0x01,
+	SAT_SENSE_KEY_ILLEGAL_REQUEST	= 0x05,
+	SAT_SENSE_KEY_ABORTED		= 0x0B
+};
+
+#define ATA_STATUS_ERR		0x01
+#define ATA_STATUS_DSC		0x10
+#define ATA_STATUS_DF		0x20
+#define ATA_STATUS_DRDY		0x40
+
+#define ATA_ERROR_ABRT		0x04
+
 enum ata_access_mode {
 	ACCESS_MODE_ATA = 0,
-	ACCESS_MODE_SAT = 1
+	ACCESS_MODE_SAT = 1,
+	ACCESS_MODE_SIM = 2,	/* simulated drive, see sim.c */
+	ACCESS_MODE_REPLAY = 3	/* recorded commands, see trace.c */
+};
+
+struct ata_sim;
+struct ata_stats;
+struct ata_trace;
+struct ata_replay;
+
+/* output registers of the last command, if the backend could read them */
+struct ata_regs
+{
+	bool		valid;
+	uint8_t		status;
+	uint8_t		error;
+	uint8_t		count;
+	uint8_t		lba_low;
+	uint8_t		lba_mid;
+	uint8_t		lba_high;
+	uint8_t		device;
+};
+
+/* I/O statistics kept by the operating system, reading them never
+ * touches the drive */
+struct ata_iostat
+{
+	uint64_t	reads;		/* completed requests */
+	uint64_t	writes;
+	uint64_t	sectors;	/* 512-byte sectors transferred */
+	uint64_t	in_flight;	/* requests being worked on */
+	uint64_t	io_ticks;	/* milliseconds spent doing I/O */
+};
+
+/*
+ * Every handle has its own buffers for command data and sense data, which
+ * are allocated when it is opened and reused by every command.
+ */
+#define ATA_DATA_BUFSIZE	4096
+#define ATA_SENSE_BUFSIZE	64
+#define ATA_BUFFER_ALIGN	4096
+/* the longest SCSI CDB a backend sends, ATA PASS-THROUGH(16) */
+#define ATA_CDB_MAX		16
+
+/* sizes of the strings returned by ata_getdevid() */
+#define ATA_DEVID_LEN		128
+#define ATA_DEVREV_LEN		16
+/* size of the string returned by ata_getcontroller() */
+#define ATA_CONTROLLER_LEN	64
+/* size of the string returned by ata_getarray() */
+#define ATA_ARRAY_LEN		32
+/* size of the string returned by ata_getslot() */
+#define ATA_SLOT_LEN		64
+
+/* how a device is attached, as ata_gettransport() finds it */
+enum ata_transport {
+	ATA_TRANSPORT_UNKNOWN	= 0,
+	ATA_TRANSPORT_ATA	= 1,	/* libata, ata(4) or the IDE driver */
+	ATA_TRANSPORT_SAT	= 2,	/* SCSI to ATA: USB bridge, SAS HBA */
+	ATA_TRANSPORT_SAS	= 3,	/* SAS or other SCSI disk, not ATA */
+	ATA_TRANSPORT_SIM	= 4
 };
 
 typedef struct 
@@ -240,24 +375,74 @@ typedef struct
 	uint32_t dev;
 	uint32_t cmd;
 	struct ata_cmd atacmd;
+	struct ata_regs regs;
+	const char *cachedir;	/* IDENTIFY cache, NULL if not used */
+	uint8_t *data;		/* ATA_DATA_BUFSIZE bytes */
+	uint8_t *sense;		/* ATA_SENSE_BUFSIZE bytes */
+	uint8_t cdb[ATA_CDB_MAX];	/* last CDB sent to a SAT device */
+	uint8_t cdblen;
+	uint8_t senselen;	/* sense bytes returned with it */
+	uint8_t satlen;		/* shortest CDB the device takes, 0 if any */
+	bool satloaded;		/* satlen looked up in the cache */
+	bool satworked;		/* a command has gone through SAT */
+	struct ata_sim *sim;	/* state of a simulated drive */
+	struct ata_stats *stats;	/* command times, NULL if not kept */
+	struct ata_trace *trace;	/* trace being written, or NULL */
+	struct ata_replay *replay;	/* trace being played back */
 } ATA;
 
 int	ata_open( ATA **ata, const char *device );
+int	ata_allocbuffers( ATA *ata );
+void	ata_freebuffers( ATA *ata );
 void	ata_close( ATA **ata );
 int	ata_is_opened( ATA *ata );
 int	ata_setidletimer( ATA *ata, uint32_t idle_mins );
+int	ata_setidletimer_secs( ATA *ata, uint32_t idle_secs );
 int	ata_sleep( ATA *ata );
 int	ata_setstandbytimer( ATA *ata, uint32_t standby_mins );
 int	ata_setacoustic( ATA *ata, uint32_t acoustic_val);
 int	ata_setapm( ATA *ata, uint32_t apm_val);
-void	ata_listdevices( ATA *ata );
+int	ata_listdevices( char ***devices, int *ndevices );
+void	ata_freedevices( char **devices, int ndevices );
+int	ata_getboottime( uint64_t *boottime );
 int	ata_getmaxchan( ATA *ata, uint32_t *maxchan );
 int	ata_cmd( ATA *ata, enum ata_command atacmd, int drivercmd );
 bool	ata_devpresent( ATA *ata );
 int	ata_ident( ATA *ata, struct ata_ident * identity);
-void	ata_showdeviceinfo( ATA *ata );
+int	ata_getiostat( ATA *ata, struct ata_iostat *stat );
+int	ata_getdevid( ATA *ata, char *devid, size_t idlen,
+	    char *firmware, size_t fwlen );
+int	ata_getcontroller( ATA *ata, char *name, size_t len );
+int	ata_getarray( ATA *ata, char *name, size_t len );
+int	ata_getslot( ATA *ata, char *name, size_t len );
+int	ata_gettransport( ATA *ata, enum ata_transport *transport );
+int	ata_checkpowermode( ATA *ata, enum ata_power_mode *mode );
+enum ata_power_mode	ata_decodepowermode( const struct ata_regs *regs );
+const char *	ata_powermodestring( enum ata_power_mode mode );
+const char *	ata_transportstring( enum ata_transport transport );
+const char *	ata_commandname( uint8_t opcode );
+void	ata_decodeident( const struct ata_ident *ident,
+	    struct ata_info *info );
 void	ata_setfeature_param( ATA *ata, enum ata_feature feature_val);
+void	ata_setlba_param( ATA *ata, uint32_t lba );
 int	ata_setataparams( ATA *ata, int seccount, int count);
 void	ata_setdataout_params( ATA *ata, char ** databuf, int nbytes);
 
+/*
+ * Asynchronous command queue.  Commands are prepared on the handle as for
+ * ata_cmd(), e.g. with ata_setataparams(), and then submitted.  Commands
+ * for one handle run one after the other, commands for different handles
+ * run at the same time and may complete in any order.  done is called for
+ * each command from ata_queue_run(), with the result registers and data
+ * in the handle; it may submit more commands.
+ */
+struct ata_queue;
+typedef void (*ata_done_t)( ATA *ata, int rc, void *arg );
+
+struct ata_queue *	ata_queue_new( void );
+int	ata_queue_submit( struct ata_queue *queue, ATA *ata,
+	    enum ata_command atacmd, ata_done_t done, void *arg );
+int	ata_queue_run( struct ata_queue *queue );
+void	ata_queue_free( struct ata_queue *queue );
+
 #endif /* ATAIDLE_H */
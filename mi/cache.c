@@ -0,0 +1,432 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Persistent cache of IDENTIFY data.  Each device gets a small file in the
+ * cache directory, named after a hash of its WWN or serial number, which
+ * the operating system can tell us without sending anything to the drive.
+ * Records are thrown away when the firmware revision changes, and after
+ * a reboot, as the APM and AAM levels in them are settings the drive may
+ * have lost or been given since; without a firmware revision or a boot
+ * time to check, they are never used.  Files are
+ * written to a temporary name and renamed, so concurrent ataidle processes
+ * never see a partial record.
+ *
+ * The time a drive model takes to spin up, as measured by --profile-resume,
+ * is kept next to them in a one-line text file per model, and other state
+ * of a device can be kept in files named after its record.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "cache.h"
+#include "sat.h"
+#include "trace.h"
+#include "util.h"
+
+#define ATA_CACHE_MAGIC		"ATAIDC2"
+
+struct ata_cache_rec
+{
+	char		magic[8];
+	char		devid[ATA_DEVID_LEN];
+	char		firmware[ATA_DEVREV_LEN];
+	uint64_t	boot;		/* when the system booted */
+	struct ata_ident ident;
+};
+
+static uint32_t	cache_hash( const char *p, size_t len );
+static int	cache_path( ATA *ata, char *path, size_t len,
+		    struct ata_cache_rec *rec );
+static int	cache_read( ATA *ata, struct ata_cache_rec *rec );
+static int	cache_write( ATA *ata, struct ata_cache_rec *rec );
+static int	cache_modelpath( ATA *ata, const struct ata_ident *ident,
+		    char *path, size_t len );
+
+/* FNV-1a, stopping early at a NUL */
+static uint32_t cache_hash( const char *p, size_t len )
+{
+	uint32_t hash = 2166136261U;
+
+	for (; len > 0 && *p != '\0'; p++, len--) {
+		hash ^= (unsigned char) *p;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/* work out the record file of a device, and fill in the record's key */
+static int cache_path( ATA *ata, char *path, size_t len,
+		struct ata_cache_rec *rec )
+{
+	if (ata->cachedir == NULL)
+		return -1;
+
+	memset(rec, 0, sizeof(struct ata_cache_rec));
+	if (ata_getdevid(ata, rec->devid, sizeof(rec->devid),
+	    rec->firmware, sizeof(rec->firmware)))
+		return -1;
+	if (rec->devid[0] == '\0')
+		return -1;
+	if (ata_getboottime(&rec->boot))
+		rec->boot = 0;
+	memcpy(rec->magic, ATA_CACHE_MAGIC, sizeof(rec->magic));
+
+	snprintf(path, len, "%s/%08lx", ata->cachedir,
+	    (unsigned long) cache_hash(rec->devid, sizeof(rec->devid)));
+	return 0;
+}
+
+/* load the record of the device, returns 0 only if it's still valid */
+static int cache_read( ATA *ata, struct ata_cache_rec *rec )
+{
+	char path[1024];
+	struct ata_cache_rec disk;
+	ssize_t n;
+	int fd;
+
+	if (cache_path(ata, path, sizeof(path), rec))
+		return -1;
+	if (rec->firmware[0] == '\0' || rec->boot == 0)
+		return -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	n = read(fd, &disk, sizeof(struct ata_cache_rec));
+	close(fd);
+
+	if (n != sizeof(struct ata_cache_rec) ||
+	    memcmp(disk.magic, rec->magic, sizeof(disk.magic)) != 0 ||
+	    memcmp(disk.devid, rec->devid, sizeof(disk.devid)) != 0 ||
+	    memcmp(disk.firmware, rec->firmware, sizeof(disk.firmware)) != 0 ||
+	    disk.boot != rec->boot)
+		return -1;
+
+	memcpy(&rec->ident, &disk.ident, sizeof(struct ata_ident));
+	return 0;
+}
+
+static int cache_write( ATA *ata, struct ata_cache_rec *rec )
+{
+	char path[1024];
+	char tmppath[1060];
+	struct ata_cache_rec key;
+	int fd;
+
+	if (cache_path(ata, path, sizeof(path), &key))
+		return -1;
+	memcpy(rec, &key, offsetof(struct ata_cache_rec, ident));
+
+	fd = ata_cache_mktemp(ata, path, tmppath, sizeof(tmppath));
+	if (fd == -1)
+		return -1;
+
+	if (write(fd, rec, sizeof(struct ata_cache_rec)) !=
+	    sizeof(struct ata_cache_rec)) {
+		close(fd);
+		unlink(tmppath);
+		return -1;
+	}
+	if (close(fd) != 0 || rename(tmppath, path) != 0) {
+		unlink(tmppath);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Get the IDENTIFY data of the device, from the cache if possible.
+ * Otherwise the drive is asked and the cache is updated.
+ */
+int ata_getident( ATA *ata, struct ata_ident *identity )
+{
+	if (ata_cache_getident(ata, identity) == 0)
+		return 0;
+
+	return ata_cache_refresh(ata, identity);
+}
+
+/*
+ * Like ata_getident(), but ask the drive when it is spinning anyway, so
+ * that the APM and AAM levels shown are the current ones.  A drive in
+ * standby gets the cached record, if any, rather than being spun up.
+ */
+int ata_getident_current( ATA *ata, struct ata_ident *identity )
+{
+	enum ata_power_mode mode;
+
+	if (ata_checkpowermode(ata, &mode) == 0 &&
+	    (mode == ATA_POWER_ACTIVE || mode == ATA_POWER_IDLE))
+		return ata_cache_refresh(ata, identity);
+
+	return ata_getident(ata, identity);
+}
+
+/*
+ * Ask the drive for its IDENTIFY data whatever is cached, and update the
+ * cache with it.  Used when the settings the drive reports must be current.
+ */
+int ata_cache_refresh( ATA *ata, struct ata_ident *identity )
+{
+	struct ata_cache_rec rec;
+	int rc;
+
+	rc = ata_ident(ata, identity);
+	if (rc == 0 && ata->cachedir != NULL) {
+		memcpy(&rec.ident, identity, sizeof(struct ata_ident));
+		cache_write(ata, &rec);
+	}
+
+	return rc;
+}
+
+/*
+ * Get the IDENTIFY data of the device only if it is cached.  Hits are
+ * recorded in the trace, and a replayed device only has the hits of the
+ * trace.
+ */
+int ata_cache_getident( ATA *ata, struct ata_ident *identity )
+{
+	struct ata_cache_rec rec;
+
+	if (ata->replay != NULL)
+		return ata_replay_cached(ata, identity);
+	if (cache_read(ata, &rec))
+		return -1;
+
+	memcpy(identity, &rec.ident, sizeof(struct ata_ident));
+	ata_trace_cached(ata, identity);
+	return 0;
+}
+
+/*
+ * Update the cached APM or AAM settings after SET FEATURES succeeded,
+ * so later lookups don't return the old values.
+ */
+void ata_cache_setfeature( ATA *ata, enum ata_feature feature, uint32_t val )
+{
+	struct ata_cache_rec rec;
+	struct ata_ident *ident = &rec.ident;
+
+	if (cache_read(ata, &rec))
+		return;
+
+	switch (feature) {
+	case ATA_APM_ENABLE:
+		ident->cmd_enabled2 |= ATA_APM_ENABLED;
+		ident->apm_value = val;
+		break;
+	case ATA_APM_DISABLE:
+		ident->cmd_enabled2 &= ~ATA_APM_ENABLED;
+		break;
+	case ATA_AUTOACOUSTIC_ENABLE:
+		ident->cmd_enabled2 |= ATA_AAM_ENABLED;
+		ident->aam_value = (ident->aam_value & 0xFF00) | (val & 0xFF);
+		break;
+	case ATA_AUTOACOUSTIC_DISABLE:
+		ident->cmd_enabled2 &= ~ATA_AAM_ENABLED;
+		break;
+	default:
+		return;
+	}
+
+	cache_write(ata, &rec);
+}
+
+/* the spin-up time file of the drive's model */
+static int cache_modelpath( ATA *ata, const struct ata_ident *ident,
+		char *path, size_t len )
+{
+	if (ata->cachedir == NULL)
+		return -1;
+
+	snprintf(path, len, "%s/model-%08lx", ata->cachedir, (unsigned long)
+	    cache_hash((const char *) ident->model, sizeof(ident->model)));
+	return 0;
+}
+
+/*
+ * Get the milliseconds the drive's model takes to spin up.  Only cached
+ * IDENTIFY data is used, so the drive is never woken to find out.
+ */
+int ata_cache_getspinup( ATA *ata, uint32_t *ms )
+{
+	struct ata_ident ident;
+	char path[1024];
+	unsigned long val;
+	FILE *fp;
+	int rc = -1;
+
+	if (ata_cache_getident(ata, &ident) ||
+	    cache_modelpath(ata, &ident, path, sizeof(path)))
+		return -1;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return -1;
+	if (fscanf(fp, "%lu", &val) == 1 && val > 0 && val <= UINT32_MAX) {
+		*ms = val;
+		rc = 0;
+	}
+	fclose(fp);
+
+	return rc;
+}
+
+/* remember how long the drive's model takes to spin up */
+int ata_cache_setspinup( ATA *ata, uint32_t ms )
+{
+	struct ata_ident ident;
+	char path[1024];
+	char tmppath[1060];
+	FILE *fp;
+	int fd;
+
+	if (ata_getident(ata, &ident) ||
+	    cache_modelpath(ata, &ident, path, sizeof(path)))
+		return -1;
+
+	fd = ata_cache_mktemp(ata, path, tmppath, sizeof(tmppath));
+	if (fd == -1)
+		return -1;
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		unlink(tmppath);
+		return -1;
+	}
+	fprintf(fp, "%lu\n", (unsigned long) ms);
+	if (fclose(fp) != 0 || rename(tmppath, path) != 0) {
+		unlink(tmppath);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* the path of another file kept for the device, named after its record */
+int ata_cache_devpath( ATA *ata, const char *kind, char *path, size_t len )
+{
+	struct ata_cache_rec rec;
+	char base[1024];
+
+	if (cache_path(ata, base, sizeof(base), &rec))
+		return -1;
+
+	snprintf(path, len, "%s-%s", base, kind);
+	return 0;
+}
+
+/*
+ * Look up, once per handle, whether an earlier process found that the
+ * SAT device turns down PASS-THROUGH(12), so the CDB isn't refused and
+ * sent again by every new process.
+ */
+void ata_cache_loadsat( ATA *ata )
+{
+	char path[1100];
+	char buf[16];
+
+	if (ata->satloaded)
+		return;
+	ata->satloaded = true;
+
+	if (ata->satlen == SAT_CDB_LONG ||
+	    ata_cache_devpath(ata, "sat", path, sizeof(path)) ||
+	    ata_readfile(path, buf, sizeof(buf)) < 0)
+		return;
+	if (atoi(buf) == SAT_CDB_LONG)
+		ata->satlen = SAT_CDB_LONG;
+}
+
+/* remember that the SAT device needs PASS-THROUGH(16) */
+void ata_cache_savesat( ATA *ata )
+{
+	char path[1100];
+	char tmppath[1140];
+	char buf[16];
+	int len;
+	int fd;
+
+	if (ata_cache_devpath(ata, "sat", path, sizeof(path)))
+		return;
+
+	fd = ata_cache_mktemp(ata, path, tmppath, sizeof(tmppath));
+	if (fd == -1)
+		return;
+	len = snprintf(buf, sizeof(buf), "%d\n", ata->satlen);
+	if (write(fd, buf, len) != len) {
+		close(fd);
+		unlink(tmppath);
+		return;
+	}
+	if (close(fd) != 0 || rename(tmppath, path) != 0)
+		unlink(tmppath);
+}
+
+/*
+ * Create a temporary file next to path, to be renamed over it once it is
+ * written. The name is unpredictable and the file is created exclusively,
+ * so nobody else with write access to the directory can plant a symlink
+ * there for us to follow.
+ */
+int ata_cache_mktemp( ATA *ata, const char *path, char *tmppath, size_t len )
+{
+	int fd;
+
+	mkdir(ata->cachedir, 0755);
+	if ((size_t) snprintf(tmppath, len, "%s.XXXXXX", path) >= len) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	fd = mkstemp(tmppath);
+	if (fd == -1)
+		return -1;
+	if (fchmod(fd, 0644) != 0) {
+		close(fd);
+		unlink(tmppath);
+		return -1;
+	}
+
+	return fd;
+}
@@ -0,0 +1,24 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+
+int	ata_getident( ATA *ata, struct ata_ident *identity );
+int	ata_getident_current( ATA *ata, struct ata_ident *identity );
+int	ata_cache_getident( ATA *ata, struct ata_ident *identity );
+int	ata_cache_refresh( ATA *ata, struct ata_ident *identity );
+void	ata_cache_setfeature( ATA *ata, enum ata_feature feature,
+	    uint32_t val );
+int	ata_cache_getspinup( ATA *ata, uint32_t *ms );
+int	ata_cache_setspinup( ATA *ata, uint32_t ms );
+int	ata_cache_devpath( ATA *ata, const char *kind, char *path,
+	    size_t len );
+void	ata_cache_loadsat( ATA *ata );
+void	ata_cache_savesat( ATA *ata );
+int	ata_cache_mktemp( ATA *ata, const char *path, char *tmppath,
+	    size_t len );
+
+#endif /* CACHE_H */
@@ -0,0 +1,304 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Load cycle and start/stop budget.  Drives are rated for a number of head
+ * load/unload cycles and spin-ups over their service life, and low APM
+ * levels or short standby timers can use them up years early.  The SMART
+ * counters are sampled into a state file next to the IDENTIFY cache, at
+ * most one sample per CYCLES_MIN_HOURS power-on hours, so the recent rate
+ * can be told apart from the lifetime average.  The rate is projected to
+ * the end of the rated service life and compared with the ratings.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "cache.h"
+#include "cycles.h"
+#include "smart.h"
+
+/* the longest time the drive's standby timer can hold, see ata_getidleval() */
+#define CYCLES_MAX_MINS		330
+
+struct cycles_sample
+{
+	uint32_t	hours;
+	uint32_t	startstop;
+	uint32_t	load;
+};
+
+static int	cycles_load( ATA *ata, struct cycles_sample *samples );
+static int	cycles_save( ATA *ata, const struct cycles_sample *samples,
+		    int n );
+static int	cycles_project( const struct cycles_limits *lim,
+		    const struct cycles_sample *cur,
+		    const struct cycles_sample *base, bool has_load,
+		    bool has_startstop, struct cycles_status *st );
+
+/* read LOAD[:STARTSTOP[:HOURS]] */
+int cycles_parselimits( const char *str, struct cycles_limits *lim )
+{
+	unsigned long val[3];
+	char *end;
+	int i;
+
+	val[0] = 0;
+	val[1] = CYCLES_DEFAULT_STARTSTOP;
+	val[2] = CYCLES_DEFAULT_HOURS;
+	for (i = 0; i < 3; i++) {
+		errno = 0;
+		val[i] = strtoul(str, &end, 10);
+		if (errno || end == str || val[i] > UINT32_MAX)
+			return -1;
+		if (*end == '\0')
+			break;
+		if (*end != ':' || i == 2)
+			return -1;
+		str = end + 1;
+	}
+	if (val[0] != 0 && val[2] == 0)
+		return -1;
+
+	lim->load = val[0];
+	lim->startstop = val[1];
+	lim->hours = val[2];
+	return 0;
+}
+
+/* the samples saved for the device, oldest first */
+static int cycles_load( ATA *ata, struct cycles_sample *samples )
+{
+	char path[1100];
+	unsigned long h, s, l;
+	FILE *fp;
+	int n = 0;
+
+	if (ata_cache_devpath(ata, "cycles", path, sizeof(path)))
+		return 0;
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return 0;
+
+	while (n < CYCLES_NSAMPLES &&
+	    fscanf(fp, "%lu %lu %lu", &h, &s, &l) == 3) {
+		samples[n].hours = h;
+		samples[n].startstop = s;
+		samples[n].load = l;
+		n++;
+	}
+	fclose(fp);
+
+	return n;
+}
+
+static int cycles_save( ATA *ata, const struct cycles_sample *samples, int n )
+{
+	char path[1100];
+	char tmppath[1140];
+	FILE *fp;
+	int fd;
+	int i;
+
+	if (ata_cache_devpath(ata, "cycles", path, sizeof(path)))
+		return -1;
+
+	fd = ata_cache_mktemp(ata, path, tmppath, sizeof(tmppath));
+	if (fd == -1)
+		return -1;
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		unlink(tmppath);
+		return -1;
+	}
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%lu %lu %lu\n", (unsigned long) samples[i].hours,
+		    (unsigned long) samples[i].startstop,
+		    (unsigned long) samples[i].load);
+	if (fclose(fp) != 0 || rename(tmppath, path) != 0) {
+		unlink(tmppath);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Read the counters of the drive, record them and work out whether the
+ * drive will outlive its ratings at the current rate.  This reads SMART
+ * data, so the drive has to be spinning.
+ */
+int cycles_check( ATA *ata, const struct cycles_limits *lim,
+		struct cycles_status *st )
+{
+	struct cycles_sample samples[CYCLES_NSAMPLES];
+	struct cycles_sample cur, base;
+	struct ata_ident ident;
+	struct ata_smart smart;
+	bool has_load, has_startstop;
+	int n;
+
+	memset(st, 0, sizeof(struct cycles_status));
+
+	if (ata_getident(ata, &ident))
+		return -1;
+	if (!(ident.cmd_supp1 & ATA_SMART_SUPPORTED) ||
+	    !(ident.cmd_enabled1 & ATA_SMART_ENABLED)) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	if (ata_smart_read(ata, &smart))
+		return -1;
+
+	memset(&cur, 0, sizeof(struct cycles_sample));
+	if (ata_smart_count(&smart, SMART_POWER_ON_HOURS, &cur.hours)) {
+		errno = ENOTSUP;
+		return -1;
+	}
+	has_load = (ata_smart_count(&smart, SMART_LOAD_CYCLES, &cur.load) == 0);
+	has_startstop = (ata_smart_count(&smart, SMART_START_STOP,
+	    &cur.startstop) == 0);
+
+	n = cycles_load(ata, samples);
+	if (n > 0 && (cur.hours < samples[n - 1].hours ||
+	    cur.load < samples[n - 1].load ||
+	    cur.startstop < samples[n - 1].startstop))
+		n = 0;		/* the counters went back, start again */
+
+	/* the rate since the oldest sample, or over the drive's whole life */
+	memset(&base, 0, sizeof(struct cycles_sample));
+	if (n > 0 && cur.hours >= samples[0].hours + CYCLES_MIN_HOURS)
+		base = samples[0];
+
+	if (n == 0 || cur.hours >= samples[n - 1].hours + CYCLES_MIN_HOURS) {
+		if (n == CYCLES_NSAMPLES) {
+			memmove(samples, samples + 1,
+			    (n - 1) * sizeof(struct cycles_sample));
+			n--;
+		}
+		samples[n++] = cur;
+		cycles_save(ata, samples, n);
+	}
+
+	return cycles_project(lim, &cur, &base, has_load, has_startstop, st);
+}
+
+/*
+ * Work out the same from the samples already recorded, without asking
+ * the drive, for when its timers mustn't be disturbed.  The newest
+ * sample is at most CYCLES_MIN_HOURS old while the drive is checked.
+ */
+int cycles_check_saved( ATA *ata, const struct cycles_limits *lim,
+		struct cycles_status *st )
+{
+	struct cycles_sample samples[CYCLES_NSAMPLES];
+	struct cycles_sample cur, base;
+	int n;
+
+	memset(st, 0, sizeof(struct cycles_status));
+
+	n = cycles_load(ata, samples);
+	if (n == 0) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	cur = samples[n - 1];
+	memset(&base, 0, sizeof(struct cycles_sample));
+	if (cur.hours >= samples[0].hours + CYCLES_MIN_HOURS)
+		base = samples[0];
+
+	return cycles_project(lim, &cur, &base, cur.load > 0,
+	    cur.startstop > 0, st);
+}
+
+/* the rate from base to cur, projected to the end of the service life */
+static int cycles_project( const struct cycles_limits *lim,
+		const struct cycles_sample *cur,
+		const struct cycles_sample *base, bool has_load,
+		bool has_startstop, struct cycles_status *st )
+{
+	uint32_t remaining;
+	double hours;
+
+	st->hours = cur->hours;
+	st->load = cur->load;
+	st->startstop = cur->startstop;
+	if (cur->hours < base->hours + CYCLES_MIN_HOURS)
+		return 0;	/* too early to tell */
+
+	hours = cur->hours - base->hours;
+	st->load_rate = (cur->load - base->load) / hours;
+	st->startstop_rate = (cur->startstop - base->startstop) / hours;
+
+	remaining = (lim->hours > cur->hours) ? lim->hours - cur->hours : 0;
+	st->load_proj = cur->load + st->load_rate * remaining;
+	st->startstop_proj = cur->startstop + st->startstop_rate * remaining;
+	st->over = (has_load && lim->load > 0 && st->load_proj > lim->load) ||
+	    (has_startstop && lim->startstop > 0 &&
+	    st->startstop_proj > lim->startstop);
+
+	return 0;
+}
+
+/* a standby timer, in minutes, about twice as long that the drive can hold */
+uint32_t cycles_relax_standby( uint32_t mins )
+{
+	uint32_t relaxed = mins * 2;
+
+	if (mins == 0 || mins == ATA_IDLEVAL_IMMEDIATE ||
+	    mins >= CYCLES_MAX_MINS)
+		return mins;
+	if (relaxed <= 21)
+		return relaxed;
+	relaxed = (relaxed + 29) / 30 * 30;
+	return (relaxed < CYCLES_MAX_MINS) ? relaxed : CYCLES_MAX_MINS;
+}
+
+/* an APM level which doesn't let the drive spin down or unload on its own */
+uint32_t cycles_relax_apm( uint32_t level )
+{
+	if (level > 0 && level < ATA_APM_MINPOWER_NO_STANDBY)
+		return ATA_APM_MINPOWER_NO_STANDBY;
+	return level;
+}
+
+/* a host-side timeout, in seconds, twice as long */
+uint32_t cycles_relax_timeout( uint32_t secs )
+{
+	if (secs == 0 || secs >= CYCLES_MAX_MINS * 60)
+		return secs;
+	return (secs * 2 < CYCLES_MAX_MINS * 60) ? secs * 2 :
+	    CYCLES_MAX_MINS * 60;
+}
@@ -0,0 +1,48 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "atagen.h"
+
+/* what a typical 3.5" drive is rated for */
+#define CYCLES_DEFAULT_LOAD	300000
+#define CYCLES_DEFAULT_STARTSTOP 50000
+#define CYCLES_DEFAULT_HOURS	(5 * 365 * 24)	/* 5 years, always on */
+
+/* power-on hours needed before a rate is worked out */
+#define CYCLES_MIN_HOURS	24
+/* samples kept in the state file, at least CYCLES_MIN_HOURS apart */
+#define CYCLES_NSAMPLES		64
+
+/* rated cycles over the service life; load 0 turns the guard off */
+struct cycles_limits
+{
+	uint32_t	load;
+	uint32_t	startstop;
+	uint32_t	hours;
+};
+
+struct cycles_status
+{
+	uint32_t	hours;		/* power-on hours */
+	uint32_t	load;		/* counts so far */
+	uint32_t	startstop;
+	double		load_rate;	/* per power-on hour */
+	double		startstop_rate;
+	double		load_proj;	/* at the end of the service life */
+	double		startstop_proj;
+	bool		over;		/* a projection exceeds the rating */
+};
+
+int	cycles_parselimits( const char *str, struct cycles_limits *lim );
+int	cycles_check( ATA *ata, const struct cycles_limits *lim,
+	    struct cycles_status *st );
+int	cycles_check_saved( ATA *ata, const struct cycles_limits *lim,
+	    struct cycles_status *st );
+uint32_t	cycles_relax_standby( uint32_t mins );
+uint32_t	cycles_relax_apm( uint32_t level );
+uint32_t	cycles_relax_timeout( uint32_t secs );
+
+#endif /* CYCLES_H */
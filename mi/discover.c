@@ -0,0 +1,304 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Device discovery and inventory.  The candidates are the devices given,
+ * or every disk ata_listdevices() finds; each is opened and asked how it
+ * is attached, where it sits and who it is.  IDENTIFY comes from the
+ * cache when it can, so drives in standby are left alone, and is sent by
+ * up to maxjobs threads at once so a host full of drives answers in a
+ * fraction of a second rather than one drive after another.  SAS disks
+ * don't speak ATA and are listed without it.
+ *
+ * Since /dev names move around between boots, drives can also be picked
+ * by what discovery found out about them:
+ *
+ *	wwn:5000c500a1b2c3d4	the world wide name, naa. and 0x are ignored
+ *	model:ST4000*		model pattern, see fnmatch(3)
+ *	slot:5003048001a2b3c4/7	enclosure id and slot, also a pattern
+ */
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "cache.h"
+#include "discover.h"
+#include "inventory.h"
+
+struct discover_ctx
+{
+	struct discover_dev *	devs;
+	int			ndevs;
+	int			next;		/* first device not yet taken */
+	const char *		cachedir;
+	pthread_mutex_t		lock;
+};
+
+static const char *	discover_wwnstrip( const char *wwn );
+static void	discover_identwwn( const struct ata_ident *ident,
+		    char *wwn );
+static void	discover_probe( struct discover_dev *dev,
+		    const char *cachedir );
+static void *	discover_worker( void *arg );
+
+/* leave out the prefixes the kernel and people like to put in front */
+static const char * discover_wwnstrip( const char *wwn )
+{
+	if (strncasecmp(wwn, "naa.", 4) == 0)
+		return wwn + 4;
+	if (strncasecmp(wwn, "0x", 2) == 0)
+		return wwn + 2;
+	return wwn;
+}
+
+/* words 108-111, if the drive says they hold a name */
+static void discover_identwwn( const struct ata_ident *ident, char *wwn )
+{
+	const uint16_t *w = &ident->word104[4];
+
+	if ((ident->cmd_supp_ext & ATA_WWN_SUPPORTED) == 0 ||
+	    (ident->cmd_ext_default & ATA_WWN_SUPPORTED) == 0 ||
+	    (w[0] >> 12) == 0)
+		return;
+	snprintf(wwn, DISCOVER_WWN_LEN, "%04x%04x%04x%04x", w[0], w[1], w[2],
+	    w[3]);
+}
+
+/* find out everything about one device, errors are kept in dev->error */
+static void discover_probe( struct discover_dev *dev, const char *cachedir )
+{
+	struct ata_ident ident;
+	char devid[ATA_DEVID_LEN];
+	char firmware[ATA_DEVREV_LEN];
+	ATA *ata = NULL;
+
+	if (ata_open(&ata, dev->device) <= 0) {
+		dev->error = errno ? errno : ENXIO;
+		return;
+	}
+	ata->cachedir = cachedir;
+
+	if (ata_gettransport(ata, &dev->transport))
+		dev->transport = ATA_TRANSPORT_UNKNOWN;
+	if (ata_getcontroller(ata, dev->controller, sizeof(dev->controller)))
+		dev->controller[0] = '\0';
+	if (ata_getslot(ata, dev->slot, sizeof(dev->slot)))
+		dev->slot[0] = '\0';
+	if (ata_getdevid(ata, devid, sizeof(devid), firmware,
+	    sizeof(firmware)) == 0 && strncmp(devid, "naa.", 4) == 0)
+		snprintf(dev->wwn, sizeof(dev->wwn), "%s", devid + 4);
+
+	if (dev->transport != ATA_TRANSPORT_SAS) {
+		if (ata_getident(ata, &ident)) {
+			dev->error = errno ? errno : EIO;
+		} else {
+			ata_decodeident(&ident, &dev->info);
+			inventory_clean(dev->info.model);
+			inventory_clean(dev->info.serial);
+			inventory_clean(dev->info.firmware);
+			discover_identwwn(&ident, dev->wwn);
+			dev->identified = true;
+		}
+	}
+
+	ata_close(&ata);
+}
+
+static void * discover_worker( void *arg )
+{
+	struct discover_ctx *ctx = arg;
+
+	for (;;) {
+		struct discover_dev *dev;
+
+		pthread_mutex_lock(&ctx->lock);
+		dev = (ctx->next < ctx->ndevs) ? &ctx->devs[ctx->next++] : NULL;
+		pthread_mutex_unlock(&ctx->lock);
+		if (dev == NULL)
+			break;
+		discover_probe(dev, ctx->cachedir);
+	}
+
+	return NULL;
+}
+
+/*
+ * Probe the devices, or every disk found if ndevices is 0, with up to
+ * maxjobs threads.  Returns the number of devices in *devs, which has to
+ * be freed with discover_free(), or -1 if the disks couldn't be listed.
+ */
+int discover_run( char **devices, int ndevices, int maxjobs,
+		const char *cachedir, struct discover_dev **devs )
+{
+	struct discover_ctx ctx;
+	pthread_t *threads;
+	char **found = NULL;
+	int nthreads = 0;
+	int i;
+
+	if (ndevices == 0) {
+		if (ata_listdevices(&found, &ndevices))
+			return -1;
+		devices = found;
+	}
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.devs = calloc(ndevices + 1, sizeof(struct discover_dev));
+	threads = calloc(maxjobs, sizeof(pthread_t));
+	if (ctx.devs == NULL || threads == NULL) {
+		free(ctx.devs);
+		free(threads);
+		ata_freedevices(found, ndevices);
+		return -1;
+	}
+	for (i = 0; i < ndevices; i++) {
+		ctx.devs[i].device = malloc(strlen(devices[i]) + 1);
+		if (ctx.devs[i].device == NULL) {
+			discover_free(ctx.devs, i);
+			free(threads);
+			ata_freedevices(found, ndevices);
+			return -1;
+		}
+		strcpy(ctx.devs[i].device, devices[i]);
+	}
+	ata_freedevices(found, ndevices);
+	ctx.ndevs = ndevices;
+	ctx.cachedir = cachedir;
+	pthread_mutex_init(&ctx.lock, NULL);
+
+	/* whatever isn't taken by a thread is done here */
+	while (nthreads < maxjobs - 1 && nthreads < ndevices - 1 &&
+	    pthread_create(&threads[nthreads], NULL, discover_worker,
+	    &ctx) == 0)
+		nthreads++;
+	discover_worker(&ctx);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&ctx.lock);
+	free(threads);
+
+	*devs = ctx.devs;
+	return ndevices;
+}
+
+void discover_free( struct discover_dev *devs, int ndevs )
+{
+	int i;
+
+	if (devs == NULL)
+		return;
+	for (i = 0; i < ndevs; i++)
+		free(devs[i].device);
+	free(devs);
+}
+
+bool discover_isselector( const char *arg )
+{
+	return strncmp(arg, DISCOVER_WWN, strlen(DISCOVER_WWN)) == 0 ||
+	    strncmp(arg, DISCOVER_MODEL, strlen(DISCOVER_MODEL)) == 0 ||
+	    strncmp(arg, DISCOVER_SLOT, strlen(DISCOVER_SLOT)) == 0;
+}
+
+/* does the device match wwn:, model: or slot: */
+bool discover_match( const struct discover_dev *dev, const char *selector )
+{
+	if (strncmp(selector, DISCOVER_WWN, strlen(DISCOVER_WWN)) == 0)
+		return dev->wwn[0] != '\0' && strcasecmp(dev->wwn,
+		    discover_wwnstrip(selector + strlen(DISCOVER_WWN))) == 0;
+	if (strncmp(selector, DISCOVER_MODEL, strlen(DISCOVER_MODEL)) == 0)
+		return dev->identified && fnmatch(selector +
+		    strlen(DISCOVER_MODEL), dev->info.model, 0) == 0;
+	if (strncmp(selector, DISCOVER_SLOT, strlen(DISCOVER_SLOT)) == 0)
+		return dev->slot[0] != '\0' && fnmatch(selector +
+		    strlen(DISCOVER_SLOT), dev->slot, 0) == 0;
+	return false;
+}
+
+/* one CSV row or line of JSON for each device */
+void discover_print( FILE *out, const struct discover_dev *devs, int ndevs,
+		bool json )
+{
+	int i;
+
+	if (!json)
+		fputs("device,transport,wwn,model,serial,firmware,capacity,"
+		    "controller,slot,error\n", out);
+
+	for (i = 0; i < ndevs; i++) {
+		const struct discover_dev *dev = &devs[i];
+		uint64_t capacity = dev->info.sectors *
+		    dev->info.logical_sector;
+		const char *error = dev->error ? strerror(dev->error) : "";
+
+		if (json) {
+			fputs("{\"device\":", out);
+			inventory_string(out, dev->device, true);
+			fprintf(out, ",\"transport\":\"%s\",\"wwn\":\"%s\","
+			    "\"model\":", ata_transportstring(dev->transport),
+			    dev->wwn);
+			inventory_string(out, dev->info.model, true);
+			fputs(",\"serial\":", out);
+			inventory_string(out, dev->info.serial, true);
+			fputs(",\"firmware\":", out);
+			inventory_string(out, dev->info.firmware, true);
+			fprintf(out, ",\"capacity\":%" PRIu64 ",\"controller\":",
+			    capacity);
+			inventory_string(out, dev->controller, true);
+			fputs(",\"slot\":", out);
+			inventory_string(out, dev->slot, true);
+			fputs(",\"error\":", out);
+			inventory_string(out, error, true);
+			fputs("}\n", out);
+			continue;
+		}
+
+		inventory_string(out, dev->device, false);
+		fprintf(out, ",%s,%s,", ata_transportstring(dev->transport),
+		    dev->wwn);
+		inventory_string(out, dev->info.model, false);
+		putc(',', out);
+		inventory_string(out, dev->info.serial, false);
+		putc(',', out);
+		inventory_string(out, dev->info.firmware, false);
+		fprintf(out, ",%" PRIu64 ",", capacity);
+		inventory_string(out, dev->controller, false);
+		putc(',', out);
+		inventory_string(out, dev->slot, false);
+		putc(',', out);
+		inventory_string(out, error, false);
+		putc('\n', out);
+	}
+}
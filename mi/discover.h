@@ -0,0 +1,38 @@
+#ifndef DISCOVER_H
+#define DISCOVER_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "atagen.h"
+
+/* selectors which can be given instead of device names */
+#define DISCOVER_WWN	"wwn:"
+#define DISCOVER_MODEL	"model:"
+#define DISCOVER_SLOT	"slot:"
+
+/* NAA world wide name as 16 hex digits */
+#define DISCOVER_WWN_LEN	17
+
+struct discover_dev
+{
+	char *			device;
+	enum ata_transport	transport;
+	char			wwn[DISCOVER_WWN_LEN];	/* "" if unknown */
+	char			controller[ATA_CONTROLLER_LEN];
+	char			slot[ATA_SLOT_LEN];
+	struct ata_info		info;
+	bool			identified;
+	int			error;		/* errno, 0 if it worked */
+};
+
+int	discover_run( char **devices, int ndevices, int maxjobs,
+	    const char *cachedir, struct discover_dev **devs );
+void	discover_free( struct discover_dev *devs, int ndevs );
+bool	discover_isselector( const char *arg );
+bool	discover_match( const struct discover_dev *dev,
+	    const char *selector );
+void	discover_print( FILE *out, const struct discover_dev *devs,
+	    int ndevs, bool json );
+
+#endif /* DISCOVER_H */
@@ -0,0 +1,272 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Offline inventory of captured IDENTIFY data.  Each file holds one or
+ * more raw 512 byte IDENTIFY records, as the drives sent them; a
+ * directory stands for the files in it.  Files are mapped rather than
+ * read, and every record is decoded with the same code as ata_ident()
+ * and ata_decodeident() and written as a CSV row or a line of JSON.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "inventory.h"
+#include "util.h"
+
+#define INVENTORY_RECORD	512
+#define INVENTORY_SIGNATURE	0xA5
+
+static const char *	inventory_checksum( const unsigned char *raw );
+static void	inventory_record( FILE *out, const char *path, size_t n,
+		    const unsigned char *raw, bool json );
+static int	inventory_file( FILE *out, const char *path, bool json );
+static int	select_dump( const struct dirent *de );
+static int	inventory_dir( FILE *out, const char *path, bool json );
+
+/* trim the padding, and keep garbage out of the output */
+void inventory_clean( char *s )
+{
+	size_t len = strlen(s);
+	size_t i;
+
+	while (len > 0 && s[len - 1] == ' ')
+		s[--len] = '\0';
+	for (i = 0; i < len; i++)
+		if ((unsigned char) s[i] < 0x20 || (unsigned char) s[i] > 0x7E)
+			s[i] = '?';
+}
+
+/* write a string quoted for CSV, or for JSON */
+void inventory_string( FILE *out, const char *s, bool json )
+{
+	putc('"', out);
+	for (; *s != '\0'; s++) {
+		if (*s == '"')
+			fputs(json ? "\\\"" : "\"\"", out);
+		else if (*s == '\\' && json)
+			fputs("\\\\", out);
+		else
+			putc(*s, out);
+	}
+	putc('"', out);
+}
+
+/* word 255 holds a checksum when its low byte is the signature */
+static const char * inventory_checksum( const unsigned char *raw )
+{
+	unsigned char sum = 0;
+	int i;
+
+	if (raw[510] != INVENTORY_SIGNATURE)
+		return "none";
+	for (i = 0; i < INVENTORY_RECORD; i++)
+		sum += raw[i];
+
+	return (sum == 0) ? "ok" : "bad";
+}
+
+static void inventory_record( FILE *out, const char *path, size_t n,
+		const unsigned char *raw, bool json )
+{
+	union {
+		struct ata_ident ident;
+		char buf[INVENTORY_RECORD];
+	} rec;
+	struct ata_info info;
+	const char *checksum;
+
+	checksum = inventory_checksum(raw);
+	memcpy(rec.buf, raw, INVENTORY_RECORD);
+	ata_fixident(rec.buf);
+	ata_decodeident(&rec.ident, &info);
+	inventory_clean(info.model);
+	inventory_clean(info.serial);
+	inventory_clean(info.firmware);
+
+	if (json) {
+		fputs("{\"source\":", out);
+		inventory_string(out, path, true);
+		fprintf(out, ",\"record\":%lu,\"model\":", (unsigned long) n);
+		inventory_string(out, info.model, true);
+		fputs(",\"serial\":", out);
+		inventory_string(out, info.serial, true);
+		fputs(",\"firmware\":", out);
+		inventory_string(out, info.firmware, true);
+		fprintf(out, ",\"version\":\"%s\",\"sectors\":%" PRIu64
+		    ",\"logical_sector\":%lu,\"physical_sector\":%lu,"
+		    "\"capacity\":%" PRIu64 ",\"rotation\":%u,", info.version,
+		    info.sectors, (unsigned long) info.logical_sector,
+		    (unsigned long) info.physical_sector,
+		    info.sectors * info.logical_sector, info.rotation);
+		fprintf(out, "\"lba48\":%s,\"smart\":%s,\"smart_enabled\":%s,"
+		    "\"pm\":%s,\"apm\":%s,\"apm_enabled\":%s,\"apm_level\":%d,",
+		    info.lba48 ? "true" : "false",
+		    info.smart_supp ? "true" : "false",
+		    info.smart_enabled ? "true" : "false",
+		    info.pm_supp ? "true" : "false",
+		    info.apm_supp ? "true" : "false",
+		    info.apm_enabled ? "true" : "false", info.apm);
+		fprintf(out, "\"aam\":%s,\"aam_enabled\":%s,\"aam_level\":%d,"
+		    "\"checksum\":\"%s\"}\n", info.aam_supp ? "true" : "false",
+		    info.aam_enabled ? "true" : "false", info.aam, checksum);
+		return;
+	}
+
+	inventory_string(out, path, false);
+	fprintf(out, ",%lu,", (unsigned long) n);
+	inventory_string(out, info.model, false);
+	putc(',', out);
+	inventory_string(out, info.serial, false);
+	putc(',', out);
+	inventory_string(out, info.firmware, false);
+	fprintf(out, ",%s,%" PRIu64 ",%lu,%lu,%" PRIu64 ",%u,", info.version,
+	    info.sectors, (unsigned long) info.logical_sector,
+	    (unsigned long) info.physical_sector,
+	    info.sectors * info.logical_sector, info.rotation);
+	fprintf(out, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%s\n", info.lba48,
+	    info.smart_supp, info.smart_enabled, info.pm_supp, info.apm_supp,
+	    info.apm_enabled, info.apm, info.aam_supp, info.aam_enabled,
+	    info.aam, checksum);
+}
+
+/* decode every record in a file */
+static int inventory_file( FILE *out, const char *path, bool json )
+{
+	struct stat sb;
+	unsigned char *map;
+	size_t n, count;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &sb)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return -1;
+	}
+
+	count = sb.st_size / INVENTORY_RECORD;
+	if (sb.st_size % INVENTORY_RECORD)
+		fprintf(stderr, "%s: ignoring %lu bytes after the last record\n",
+		    path, (unsigned long) (sb.st_size % INVENTORY_RECORD));
+	if (count == 0) {
+		close(fd);
+		return 0;
+	}
+
+	map = mmap(NULL, count * INVENTORY_RECORD, PROT_READ, MAP_PRIVATE,
+	    fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	posix_madvise(map, count * INVENTORY_RECORD, POSIX_MADV_SEQUENTIAL);
+
+	for (n = 0; n < count; n++)
+		inventory_record(out, path, n, map + n * INVENTORY_RECORD, json);
+
+	munmap(map, count * INVENTORY_RECORD);
+
+	return 0;
+}
+
+static int select_dump( const struct dirent *de )
+{
+	return de->d_name[0] != '.';
+}
+
+/* decode the files in a directory, in the order of their names */
+static int inventory_dir( FILE *out, const char *path, bool json )
+{
+	struct dirent **names;
+	char file[1024];
+	struct stat sb;
+	int rc = 0;
+	int n, i;
+
+	n = scandir(path, &names, select_dump, alphasort);
+	if (n == -1) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		snprintf(file, sizeof(file), "%s/%s", path, names[i]->d_name);
+		if (stat(file, &sb) == 0 && S_ISREG(sb.st_mode) &&
+		    inventory_file(out, file, json))
+			rc = -1;
+		free(names[i]);
+	}
+	free(names);
+
+	return rc;
+}
+
+/*
+ * Decode the records in each of the files or directories, returns -1 if
+ * any of them couldn't be read.
+ */
+int inventory_run( char **paths, int npaths, bool json, FILE *out )
+{
+	struct stat sb;
+	int rc = 0;
+	int i;
+
+	if (!json)
+		fputs("source,record,model,serial,firmware,version,sectors,"
+		    "logical_sector,physical_sector,capacity,rotation,lba48,"
+		    "smart,smart_enabled,pm,apm,apm_enabled,apm_level,aam,"
+		    "aam_enabled,aam_level,checksum\n", out);
+
+	for (i = 0; i < npaths; i++) {
+		if (stat(paths[i], &sb)) {
+			fprintf(stderr, "%s: %s\n", paths[i], strerror(errno));
+			rc = -1;
+		} else if (S_ISDIR(sb.st_mode)) {
+			if (inventory_dir(out, paths[i], json))
+				rc = -1;
+		} else if (inventory_file(out, paths[i], json)) {
+			rc = -1;
+		}
+	}
+
+	return rc;
+}
@@ -0,0 +1,11 @@
+#ifndef INVENTORY_H
+#define INVENTORY_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+void	inventory_clean( char *s );
+void	inventory_string( FILE *out, const char *s, bool json );
+int	inventory_run( char **paths, int npaths, bool json, FILE *out );
+
+#endif /* INVENTORY_H */
@@ -0,0 +1,54 @@
+/*-
+* Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+* Copyright 2009 Marcin Wisnicki <mwisnicki@gmail.com>. All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions
+* are met:
+* 1. Redistributions of source code must retain the above copyright
+*    notice, this list of conditions and the following disclaimer.
+* 2. Redistributions in binary form must reproduce the above copyright
+*    notice, this list of conditions and the following disclaimer in the
+*    documentation and/or other materials provided with the distribution.
+* 3. The name of the author may not be used to endorse or promote products
+*    derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+* BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+* OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+* TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+* USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+*/
+
+/*
+ * The public interface of libataidle.
+ *
+ * Every call takes the ATA handle returned by ata_open() and reports
+ * failure by returning non-zero with errno set; nothing is printed and
+ * the process is never exited.  Different handles may be used from
+ * different threads at the same time, a single handle may not.
+ */
+
+#ifndef LIBATAIDLE_H
+#define LIBATAIDLE_H
+
+/* bumped when a function or structure changes incompatibly */
+#define LIBATAIDLE_API_VERSION	1
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "cache.h"
+#include "cycles.h"
+#include "sim.h"
+#include "smart.h"
+#include "stats.h"
+#include "trace.h"
+#include "util.h"
+
+#endif /* LIBATAIDLE_H */
@@ -0,0 +1,371 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Prometheus exporter.  Every interval the power mode of each drive is
+ * read with CHECK POWER MODE, and the metrics are written to a file in
+ * the text format read by the node exporter's textfile collector.  The
+ * file is written under a temporary name and renamed, so a scrape never
+ * sees half of it.
+ *
+ * Nothing is sent which could spin a drive up: the APM and AAM levels come
+ * from the IDENTIFY cache, and IDENTIFY is only sent to drives which are
+ * already spinning when the cache doesn't have them.  Spin-ups, spin-downs
+ * and the time spent in each mode are worked out from the successive
+ * power modes, so changes between two polls are missed.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "cache.h"
+#include "metrics.h"
+#include "stats.h"
+#include "util.h"
+
+/* power modes, indexed by enum ata_power_mode */
+#define METRICS_NMODES		5
+
+/* upper bounds of the exported histogram buckets, in microseconds */
+static const uint64_t metrics_le[] = {
+	1 << 4, 1 << 7, 1 << 10, 1 << 13, 1 << 16, 1 << 19, 1 << 22, 1 << 25
+};
+
+struct metrics_dev
+{
+	ATA *			ata;
+	const char *		device;
+	bool			up;	/* CHECK POWER MODE worked */
+	enum ata_power_mode	mode;
+	uint64_t		spinups;
+	uint64_t		spindowns;
+	uint64_t		errors;
+	uint64_t		mode_usecs[METRICS_NMODES];
+	bool			have_ident;
+	struct ata_ident	ident;
+};
+
+static bool	metrics_spinning( enum ata_power_mode mode );
+static void	metrics_poll( struct metrics_dev *md, uint64_t elapsed );
+static void	metrics_label( FILE *fp, const char *device );
+static void	metrics_help( FILE *fp, const char *name, const char *type,
+		    const char *help );
+static void	metrics_histograms( FILE *fp, struct metrics_dev *md );
+static int	metrics_write( const char *path, struct metrics_dev *devs,
+		    int ndevices );
+
+static bool metrics_spinning( enum ata_power_mode mode )
+{
+	return mode == ATA_POWER_ACTIVE || mode == ATA_POWER_IDLE;
+}
+
+/*
+ * Find out what a drive is doing.  elapsed is the time since the last
+ * poll, which is put down to the mode the drive was in then.
+ */
+static void metrics_poll( struct metrics_dev *md, uint64_t elapsed )
+{
+	enum ata_power_mode old = md->mode;
+	struct ata_ident ident;
+
+	md->mode_usecs[old] += elapsed;
+
+	ata_setataparams(md->ata, 0, 0);
+	md->up = (ata_cmd(md->ata, ATA_CHECK_POWER_MODE, 0) == 0);
+	md->mode = md->up ? ata_decodepowermode(&md->ata->regs) :
+	    ATA_POWER_UNKNOWN;
+	if (!md->up)
+		md->errors++;
+
+	if (old != ATA_POWER_UNKNOWN && md->mode != ATA_POWER_UNKNOWN) {
+		if (!metrics_spinning(old) && metrics_spinning(md->mode))
+			md->spinups++;
+		else if (metrics_spinning(old) && !metrics_spinning(md->mode))
+			md->spindowns++;
+	}
+
+	/* the cache may have been updated by another ataidle */
+	if (ata_cache_getident(md->ata, &ident) == 0 ||
+	    (metrics_spinning(md->mode) && !md->have_ident &&
+	    ata_getident(md->ata, &ident) == 0)) {
+		memcpy(&md->ident, &ident, sizeof(struct ata_ident));
+		md->have_ident = true;
+	}
+}
+
+/* print a device label value, escaped as the text format wants */
+static void metrics_label( FILE *fp, const char *device )
+{
+	const char *p;
+
+	fputs("device=\"", fp);
+	for (p = device; *p != '\0'; p++) {
+		if (*p == '\\' || *p == '"')
+			fputc('\\', fp);
+		if (*p == '\n')
+			fputs("\\n", fp);
+		else
+			fputc(*p, fp);
+	}
+	fputc('"', fp);
+}
+
+static void metrics_help( FILE *fp, const char *name, const char *type,
+		const char *help )
+{
+	fprintf(fp, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* the command times of a device, with fewer buckets than are kept */
+static void metrics_histograms( FILE *fp, struct metrics_dev *md )
+{
+	const struct ata_stats *stats = ata_stats_get(md->ata);
+	int i, spinup, le, b;
+
+	for (i = 0; stats != NULL && i < stats->nops; i++) {
+		const struct ata_opstats *op = &stats->ops[i];
+
+		for (spinup = 0; spinup < 2; spinup++) {
+			const struct ata_hist *hist = &op->hist[spinup];
+			char labels[64];
+
+			if (hist->count == 0)
+				continue;
+			snprintf(labels, sizeof(labels),
+			    "command=\"%s\",spinup=\"%s\"",
+			    ata_commandname(op->opcode),
+			    spinup ? "true" : "false");
+
+			for (le = 0; le < (int) (sizeof(metrics_le) /
+			    sizeof(metrics_le[0])); le++) {
+				uint64_t n = 0;
+
+				for (b = 0; b < ATA_HIST_BUCKETS - 1; b++)
+					if (ata_hist_lower(b + 1) - 1 <=
+					    metrics_le[le])
+						n += hist->buckets[b];
+
+				fputs("ataidle_command_duration_seconds_bucket{",
+				    fp);
+				metrics_label(fp, md->device);
+				fprintf(fp, ",%s,le=\"%.6f\"} %" PRIu64 "\n",
+				    labels, metrics_le[le] / 1e6, n);
+			}
+
+			fputs("ataidle_command_duration_seconds_bucket{", fp);
+			metrics_label(fp, md->device);
+			fprintf(fp, ",%s,le=\"+Inf\"} %" PRIu64 "\n", labels,
+			    hist->count);
+			fputs("ataidle_command_duration_seconds_sum{", fp);
+			metrics_label(fp, md->device);
+			fprintf(fp, ",%s} %g\n", labels, hist->sum / 1e6);
+			fputs("ataidle_command_duration_seconds_count{", fp);
+			metrics_label(fp, md->device);
+			fprintf(fp, ",%s} %" PRIu64 "\n", labels, hist->count);
+		}
+	}
+}
+
+/* write all the metrics to a temporary file and put it in place */
+static int metrics_write( const char *path, struct metrics_dev *devs,
+		int ndevices )
+{
+	char tmppath[1024];
+	FILE *fp;
+	int i, m;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.%ld", path, (long) getpid());
+	fp = fopen(tmppath, "w");
+	if (fp == NULL)
+		return -1;
+
+	metrics_help(fp, "ataidle_up", "gauge",
+	    "Whether CHECK POWER MODE worked on the last poll.");
+	for (i = 0; i < ndevices; i++) {
+		fputs("ataidle_up{", fp);
+		metrics_label(fp, devs[i].device);
+		fprintf(fp, "} %d\n", devs[i].up);
+	}
+
+	metrics_help(fp, "ataidle_power_state", "gauge",
+	    "Power mode of the drive, 1 for the current mode.");
+	for (i = 0; i < ndevices; i++) {
+		for (m = 0; m < METRICS_NMODES; m++) {
+			fputs("ataidle_power_state{", fp);
+			metrics_label(fp, devs[i].device);
+			fprintf(fp, ",state=\"%s\"} %d\n",
+			    ata_powermodestring(m), devs[i].mode == m);
+		}
+	}
+
+	metrics_help(fp, "ataidle_power_state_seconds_total", "counter",
+	    "Time the drive was seen in each power mode.");
+	for (i = 0; i < ndevices; i++) {
+		for (m = 0; m < METRICS_NMODES; m++) {
+			fputs("ataidle_power_state_seconds_total{", fp);
+			metrics_label(fp, devs[i].device);
+			fprintf(fp, ",state=\"%s\"} %g\n",
+			    ata_powermodestring(m),
+			    devs[i].mode_usecs[m] / 1e6);
+		}
+	}
+
+	metrics_help(fp, "ataidle_spinups_total", "counter",
+	    "Changes from standby or sleep to active or idle between polls.");
+	for (i = 0; i < ndevices; i++) {
+		fputs("ataidle_spinups_total{", fp);
+		metrics_label(fp, devs[i].device);
+		fprintf(fp, "} %" PRIu64 "\n", devs[i].spinups);
+	}
+
+	metrics_help(fp, "ataidle_spindowns_total", "counter",
+	    "Changes from active or idle to standby or sleep between polls.");
+	for (i = 0; i < ndevices; i++) {
+		fputs("ataidle_spindowns_total{", fp);
+		metrics_label(fp, devs[i].device);
+		fprintf(fp, "} %" PRIu64 "\n", devs[i].spindowns);
+	}
+
+	metrics_help(fp, "ataidle_poll_errors_total", "counter",
+	    "Polls where CHECK POWER MODE failed.");
+	for (i = 0; i < ndevices; i++) {
+		fputs("ataidle_poll_errors_total{", fp);
+		metrics_label(fp, devs[i].device);
+		fprintf(fp, "} %" PRIu64 "\n", devs[i].errors);
+	}
+
+	/* decoded as ata_showdeviceinfo() does, 0 if disabled */
+	metrics_help(fp, "ataidle_apm_level", "gauge",
+	    "APM level from IDENTIFY word 91, 0 if APM is disabled.");
+	for (i = 0; i < ndevices; i++) {
+		const struct ata_ident *id = &devs[i].ident;
+
+		if (!devs[i].have_ident || !(id->cmd_supp2 & ATA_APM_SUPPORTED))
+			continue;
+		fputs("ataidle_apm_level{", fp);
+		metrics_label(fp, devs[i].device);
+		fprintf(fp, "} %d\n", (id->cmd_enabled2 & ATA_APM_ENABLED) ?
+		    id->apm_value : 0);
+	}
+
+	metrics_help(fp, "ataidle_aam_level", "gauge",
+	    "AAM level from IDENTIFY word 94 as given to -A, 0 if disabled.");
+	for (i = 0; i < ndevices; i++) {
+		const struct ata_ident *id = &devs[i].ident;
+
+		if (!devs[i].have_ident || !(id->cmd_supp2 & ATA_AAM_SUPPORTED))
+			continue;
+		fputs("ataidle_aam_level{", fp);
+		metrics_label(fp, devs[i].device);
+		fprintf(fp, "} %d\n", (id->cmd_enabled2 & ATA_AAM_ENABLED) ?
+		    (id->aam_value & 0x00FF) - 127 : 0);
+	}
+
+	metrics_help(fp, "ataidle_aam_recommended_level", "gauge",
+	    "AAM level recommended by the vendor, from IDENTIFY word 94.");
+	for (i = 0; i < ndevices; i++) {
+		const struct ata_ident *id = &devs[i].ident;
+
+		if (!devs[i].have_ident || !(id->cmd_supp2 & ATA_AAM_SUPPORTED))
+			continue;
+		fputs("ataidle_aam_recommended_level{", fp);
+		metrics_label(fp, devs[i].device);
+		fprintf(fp, "} %d\n", ((id->aam_value & 0xFF00) >> 8) - 127);
+	}
+
+	metrics_help(fp, "ataidle_command_duration_seconds", "histogram",
+	    "Time taken by commands sent by ataidle, by whether the drive "
+	    "was stopped.");
+	for (i = 0; i < ndevices; i++)
+		metrics_histograms(fp, &devs[i]);
+
+	metrics_help(fp, "ataidle_last_poll_timestamp_seconds", "gauge",
+	    "When the drives were last polled.");
+	fprintf(fp, "ataidle_last_poll_timestamp_seconds %ld\n",
+	    (long) time(NULL));
+
+	if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+		fclose(fp);
+		unlink(tmppath);
+		return -1;
+	}
+	if (fclose(fp) != 0 || rename(tmppath, path) != 0) {
+		unlink(tmppath);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* poll the drives and write the metrics every interval seconds, forever */
+int metrics_run( ATA **atas, char **devices, int ndevices,
+		const char *path, uint32_t interval )
+{
+	struct metrics_dev *devs;
+	uint64_t last;
+	int i;
+
+	devs = calloc(ndevices, sizeof(struct metrics_dev));
+	if (devs == NULL)
+		return -1;
+
+	for (i = 0; i < ndevices; i++) {
+		devs[i].ata = atas[i];
+		devs[i].device = devices[i];
+		devs[i].mode = ATA_POWER_UNKNOWN;
+		if (ata_stats_enable(atas[i], false)) {
+			free(devs);
+			return -1;
+		}
+	}
+
+	last = ata_now_usec();
+	for (;;) {
+		uint64_t now = ata_now_usec();
+
+		for (i = 0; i < ndevices; i++)
+			metrics_poll(&devs[i], now - last);
+		last = now;
+
+		if (metrics_write(path, devs, ndevices))
+			fprintf(stderr, "cannot write %s: %s\n", path,
+			    strerror(errno));
+
+		sleep(interval);
+	}
+
+	/* NOTREACHED */
+	free(devs);
+	return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+#include "atagen.h"
+
+/* how often the drives are polled by default, in seconds */
+#define METRICS_DEFAULT_INTERVAL	60
+
+int	metrics_run( ATA **atas, char **devices, int ndevices,
+	    const char *path, uint32_t interval );
+
+#endif /* METRICS_H */
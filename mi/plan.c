@@ -0,0 +1,204 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Batch plans: a file with one operation per line,
+ *
+ *	device operation [value]
+ *
+ * e.g. "/dev/ada0 apm 254".  Operations are the long names below or the
+ * command line option letters.  Lines are grouped by device, keeping the
+ * order they appear in, so each device only has to be opened once.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plan.h"
+
+static const struct plan_opname {
+	const char *	name;
+	int		ch;
+	bool		hasval;
+} plan_opnames[] = {
+	{ "idle",		'I',	true },
+	{ "idle-now",		'i',	false },
+	{ "standby",		'S',	true },
+	{ "standby-now",	's',	false },
+	{ "sleep",		'o',	false },
+	{ "acoustic",		'A',	true },
+	{ "aam",		'A',	true },
+	{ "apm",		'P',	true },
+	{ "check",		'c',	false },
+	{ NULL,			0,	false }
+};
+
+static struct ata_target *	plan_target( struct ata_target **targets,
+				    int *ntargets, const char *device );
+
+/* look up an operation by name or option letter, 0 if unknown */
+int plan_opchar( const char *name, bool *hasval )
+{
+	const struct plan_opname *op;
+
+	for (op = plan_opnames; op->name != NULL; op++) {
+		if (strcmp(name, op->name) == 0 ||
+		    (name[0] == op->ch && name[1] == '\0')) {
+			*hasval = op->hasval;
+			return op->ch;
+		}
+	}
+
+	return 0;
+}
+
+/* find the target for device, adding it to the end if it's new */
+static struct ata_target * plan_target( struct ata_target **targets,
+		int *ntargets, const char *device )
+{
+	struct ata_target *t;
+	int i;
+
+	for (i = 0; i < *ntargets; i++)
+		if (strcmp((*targets)[i].device, device) == 0)
+			return &(*targets)[i];
+
+	t = realloc(*targets, (*ntargets + 1) * sizeof(struct ata_target));
+	if (t == NULL)
+		return NULL;
+	*targets = t;
+
+	t = &(*targets)[(*ntargets)++];
+	memset(t, 0, sizeof(struct ata_target));
+	t->device = malloc(strlen(device) + 1);
+	if (t->device == NULL)
+		return NULL;
+	strcpy(t->device, device);
+
+	return t;
+}
+
+/*
+ * Read a plan, returning the devices in the order they first appear.
+ * Errors are reported with the file name and line number.
+ */
+int plan_read( FILE *fp, const char *name, struct ata_target **targets,
+		int *ntargets )
+{
+	char line[1024];
+	int lineno = 0;
+
+	*targets = NULL;
+	*ntargets = 0;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *device, *opname, *value, *extra, *end;
+		struct ata_target *t;
+		struct ata_op *ops;
+		bool hasval;
+		int ch;
+
+		lineno++;
+		if ((end = strchr(line, '#')) != NULL)
+			*end = '\0';
+
+		device = strtok(line, " \t\r\n");
+		if (device == NULL)
+			continue;
+		opname = strtok(NULL, " \t\r\n");
+		value = strtok(NULL, " \t\r\n");
+		extra = strtok(NULL, " \t\r\n");
+
+		if (opname == NULL) {
+			fprintf(stderr, "%s:%d: missing operation\n", name, lineno);
+			goto fail;
+		}
+		ch = plan_opchar(opname, &hasval);
+		if (ch == 0) {
+			fprintf(stderr, "%s:%d: unknown operation '%s'\n",
+			    name, lineno, opname);
+			goto fail;
+		}
+		if ((hasval && value == NULL) || (!hasval && value != NULL) ||
+		    extra != NULL) {
+			fprintf(stderr, "%s:%d: '%s' %s a value\n", name, lineno,
+			    opname, hasval ? "needs" : "doesn't take");
+			goto fail;
+		}
+
+		t = plan_target(targets, ntargets, device);
+		if (t == NULL)
+			goto nomem;
+		ops = realloc(t->ops, (t->nops + 1) * sizeof(struct ata_op));
+		if (ops == NULL)
+			goto nomem;
+		t->ops = ops;
+
+		ops[t->nops].ch = ch;
+		ops[t->nops].val = 0;
+		if (hasval) {
+			errno = 0;
+			ops[t->nops].val = strtol(value, &end, 10);
+			if (errno || *end != '\0' || ops[t->nops].val < 0) {
+				fprintf(stderr, "%s:%d: invalid value '%s'\n",
+				    name, lineno, value);
+				goto fail;
+			}
+		}
+		t->nops++;
+	}
+
+	if (ferror(fp)) {
+		fprintf(stderr, "%s: %s\n", name, strerror(errno));
+		goto fail;
+	}
+
+	return 0;
+
+nomem:
+	fprintf(stderr, "%s: %s\n", name, strerror(ENOMEM));
+fail:
+	plan_free(*targets, *ntargets);
+	*targets = NULL;
+	*ntargets = 0;
+	return -1;
+}
+
+void plan_free( struct ata_target *targets, int ntargets )
+{
+	int i;
+
+	for (i = 0; i < ntargets; i++) {
+		free(targets[i].device);
+		free(targets[i].ops);
+	}
+	free(targets);
+}
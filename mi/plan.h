@@ -0,0 +1,27 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* an operation on a device, named after its command line option */
+struct ata_op
+{
+	int	ch;
+	long	val;
+};
+
+/* a device and the operations to apply to it, in order */
+struct ata_target
+{
+	char *		device;
+	struct ata_op *	ops;
+	int		nops;
+};
+
+int	plan_opchar( const char *name, bool *hasval );
+int	plan_read( FILE *fp, const char *name, struct ata_target **targets,
+	    int *ntargets );
+void	plan_free( struct ata_target *targets, int ntargets );
+
+#endif /* PLAN_H */
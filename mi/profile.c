@@ -0,0 +1,215 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Resume latency profiler.  The drive is put into each power mode in turn
+ * and the time taken by the first read afterwards is measured, to find out
+ * what each mode costs in latency.  The read is a 4k O_DIRECT read at a
+ * random offset, so neither the page cache nor, most likely, the drive's
+ * cache can answer it.  Devices which can't be read that way, such as SCSI
+ * generic nodes, get a READ VERIFY SECTORS instead, which has to go to the
+ * media as well.  The median time out of standby is remembered for the
+ * drive's model, for the adaptive spindown daemon.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "cache.h"
+#include "profile.h"
+#include "util.h"
+
+#define PROFILE_READ_SIZE	4096
+
+struct profile_state
+{
+	const char *		name;
+	enum ata_command	cmd;
+	enum ata_power_mode	mode;	/* unknown if it can't be checked */
+};
+
+/* CHECK POWER MODE would wake a sleeping drive, so sleep isn't checked */
+static const struct profile_state profile_states[] = {
+	{ "idle",	ATA_IDLE_IMMEDIATE,	ATA_POWER_IDLE },
+	{ "standby",	ATA_STANDBY_IMMEDIATE,	ATA_POWER_STANDBY },
+	{ "sleep",	ATA_SLEEP,		ATA_POWER_UNKNOWN }
+};
+
+#define PROFILE_NSTATES	(sizeof(profile_states) / sizeof(profile_states[0]))
+
+static int	profile_cmp( const void *a, const void *b );
+static int	profile_enter( ATA *ata, const struct profile_state *st,
+		    bool *reached );
+static int	profile_wake( ATA *ata, int fd, off_t blocks );
+static uint64_t	profile_report( FILE *out, const char *name,
+		    uint64_t *samples, int n, int missed );
+
+static int profile_cmp( const void *a, const void *b )
+{
+	uint64_t x = *(const uint64_t *) a;
+	uint64_t y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* send the command for a power mode and check the drive went there */
+static int profile_enter( ATA *ata, const struct profile_state *st,
+		bool *reached )
+{
+	ata_setataparams(ata, 0, 0);
+	if (ata_cmd(ata, st->cmd, 0))
+		return -1;
+
+	*reached = true;
+	if (st->mode != ATA_POWER_UNKNOWN) {
+		ata_setataparams(ata, 0, 0);
+		if (ata_cmd(ata, ATA_CHECK_POWER_MODE, 0) == 0 &&
+		    ata->regs.valid &&
+		    ata_decodepowermode(&ata->regs) != st->mode)
+			*reached = false;
+	}
+
+	return 0;
+}
+
+/* make the drive go to the media */
+static int profile_wake( ATA *ata, int fd, off_t blocks )
+{
+	off_t off;
+
+	if (fd == -1) {
+		ata_setataparams(ata, 1, 0);
+		return ata_cmd(ata, ATA_READ_VERIFY, 0);
+	}
+
+	off = (((off_t) rand() << 16) ^ rand()) % blocks * PROFILE_READ_SIZE;
+	if (pread(fd, ata->data, PROFILE_READ_SIZE, off) != PROFILE_READ_SIZE)
+		return -1;
+
+	return 0;
+}
+
+/* print the percentiles of one mode, returns the median */
+static uint64_t profile_report( FILE *out, const char *name,
+		uint64_t *samples, int n, int missed )
+{
+	qsort(samples, n, sizeof(uint64_t), profile_cmp);
+
+	fprintf(out, "  %-8s %6d %9.1f %9.1f %9.1f %9.1f %9.1f\n", name, n,
+	    samples[0] / 1e3, samples[(n - 1) * 50 / 100] / 1e3,
+	    samples[(n - 1) * 90 / 100] / 1e3,
+	    samples[(n - 1) * 99 / 100] / 1e3, samples[n - 1] / 1e3);
+	if (missed)
+		fprintf(out, "  (the drive didn't report %s after %d of them)\n",
+		    name, missed);
+
+	return samples[(n - 1) * 50 / 100];
+}
+
+/*
+ * Put the drive into each power mode rounds times, timing how long it
+ * takes to come back each time, and print the percentiles.
+ */
+int profile_resume( ATA *ata, const char *device, int rounds, FILE *out )
+{
+	uint64_t *samples;
+	off_t blocks = 0;
+	unsigned int s;
+	int fd;
+	int r;
+
+	samples = calloc(rounds, sizeof(uint64_t));
+	if (samples == NULL)
+		return -1;
+
+	fd = open(device, O_RDONLY | O_DIRECT);
+	if (fd != -1) {
+		blocks = lseek(fd, 0, SEEK_END) / PROFILE_READ_SIZE;
+		if (blocks <= 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	srand(time(NULL) ^ getpid());
+
+	fprintf(out, "%s: time to the first %s after each mode, in "
+	    "milliseconds\n", device, (fd != -1) ? "read" : "READ VERIFY");
+	fprintf(out, "  %-8s %6s %9s %9s %9s %9s %9s\n", "mode", "count",
+	    "min", "p50", "p90", "p99", "max");
+	fflush(out);
+
+	for (s = 0; s < PROFILE_NSTATES; s++) {
+		const struct profile_state *st = &profile_states[s];
+		uint64_t median;
+		int missed = 0;
+
+		for (r = 0; r < rounds; r++) {
+			uint64_t start;
+			bool reached;
+
+			if (profile_enter(ata, st, &reached)) {
+				fprintf(stderr, "%s: cannot enter %s: %s\n",
+				    device, st->name, strerror(errno));
+				goto fail;
+			}
+			if (!reached)
+				missed++;
+
+			start = ata_now_usec();
+			if (profile_wake(ata, fd, blocks)) {
+				fprintf(stderr, "%s: read after %s failed: %s\n",
+				    device, st->name, strerror(errno));
+				goto fail;
+			}
+			samples[r] = ata_now_usec() - start;
+		}
+
+		median = profile_report(out, st->name, samples, rounds, missed);
+		fflush(out);
+		if (st->mode == ATA_POWER_STANDBY)
+			ata_cache_setspinup(ata, (median + 999) / 1000);
+	}
+
+	if (fd != -1)
+		close(fd);
+	free(samples);
+	return 0;
+
+fail:
+	if (fd != -1)
+		close(fd);
+	free(samples);
+	return -1;
+}
@@ -0,0 +1,10 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+#include "atagen.h"
+
+int	profile_resume( ATA *ata, const char *device, int rounds, FILE *out );
+
+#endif /* PROFILE_H */
@@ -0,0 +1,332 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * ATA PASS-THROUGH (SAT) translation.  The backends describe a command as
+ * a taskfile and get back the CDB to send: PASS-THROUGH(16), or for disks
+ * PASS-THROUGH(12) whenever the registers fit in it and the device hasn't
+ * turned it down.  Some bridges only know one of the two; the first time
+ * a short CDB is rejected sat_fallback() switches the handle to the long
+ * one for good, and the IDENTIFY cache remembers it for later processes,
+ * so the backend retries that command once and never again.  The sense
+ * data that comes back is decoded into the result registers of the
+ * handle.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "cache.h"
+#include "sat.h"
+
+static bool	sat_isdata( enum ata_protocol protocol );
+static bool	sat_fits_short( const struct sat_taskfile *tf );
+
+/* protocols that move data, the rest only return registers */
+static bool sat_isdata( enum ata_protocol protocol )
+{
+	switch (protocol) {
+	case ATA_PROT_PIO_DATA_IN:
+	case ATA_PROT_PIO_DATA_OUT:
+	case ATA_PROT_DMA:
+	case ATA_PROT_DMA_QUEUED:
+	case ATA_PROT_UDMA_DATA_IN:
+	case ATA_PROT_UDMA_DATA_OUT:
+	case ATA_PROT_FPDMA:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* PASS-THROUGH(12) has 8-bit registers and 28-bit addresses */
+static bool sat_fits_short( const struct sat_taskfile *tf )
+{
+	return !tf->lba48 && tf->feature <= 0xFF && tf->count <= 0xFF &&
+	    tf->lba < (1UL << 28);
+}
+
+/*
+ * Fill in cdb (ATA_CDB_MAX bytes) for the taskfile and keep a copy in the
+ * handle.  Returns the length of the CDB, or -1 with errno set to EINVAL
+ * for reserved protocols and registers that don't fit.
+ */
+int sat_build_cdb( ATA *ata, const struct sat_taskfile *tf, uint8_t *cdb )
+{
+	union sat_cdb *sc = (union sat_cdb *) cdb;
+	struct sat_cdb_header *h = &sc->sc_h;
+	uint16_t count = tf->count;
+	uint8_t device = tf->device;
+	int len;
+
+	switch (tf->protocol) {
+	case ATA_PROT_RESERVED0:
+	case ATA_PROT_RESERVED1:
+	case ATA_PROT_RESERVED2:
+		errno = EINVAL;
+		return -1;
+	default:
+		break;
+	}
+	if (tf->lba >= ((uint64_t) 1 << (tf->lba48 ? 48 : 28)) ||
+	    (sat_isdata(tf->protocol) && (tf->datalen == 0 ||
+	    tf->datalen % 512 != 0 || tf->datalen / 512 > 0xFFFF))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	len = SAT_CDB_SHORT;
+	if (ata->satlen == SAT_CDB_LONG || !sat_fits_short(tf))
+		len = SAT_CDB_LONG;
+
+	memset(cdb, 0, ATA_CDB_MAX);
+	h->opcode = (len == SAT_CDB_SHORT) ?
+	    SAT_ATA_PASSTHROUGH_12 : SAT_ATA_PASSTHROUGH_16;
+	h->protocol = tf->protocol;
+	h->extend = tf->lba48;
+
+	if (sat_isdata(tf->protocol)) {
+		/* the transfer length is given in 512-byte blocks */
+		h->t_dir = !tf->write;
+		h->byte_block = 1;
+		if (tf->protocol == ATA_PROT_FPDMA) {
+			/* NCQ commands carry it in the features register */
+			h->t_length = SAT_T_LENGTH_FEATURES;
+		} else {
+			h->t_length = SAT_T_LENGTH_COUNT;
+			/* bridges take it from the count register */
+			if (count == 0)
+				count = tf->datalen / 512;
+		}
+	} else {
+		/* nothing to check but the registers, so ask for them */
+		h->t_length = SAT_T_LENGTH_NONE;
+		h->ck_cond = 1;
+	}
+
+	if (!tf->lba48)
+		device |= (tf->lba >> 24) & 0x0F;
+
+	if (len == SAT_CDB_SHORT) {
+		struct sat_cdb_short *s = &sc->scshort;
+
+		s->features = tf->feature;
+		s->sector_count = count;
+		s->lba_low = tf->lba & 0xFF;
+		s->lba_mid = (tf->lba >> 8) & 0xFF;
+		s->lba_high = (tf->lba >> 16) & 0xFF;
+		s->device = device;
+		s->command = tf->command;
+	} else {
+		struct sat_cdb_long *l = &sc->sclong;
+
+		l->u.std.features0 = tf->feature & 0xFF;
+		l->u.std.sector_count0 = count & 0xFF;
+		l->u.std.lba_low0 = tf->lba & 0xFF;
+		l->u.std.lba_mid0 = (tf->lba >> 8) & 0xFF;
+		l->u.std.lba_high0 = (tf->lba >> 16) & 0xFF;
+		if (tf->lba48) {
+			l->u.std.features1 = tf->feature >> 8;
+			l->u.std.sector_count1 = count >> 8;
+			l->u.std.lba_low1 = (tf->lba >> 24) & 0xFF;
+			l->u.std.lba_mid1 = (tf->lba >> 32) & 0xFF;
+			l->u.std.lba_high1 = (tf->lba >> 40) & 0xFF;
+		}
+		l->device = device;
+		l->command = tf->command;
+	}
+
+	memcpy(ata->cdb, cdb, len);
+	ata->cdblen = len;
+	return len;
+}
+
+/*
+ * Pick the ATA registers out of the sense data, in either descriptor format
+ * (ATA Status Return descriptor) or fixed format as described in SAT-2.
+ */
+int sat_decode_sense( ATA *ata, const uint8_t *sense, int len )
+{
+	int key = 0;
+	int i;
+
+	if (len < 8) {
+		errno = EIO;
+		return -1;
+	}
+
+	switch (sense[0] & 0x7F) {
+	case SAT_SENSE_DESC:
+	case SAT_SENSE_DESC_DEFERRED:
+		key = sense[1] & 0x0F;
+		for (i = 8; i + 1 < len && i < 8 + sense[7]; i += sense[i+1] + 2) {
+			const uint8_t *desc = sense + i;
+
+			if (desc[0] != SAT_SENSE_DESC_ATA_STATUS || i + 14 > len)
+				continue;
+			ata->regs.valid = true;
+			ata->regs.error = desc[3];
+			ata->regs.count = desc[5];
+			ata->regs.lba_low = desc[7];
+			ata->regs.lba_mid = desc[9];
+			ata->regs.lba_high = desc[11];
+			ata->regs.device = desc[12];
+			ata->regs.status = desc[13];
+			break;
+		}
+		break;
+	case SAT_SENSE_FIXED:
+	case SAT_SENSE_FIXED_DEFERRED:
+		key = sense[2] & 0x0F;
+		/*
+		 * the information fields only hold the registers when the
+		 * ASC/ASCQ say so; otherwise they mean something else
+		 */
+		if (len >= 14 && sense[12] == SAT_ASC_ATA_INFO &&
+		    sense[13] == SAT_ASCQ_ATA_INFO) {
+			ata->regs.valid = true;
+			ata->regs.error = sense[3];
+			ata->regs.status = sense[4];
+			ata->regs.device = sense[5];
+			ata->regs.count = sense[6];
+			ata->regs.lba_low = sense[9];
+			ata->regs.lba_mid = sense[10];
+			ata->regs.lba_high = sense[11];
+		}
+		break;
+	default:
+		errno = EIO;
+		return -1;
+	}
+
+	if (ata->regs.valid &&
+			(ata->regs.status & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+		errno = EIO;
+		return -1;
+	}
+
+	switch (key) {
+	case SAT_SENSE_KEY_NO_SENSE:
+	case SAT_SENSE_KEY_RECOVERED:
+		return 0;
+	case SAT_SENSE_KEY_ILLEGAL_REQUEST:
+		errno = EOPNOTSUPP;
+		return -1;
+	default:
+		errno = EIO;
+		return -1;
+	}
+}
+
+/*
+ * Choose the CDBs for a device from its peripheral device type.  Only
+ * disks are sent PASS-THROUGH(12): its opcode, A1h, means something else
+ * to other devices, BLANK to an optical drive.
+ */
+void sat_setpdt( ATA *ata, int pdt )
+{
+	if (pdt == SAT_PDT_DISK || pdt == SAT_PDT_RBC)
+		ata->satlen = 0;
+	else
+		ata->satlen = SAT_CDB_LONG;
+}
+
+/*
+ * After a command failed: if the device turned down the PASS-THROUGH(12)
+ * CDB itself rather than the ATA command in it, use PASS-THROUGH(16) from
+ * now on and return true so the command is sent again.
+ */
+bool sat_fallback( ATA *ata )
+{
+	const uint8_t *sense = ata->sense;
+	uint8_t key, asc;
+
+	if (ata->cdblen != SAT_CDB_SHORT || ata->satlen == SAT_CDB_LONG ||
+	    ata->senselen < 8)
+		return false;
+
+	switch (sense[0] & 0x7F) {
+	case SAT_SENSE_DESC:
+	case SAT_SENSE_DESC_DEFERRED:
+		key = sense[1] & 0x0F;
+		asc = sense[2];
+		break;
+	case SAT_SENSE_FIXED:
+	case SAT_SENSE_FIXED_DEFERRED:
+		if (ata->senselen < 13)
+			return false;
+		key = sense[2] & 0x0F;
+		asc = sense[12];
+		break;
+	default:
+		return false;
+	}
+
+	if (key != SAT_SENSE_KEY_ILLEGAL_REQUEST ||
+	    (asc != SAT_ASC_INVALID_OPCODE && asc != SAT_ASC_INVALID_FIELD))
+		return false;
+
+	ata->satlen = SAT_CDB_LONG;
+	ata_cache_savesat(ata);
+	return true;
+}
+
+/*
+ * Pull the drive's firmware revision, IDENTIFY words 23-26, out of an
+ * ATA Information VPD page. Behind a bridge the standard INQUIRY revision
+ * is the bridge's firmware, not the drive's.
+ */
+int sat_vpd_firmware( const uint8_t *page, size_t len, char *firmware,
+    size_t fwlen )
+{
+	const uint8_t *fw = page + SAT_VPD_IDENT_OFFSET + 46;
+	char buf[9];
+	char *p = buf;
+	int i;
+
+	if (len < SAT_VPD_IDENT_OFFSET + 54 || page[1] != SAT_VPD_ATA_INFO) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* the strings in IDENTIFY data have the bytes of each word swapped */
+	for (i = 0; i < 8; i += 2) {
+		buf[i] = fw[i + 1];
+		buf[i + 1] = fw[i];
+	}
+	buf[8] = '\0';
+	for (i = 7; i >= 0 && (buf[i] == ' ' || buf[i] == '\0'); i--)
+		buf[i] = '\0';
+	while (*p == ' ')
+		p++;
+
+	snprintf(firmware, fwlen, "%s", p);
+	return 0;
+}
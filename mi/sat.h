@@ -0,0 +1,53 @@
+#ifndef SAT_H
+#define SAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+
+/* sizes of the two ATA PASS-THROUGH CDBs */
+#define SAT_CDB_SHORT	12
+#define SAT_CDB_LONG	16
+
+/* the ATA Information VPD page, and where the IDENTIFY data starts in it */
+#define SAT_VPD_ATA_INFO	0x89
+#define SAT_VPD_ATA_INFO_LEN	572
+#define SAT_VPD_IDENT_OFFSET	60
+
+/* peripheral device types which may be sent PASS-THROUGH(12) */
+#define SAT_PDT_DISK		0x00
+#define SAT_PDT_RBC		0x0E
+
+/* ASCs returned by bridges that don't know a CDB */
+#define SAT_ASC_INVALID_OPCODE	0x20
+#define SAT_ASC_INVALID_FIELD	0x24
+
+/* ATA PASS-THROUGH INFORMATION AVAILABLE, which the registers come with */
+#define SAT_ASC_ATA_INFO	0x00
+#define SAT_ASCQ_ATA_INFO	0x1D
+
+/* an ATA command the way the backends hand it to the translator */
+struct sat_taskfile
+{
+	enum ata_protocol	protocol;
+	bool		write;		/* data goes to the drive */
+	bool		lba48;		/* 16-bit registers, EXT commands */
+	uint8_t		command;
+	uint16_t	feature;
+	uint16_t	count;
+	uint64_t	lba;
+	uint8_t		device;
+	size_t		datalen;	/* bytes, a multiple of 512 */
+};
+
+int	sat_build_cdb( ATA *ata, const struct sat_taskfile *tf, uint8_t *cdb );
+int	sat_decode_sense( ATA *ata, const uint8_t *sense, int len );
+void	sat_setpdt( ATA *ata, int pdt );
+bool	sat_fallback( ATA *ata );
+int	sat_vpd_firmware( const uint8_t *page, size_t len, char *firmware,
+	    size_t fwlen );
+
+#endif /* SAT_H */
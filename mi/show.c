@@ -0,0 +1,143 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Printing what is known about a device, for the command line tool.  The
+ * library itself only returns the decoded values, see ata_decodeident().
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "cache.h"
+#include "cycles.h"
+#include "show.h"
+#include "smart.h"
+
+void ata_showdeviceinfo( ATA *ata )
+{
+	int rc = 0;
+	struct ata_ident ident;
+
+	memset(&ident, 0, sizeof(struct ata_ident));
+
+	rc = ata_getident_current( ata,(struct ata_ident*)  &ident );
+
+	if (rc) {
+		printf("could not get device information: is a device attached?\n");
+		return;
+	}
+
+	ata_printident( &ident );
+	ata_smart_show( ata, &ident );
+}
+
+/* print the interesting parts of the IDENTIFY data */
+void ata_printident( const struct ata_ident *ident )
+{
+	struct ata_info info;
+	unsigned int mbsize;
+
+	ata_decodeident(ident, &info);
+
+	printf("Model:\t\t\t%s\n", info.model);
+	printf("Serial:\t\t\t%s\n", info.serial);
+	printf("Firmware Rev:\t\t%s\n", info.firmware);
+	printf("ATA revision:\t\t%s\n", (info.version[0] != '\0') ?
+			info.version : "unknown/pre ATA-2");
+	printf("LBA 48:\t\t\t%s\n", info.lba48 ? "yes" : "no");
+	printf("Geometry:\t\t%d cyls, %d heads, %d spt\n", info.cylinders,
+			info.heads, info.sectors_per_track);
+
+	mbsize = (info.sectors * info.logical_sector) / 1048576;
+
+	printf("Capacity:\t\t%u%s\n", (mbsize < 1024)?
+			mbsize : mbsize/1024, (mbsize < 1024)? "MB" : "GB");
+	printf("SMART Supported: \t%s\n", info.smart_supp ? "yes" : "no" );
+	if (info.smart_supp)
+		printf("SMART Enabled: \t\t%s\n", info.smart_enabled ? "yes" : "no" );
+	printf("APM Supported: \t\t%s\n", info.apm_supp ? "yes" : "no" );
+	if (info.apm_supp)
+		printf("APM Enabled: \t\t%s\n", info.apm_enabled ? "yes" : "no" );
+	printf("AAM Supported: \t\t%s\n", info.aam_supp ? "yes" : "no" );
+	printf("AAM Enabled: \t\t%s\n", info.aam_enabled ? "yes" : "no");
+	if (info.aam_enabled) {
+		printf("Current AAM: \t\t%d\n", info.aam);
+		printf("Vendor Recommends AAM: \t%d\n", info.aam_recommended);
+	}
+
+	if (info.apm_enabled)
+		printf("APM Value: \t\t%d\n", info.apm);
+}
+
+/* print the wear counters, unless the drive would have to spin up */
+void ata_smart_show( ATA *ata, const struct ata_ident *ident )
+{
+	struct ata_smart smart;
+	enum ata_power_mode mode;
+	uint32_t count;
+
+	if (!(ident->cmd_supp1 & ATA_SMART_SUPPORTED) ||
+	    !(ident->cmd_enabled1 & ATA_SMART_ENABLED))
+		return;
+	if (ata_checkpowermode(ata, &mode) == 0 &&
+	    (mode == ATA_POWER_STANDBY || mode == ATA_POWER_SLEEP))
+		return;
+	if (ata_smart_read(ata, &smart))
+		return;
+
+	if (ata_smart_count(&smart, SMART_POWER_ON_HOURS, &count) == 0)
+		printf("Power-On Hours: \t%lu\n", (unsigned long) count);
+	if (ata_smart_count(&smart, SMART_START_STOP, &count) == 0)
+		printf("Start/Stop Count: \t%lu\n", (unsigned long) count);
+	if (ata_smart_count(&smart, SMART_LOAD_CYCLES, &count) == 0)
+		printf("Load Cycle Count: \t%lu\n", (unsigned long) count);
+}
+
+void hexdump(const char *data, int count)
+{
+	int i;
+	for (i = 0; i < count; i++)
+	{
+		printf( "%c ", data[i]);
+	}
+}
+
+/* explain why a drive's settings are being relaxed */
+void cycles_warn( const char *device, const struct cycles_limits *lim,
+		const struct cycles_status *st )
+{
+	fprintf(stderr, "%s: %lu load and %lu start/stop cycles after %lu "
+	    "hours, %.1f and %.1f an hour, heading for %.0f and %.0f of the "
+	    "%lu and %lu rated\n", device, (unsigned long) st->load,
+	    (unsigned long) st->startstop, (unsigned long) st->hours,
+	    st->load_rate, st->startstop_rate, st->load_proj,
+	    st->startstop_proj, (unsigned long) lim->load,
+	    (unsigned long) lim->startstop);
+}
@@ -0,0 +1,14 @@
+#ifndef SHOW_H
+#define SHOW_H
+
+#include "atagen.h"
+#include "cycles.h"
+
+void	ata_showdeviceinfo( ATA *ata );
+void	ata_printident( const struct ata_ident *ident );
+void	ata_smart_show( ATA *ata, const struct ata_ident *ident );
+void	hexdump( const char *data, int count );
+void	cycles_warn( const char *device, const struct cycles_limits *lim,
+	    const struct cycles_status *st );
+
+#endif /* SHOW_H */
@@ -0,0 +1,740 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Simulated drive, for trying out policies and measuring ataidle itself
+ * on machines without disks.  It answers IDENTIFY, CHECK POWER MODE, the
+ * idle, standby and sleep commands, READ VERIFY, SMART READ DATA and the
+ * APM and AAM SET FEATURES subcommands the way a drive would, keeps the
+ * power state and standby timer, and can be made slow or unreliable.  It
+ * can also be given a stream of I/O at random intervals, which shows up
+ * in its I/O statistics and spins it up like real requests would.
+ *
+ * The drive is described by the device name:
+ *
+ *	sim:NAME[,key[=value]...]
+ *
+ * Nothing is kept once the handle is closed, so every open starts from
+ * the state given in the name.  Timers are only looked at when a command
+ * arrives, there is nothing running in the background.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "sim.h"
+#include "util.h"
+
+/* seconds a drive reports active after a command before it reports idle */
+#define SIM_ACTIVE_TIME		5
+/* standby timer value 253 is vendor specific, from 8 to 12 hours */
+#define SIM_VENDOR_TIMER	(8 * 3600)
+/* APM levels which permit standby spin down after level * step seconds */
+#define SIM_APM_STEP		10
+/* AAM level the drive recommends, in the upper byte of word 94 */
+#define SIM_AAM_DEFAULT		ATA_AUTOACOUSTIC_MINPERF
+
+#define SIM_SERIAL_LEN		20
+#define SIM_MODEL		"ATAidle simulated disk"
+#define SIM_FIRMWARE		"SIM1"
+
+/* SMART attributes kept, see smart.h */
+#define SIM_SMART_START_STOP	4
+#define SIM_SMART_POWER_ON	9
+#define SIM_SMART_LOAD_CYCLES	193
+
+#define USEC_PER_SEC		1000000
+
+struct ata_sim
+{
+	char			name[SIM_SERIAL_LEN + 1];
+	char			host[32];	/* controller it is behind */
+	char			array[32];	/* array it is in, or empty */
+	char			slot[32];	/* enclosure slot, or empty */
+	enum ata_power_mode	state;
+	uint64_t		last;		/* when the timers restarted */
+	uint32_t		standby;	/* standby timer, 0 if off */
+	uint8_t			apm;		/* APM level, 0 if disabled */
+	uint8_t			aam;		/* AAM level, 0 if disabled */
+	bool			pm_supp;
+	bool			apm_supp;
+	bool			aam_supp;
+	bool			identwake;	/* IDENTIFY spins the drive up */
+	bool			reset;		/* the host resets it from sleep */
+	uint32_t		latency;	/* usecs taken by each command */
+	uint32_t		spinup;		/* usecs taken to spin up */
+	uint32_t		scale;		/* drive time runs this much faster */
+	uint32_t		errors;		/* percentage of commands failing */
+	int			fail;		/* opcode which always fails */
+	uint32_t		io;		/* mean secs between I/O, 0 if none */
+	uint64_t		ionext;		/* when the next I/O arrives */
+	uint64_t		reads;
+	uint32_t		seed;
+	uint64_t		commands;
+	uint64_t		spinups;
+	uint64_t		opened;		/* when the handle was opened */
+	uint32_t		hours;		/* power-on hours when opened */
+	uint32_t		cycles;		/* start/stop and load cycles */
+};
+
+static int	sim_number( const char *val, unsigned long max,
+		    unsigned long *out );
+static int	sim_setkey( struct ata_sim *sim, const char *key,
+		    const char *val );
+static int	sim_parse( struct ata_sim *sim, const char *spec );
+static uint32_t	sim_hash( const char *s );
+static uint32_t	sim_random( struct ata_sim *sim );
+static uint32_t	sim_timer( uint8_t count );
+static uint64_t	sim_iogap( struct ata_sim *sim );
+static void	sim_advance( struct ata_sim *sim, uint64_t now );
+static void	sim_doio( struct ata_sim *sim, uint64_t now );
+static uint32_t	sim_wake( struct ata_sim *sim );
+static uint8_t	sim_powercount( enum ata_power_mode state );
+static int	sim_setfeature( struct ata_sim *sim, uint8_t feature,
+		    uint8_t count );
+static void	sim_putword( uint8_t *buf, int word, uint16_t val );
+static void	sim_putstring( uint8_t *buf, int word, int len,
+		    const char *str );
+static void	sim_identify( struct ata_sim *sim, uint8_t *buf );
+static void	sim_putattr( uint8_t *buf, int slot, uint8_t id,
+		    uint64_t raw );
+static void	sim_smart( struct ata_sim *sim, uint8_t *buf );
+
+bool sim_isdevice( const char *device )
+{
+	return strncmp(device, ATA_SIM_PREFIX, strlen(ATA_SIM_PREFIX)) == 0;
+}
+
+static int sim_number( const char *val, unsigned long max,
+		unsigned long *out )
+{
+	char *end;
+
+	if (val == NULL)
+		return -1;
+	errno = 0;
+	*out = strtoul(val, &end, 0);
+	if (errno || end == val || *end != '\0' || *out > max)
+		return -1;
+	return 0;
+}
+
+/* apply one key of the device name */
+static int sim_setkey( struct ata_sim *sim, const char *key,
+		const char *val )
+{
+	unsigned long n;
+	double ms;
+	char *end;
+
+	if (strcmp(key, "latency") == 0 || strcmp(key, "spinup") == 0) {
+		/* milliseconds, fractions allowed */
+		if (val == NULL)
+			return -1;
+		ms = strtod(val, &end);
+		if (end == val || *end != '\0' || ms < 0 ||
+		    ms * 1000 > UINT32_MAX)
+			return -1;
+		if (key[0] == 'l')
+			sim->latency = ms * 1000;
+		else
+			sim->spinup = ms * 1000;
+	} else if (strcmp(key, "state") == 0) {
+		if (val == NULL)
+			return -1;
+		else if (strcmp(val, "active") == 0)
+			sim->state = ATA_POWER_ACTIVE;
+		else if (strcmp(val, "idle") == 0)
+			sim->state = ATA_POWER_IDLE;
+		else if (strcmp(val, "standby") == 0)
+			sim->state = ATA_POWER_STANDBY;
+		else if (strcmp(val, "sleep") == 0)
+			sim->state = ATA_POWER_SLEEP;
+		else
+			return -1;
+	} else if (strcmp(key, "standby") == 0) {
+		if (val == NULL || ata_parsetime(val, &sim->standby))
+			return -1;
+	} else if (strcmp(key, "io") == 0) {
+		if (val == NULL || ata_parsetime(val, &sim->io))
+			return -1;
+	} else if (strcmp(key, "apm") == 0) {
+		if (sim_number(val, ATA_APM_MAXPERF, &n))
+			return -1;
+		sim->apm = n;
+	} else if (strcmp(key, "aam") == 0) {
+		if (sim_number(val, ATA_AUTOACOUSTIC_MAXPERF, &n))
+			return -1;
+		sim->aam = n;
+	} else if (strcmp(key, "nopm") == 0) {
+		sim->pm_supp = false;
+	} else if (strcmp(key, "noapm") == 0) {
+		sim->apm_supp = false;
+	} else if (strcmp(key, "noaam") == 0) {
+		sim->aam_supp = false;
+	} else if (strcmp(key, "noreset") == 0) {
+		sim->reset = false;
+	} else if (strcmp(key, "identwake") == 0) {
+		if (sim_number(val, 1, &n))
+			return -1;
+		sim->identwake = n;
+	} else if (strcmp(key, "errors") == 0) {
+		if (sim_number(val, 100, &n))
+			return -1;
+		sim->errors = n;
+	} else if (strcmp(key, "fail") == 0) {
+		if (sim_number(val, 0xFF, &n))
+			return -1;
+		sim->fail = n;
+	} else if (strcmp(key, "seed") == 0) {
+		if (sim_number(val, UINT32_MAX, &n))
+			return -1;
+		sim->seed = n;
+	} else if (strcmp(key, "hours") == 0) {
+		if (sim_number(val, UINT32_MAX, &n))
+			return -1;
+		sim->hours = n;
+	} else if (strcmp(key, "cycles") == 0) {
+		if (sim_number(val, UINT32_MAX, &n))
+			return -1;
+		sim->cycles = n;
+	} else if (strcmp(key, "host") == 0) {
+		if (val == NULL || *val == '\0')
+			return -1;
+		strcpy(sim->host, val);
+	} else if (strcmp(key, "array") == 0) {
+		if (val == NULL || *val == '\0')
+			return -1;
+		strcpy(sim->array, val);
+	} else if (strcmp(key, "slot") == 0) {
+		if (val == NULL || *val == '\0')
+			return -1;
+		strcpy(sim->slot, val);
+	} else if (strcmp(key, "scale") == 0) {
+		if (sim_number(val, UINT32_MAX, &n) || n == 0)
+			return -1;
+		sim->scale = n;
+	} else {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* read NAME[,key[=value]...] */
+static int sim_parse( struct ata_sim *sim, const char *spec )
+{
+	char key[16];
+	char val[32];
+	size_t n;
+	const char *eq;
+
+	n = strcspn(spec, ",");
+	if (n == 0)
+		return -1;
+	memcpy(sim->name, spec, (n < SIM_SERIAL_LEN) ? n : SIM_SERIAL_LEN);
+	spec += n;
+
+	while (*spec == ',') {
+		size_t keylen, vallen;
+
+		spec++;
+		n = strcspn(spec, ",");
+		eq = memchr(spec, '=', n);
+		keylen = (eq != NULL) ? (size_t)(eq - spec) : n;
+		vallen = (eq != NULL) ? n - keylen - 1 : 0;
+		if (keylen >= sizeof(key) || vallen >= sizeof(val))
+			return -1;
+
+		memcpy(key, spec, keylen);
+		key[keylen] = '\0';
+		if (eq != NULL) {
+			memcpy(val, eq + 1, vallen);
+			val[vallen] = '\0';
+		}
+		if (sim_setkey(sim, key, (eq != NULL) ? val : NULL))
+			return -1;
+		spec += n;
+	}
+
+	return 0;
+}
+
+int sim_open( ATA *ata, const char *device )
+{
+	struct ata_sim *sim;
+	const char *name = device + strlen(ATA_SIM_PREFIX);
+
+	sim = calloc(1, sizeof(struct ata_sim));
+	if (sim == NULL)
+		return -1;
+
+	sim->state = ATA_POWER_ACTIVE;
+	sim->pm_supp = true;
+	sim->apm_supp = true;
+	sim->aam_supp = true;
+	sim->identwake = true;
+	sim->reset = true;
+	sim->scale = 1;
+	sim->fail = -1;
+	strcpy(sim->host, "sim0");
+	if (sim_parse(sim, name)) {
+		free(sim);
+		errno = EINVAL;
+		return -1;
+	}
+	/* without a seed, each drive gets its own sequence fixed by its name */
+	if (sim->seed == 0)
+		sim->seed = sim_hash(sim->name);
+	if (sim->seed == 0)
+		sim->seed = 1;
+	sim->last = ata_now_usec();
+	sim->opened = sim->last;
+	if (sim->io > 0)
+		sim->ionext = sim->last + sim_iogap(sim);
+
+	ata->sim = sim;
+	ata->access_mode = ACCESS_MODE_SIM;
+
+	return 0;
+}
+
+void sim_close( ATA *ata )
+{
+	free(ata->sim);
+	ata->sim = NULL;
+}
+
+/* FNV-1a, to derive things from the name of the drive */
+static uint32_t sim_hash( const char *s )
+{
+	uint32_t h = 2166136261U;
+
+	for (; *s != '\0'; s++) {
+		h ^= (unsigned char) *s;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/* xorshift, so injected errors are the same on every run */
+static uint32_t sim_random( struct ata_sim *sim )
+{
+	uint32_t x = sim->seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	sim->seed = x;
+	return x;
+}
+
+/* seconds encoded in the count register of IDLE and STANDBY */
+static uint32_t sim_timer( uint8_t count )
+{
+	if (count <= 240)
+		return count * 5;
+	if (count <= 251)
+		return (count - 240) * 30 * 60;
+	switch (count) {
+	case 252:
+		return 21 * 60;
+	case 253:
+		return SIM_VENDOR_TIMER;
+	case 255:
+		return 21 * 60 + 15;
+	default:
+		return 0;
+	}
+}
+
+/* real microseconds until the next I/O, exponentially distributed */
+static uint64_t sim_iogap( struct ata_sim *sim )
+{
+	double u = (sim_random(sim) + 1.0) / 4294967296.0;
+
+	return -log(u) * sim->io * USEC_PER_SEC / sim->scale + 1;
+}
+
+/* catch up with what the drive did on its own since the last command */
+static void sim_advance( struct ata_sim *sim, uint64_t now )
+{
+	uint64_t idle = (now - sim->last) * sim->scale / USEC_PER_SEC;
+	uint32_t timer = sim->standby;
+
+	if (sim->apm > 0 && sim->apm < ATA_APM_MINPOWER_NO_STANDBY &&
+	    (timer == 0 || (uint32_t) sim->apm * SIM_APM_STEP < timer))
+		timer = sim->apm * SIM_APM_STEP;
+
+	if (sim->state == ATA_POWER_ACTIVE && idle >= SIM_ACTIVE_TIME)
+		sim->state = ATA_POWER_IDLE;
+
+	if ((sim->state == ATA_POWER_ACTIVE || sim->state == ATA_POWER_IDLE) &&
+	    timer != 0 && idle >= timer)
+		sim->state = ATA_POWER_STANDBY;
+}
+
+/* deliver the I/O which arrived before now, waking the drive for each */
+static void sim_doio( struct ata_sim *sim, uint64_t now )
+{
+	while (sim->io > 0 && sim->ionext <= now) {
+		if (sim->ionext > sim->last) {
+			sim_advance(sim, sim->ionext);
+			sim->last = sim->ionext;
+		}
+		sim_wake(sim);
+		sim->state = ATA_POWER_ACTIVE;
+		sim->reads++;
+		sim->ionext += sim_iogap(sim);
+	}
+}
+
+/* spin the drive up if it is stopped, returns the time this takes */
+static uint32_t sim_wake( struct ata_sim *sim )
+{
+	if (sim->state != ATA_POWER_STANDBY && sim->state != ATA_POWER_SLEEP)
+		return 0;
+
+	sim->state = ATA_POWER_ACTIVE;
+	sim->spinups++;
+	return sim->spinup;
+}
+
+static uint8_t sim_powercount( enum ata_power_mode state )
+{
+	switch (state) {
+	case ATA_POWER_STANDBY:
+	case ATA_POWER_SLEEP:
+		return ATA_POWER_COUNT_STANDBY;
+	case ATA_POWER_IDLE:
+		return ATA_POWER_COUNT_IDLE;
+	case ATA_POWER_ACTIVE:
+	default:
+		return ATA_POWER_COUNT_ACTIVE;
+	}
+}
+
+/* returns non-zero if the drive would abort the subcommand */
+static int sim_setfeature( struct ata_sim *sim, uint8_t feature,
+		uint8_t count )
+{
+	switch (feature) {
+	case ATA_APM_ENABLE:
+		if (!sim->apm_supp || count == 0 || count == 0xFF)
+			return -1;
+		sim->apm = count;
+		break;
+	case ATA_APM_DISABLE:
+		if (!sim->apm_supp)
+			return -1;
+		sim->apm = 0;
+		break;
+	case ATA_AUTOACOUSTIC_ENABLE:
+		if (!sim->aam_supp || count == 0xFF)
+			return -1;
+		sim->aam = count;
+		break;
+	case ATA_AUTOACOUSTIC_DISABLE:
+		if (!sim->aam_supp)
+			return -1;
+		sim->aam = 0;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+/* IDENTIFY data is little endian words */
+static void sim_putword( uint8_t *buf, int word, uint16_t val )
+{
+	buf[word * 2] = val & 0xFF;
+	buf[word * 2 + 1] = val >> 8;
+}
+
+/* ATA strings have the first character of each word in the upper byte */
+static void sim_putstring( uint8_t *buf, int word, int len,
+		const char *str )
+{
+	size_t slen = strlen(str);
+	int i;
+
+	for (i = 0; i < len; i++)
+		buf[word * 2 + (i ^ 1)] = (i < (int) slen) ? str[i] : ' ';
+}
+
+static void sim_identify( struct ata_sim *sim, uint8_t *buf )
+{
+	uint16_t supp1 = 0x4000 | ATA_SMART_SUPPORTED;
+	uint16_t supp2 = 0x4000;
+	uint16_t enabled2 = 0x4000;
+	uint32_t wwn = sim_hash(sim->name);
+
+	if (sim->pm_supp)
+		supp1 |= ATA_PM_SUPPORTED;
+	if (sim->apm_supp)
+		supp2 |= ATA_APM_SUPPORTED;
+	if (sim->apm)
+		enabled2 |= ATA_APM_ENABLED;
+	if (sim->aam_supp)
+		supp2 |= ATA_AAM_SUPPORTED;
+	if (sim->aam)
+		enabled2 |= ATA_AAM_ENABLED;
+
+	memset(buf, 0, 512);
+	sim_putword(buf, 0, 0x0040);		/* fixed, not removable */
+	sim_putword(buf, 1, 16383);		/* the usual fake geometry */
+	sim_putword(buf, 3, 16);
+	sim_putword(buf, 6, 63);
+	sim_putstring(buf, 10, SIM_SERIAL_LEN, sim->name);
+	sim_putstring(buf, 23, 8, SIM_FIRMWARE);
+	sim_putstring(buf, 27, 40, SIM_MODEL);
+	sim_putword(buf, 49, 0x0200);		/* LBA supported */
+	sim_putword(buf, 53, 0x0006);		/* words 64-70 and 88 valid */
+	sim_putword(buf, 60, 0xFFFF);		/* largest 28-bit LBA */
+	sim_putword(buf, 61, 0x0FFF);
+	sim_putword(buf, 80, 0x01F0);		/* ATA/ATAPI-4 to ATA8-ACS */
+	sim_putword(buf, 82, supp1);
+	sim_putword(buf, 83, supp2);
+	sim_putword(buf, 84, 0x4000 | ATA_WWN_SUPPORTED);
+	sim_putword(buf, 85, supp1);
+	sim_putword(buf, 86, enabled2);
+	sim_putword(buf, 87, 0x4000 | ATA_WWN_SUPPORTED);
+	sim_putword(buf, 91, sim->apm);
+	sim_putword(buf, 94, (SIM_AAM_DEFAULT << 8) | sim->aam);
+	/* NAA 5 with a zero OUI, and the name hashed into the serial */
+	sim_putword(buf, 108, 0x5000);
+	sim_putword(buf, 110, wwn >> 16);
+	sim_putword(buf, 111, wwn & 0xFFFF);
+}
+
+/* fill in one 12 byte entry of the SMART attribute table */
+static void sim_putattr( uint8_t *buf, int slot, uint8_t id, uint64_t raw )
+{
+	uint8_t *attr = buf + 2 + slot * 12;
+	int i;
+
+	attr[0] = id;
+	attr[1] = 0x32;			/* flags: online, event count */
+	attr[3] = 100;			/* normalised value */
+	attr[4] = 100;			/* worst */
+	for (i = 0; i < 6; i++)
+		attr[5 + i] = (raw >> (i * 8)) & 0xFF;
+}
+
+/* the SMART READ DATA sector, with the counters of the drive */
+static void sim_smart( struct ata_sim *sim, uint8_t *buf )
+{
+	uint64_t hours = sim->hours +
+	    (ata_now_usec() - sim->opened) * sim->scale / USEC_PER_SEC / 3600;
+	uint8_t sum = 0;
+	int i;
+
+	memset(buf, 0, 512);
+	buf[0] = 0x10;			/* revision */
+	sim_putattr(buf, 0, SIM_SMART_START_STOP, sim->cycles + sim->spinups);
+	sim_putattr(buf, 1, SIM_SMART_POWER_ON, hours);
+	sim_putattr(buf, 2, SIM_SMART_LOAD_CYCLES, sim->cycles + sim->spinups);
+
+	for (i = 0; i < 511; i++)
+		sum += buf[i];
+	buf[511] = -sum;
+}
+
+/*
+ * Carry out a command.  Like the real backends, this returns -1 with
+ * errno set if the drive aborted it, and leaves the output registers in
+ * ata->regs and any data in ata->data.
+ */
+int sim_cmd( ATA *ata, enum ata_command atacmd, uint8_t feature,
+		uint8_t count, size_t datalen )
+{
+	struct ata_sim *sim = ata->sim;
+	uint64_t delay = sim->latency;
+	bool restart = true;	/* the command restarts the timers */
+	int rc = 0;
+
+	sim->commands++;
+	sim_doio(sim, ata_now_usec());
+	sim_advance(sim, ata_now_usec());
+
+	/*
+	 * a sleeping drive only listens after a reset, which stops it; with
+	 * nobody to reset it the command times out
+	 */
+	if (sim->state == ATA_POWER_SLEEP) {
+		if (!sim->reset) {
+			ata->regs.valid = false;
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		sim->state = ATA_POWER_STANDBY;
+	}
+
+	if ((int) atacmd == sim->fail ||
+	    (sim->errors > 0 && sim_random(sim) % 100 < sim->errors)) {
+		rc = -1;
+	} else switch (atacmd) {
+	case ATA__IDENTIFY:
+		if (datalen < 512) {
+			rc = -1;
+			break;
+		}
+		if (sim->identwake)
+			delay += sim_wake(sim);
+		sim_identify(sim, ata->data);
+		break;
+	case ATA_CHECK_POWER_MODE:
+		count = sim_powercount(sim->state);
+		restart = false;
+		break;
+	case ATA_IDLE:
+	case ATA_IDLE_IMMEDIATE:
+		if (atacmd == ATA_IDLE) {
+			if (!sim->pm_supp) {
+				rc = -1;
+				break;
+			}
+			sim->standby = sim_timer(count);
+		}
+		delay += sim_wake(sim);
+		sim->state = ATA_POWER_IDLE;
+		break;
+	case ATA_STANDBY:
+	case ATA_STANDBY_IMMEDIATE:
+		if (atacmd == ATA_STANDBY) {
+			if (!sim->pm_supp) {
+				rc = -1;
+				break;
+			}
+			sim->standby = sim_timer(count);
+		}
+		sim->state = ATA_POWER_STANDBY;
+		break;
+	case ATA_SLEEP:
+		sim->state = ATA_POWER_SLEEP;
+		break;
+	case ATA_READ_VERIFY:
+		delay += sim_wake(sim);
+		sim->state = ATA_POWER_ACTIVE;
+		break;
+	case ATA__SETFEATURES:
+		rc = sim_setfeature(sim, feature, count);
+		break;
+	case ATA__SMART:
+		if (feature != ATA__SMART_READ_DATA || datalen < 512) {
+			rc = -1;
+			break;
+		}
+		delay += sim_wake(sim);
+		sim_smart(sim, ata->data);
+		break;
+	default:
+		rc = -1;
+		break;
+	}
+
+	if (delay > 0) {
+		struct timespec ts;
+
+		ts.tv_sec = delay / USEC_PER_SEC;
+		ts.tv_nsec = (delay % USEC_PER_SEC) * 1000;
+		while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+			;
+	}
+	if (restart)
+		sim->last = ata_now_usec();
+
+	ata->regs.valid = true;
+	ata->regs.count = count;
+	if (rc) {
+		ata->regs.status = ATA_STATUS_DRDY | ATA_STATUS_ERR;
+		ata->regs.error = ATA_ERROR_ABRT;
+		errno = EIO;
+	} else {
+		ata->regs.status = ATA_STATUS_DRDY | ATA_STATUS_DSC;
+	}
+
+	return rc;
+}
+
+/* the simulated drive does no I/O of its own */
+int sim_getiostat( ATA *ata, struct ata_iostat *stat )
+{
+	sim_doio(ata->sim, ata_now_usec());
+	memset(stat, 0, sizeof(struct ata_iostat));
+	stat->reads = ata->sim->reads;
+	stat->sectors = ata->sim->reads * 8;
+	return 0;
+}
+
+int sim_getdevid( ATA *ata, char *devid, size_t idlen,
+		char *firmware, size_t fwlen )
+{
+	(void) ata;
+	(void) idlen;
+	(void) fwlen;
+
+	/* no identity, so nothing about the drive outlives the handle */
+	devid[0] = '\0';
+	firmware[0] = '\0';
+	return 0;
+}
+
+int sim_getcontroller( ATA *ata, char *name, size_t len )
+{
+	snprintf(name, len, "%s", ata->sim->host);
+	return 0;
+}
+
+int sim_getarray( ATA *ata, char *name, size_t len )
+{
+	if (ata->sim->array[0] == '\0') {
+		errno = ENOENT;
+		return -1;
+	}
+	snprintf(name, len, "%s", ata->sim->array);
+	return 0;
+}
+
+int sim_getslot( ATA *ata, char *name, size_t len )
+{
+	if (ata->sim->slot[0] == '\0') {
+		errno = ENOENT;
+		return -1;
+	}
+	snprintf(name, len, "%s", ata->sim->slot);
+	return 0;
+}
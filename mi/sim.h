@@ -0,0 +1,26 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+
+/* devices named sim:NAME[,key=value...] are simulated, see ataidle(8) */
+#define ATA_SIM_PREFIX	"sim:"
+
+bool	sim_isdevice( const char *device );
+int	sim_open( ATA *ata, const char *device );
+void	sim_close( ATA *ata );
+int	sim_cmd( ATA *ata, enum ata_command atacmd, uint8_t feature,
+	    uint8_t count, size_t datalen );
+int	sim_getiostat( ATA *ata, struct ata_iostat *stat );
+int	sim_getdevid( ATA *ata, char *devid, size_t idlen,
+	    char *firmware, size_t fwlen );
+int	sim_getcontroller( ATA *ata, char *name, size_t len );
+int	sim_getarray( ATA *ata, char *name, size_t len );
+int	sim_getslot( ATA *ata, char *name, size_t len );
+
+#endif /* SIM_H */
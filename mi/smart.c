@@ -0,0 +1,111 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * SMART attributes.  SMART READ DATA returns a sector with a table of up to
+ * 30 vendor defined attributes, each a 12 byte entry of the id, flags,
+ * normalised value, worst value and six bytes of raw value.  Only a few
+ * counters with well known meanings are used here.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "smart.h"
+
+/* bytes of each attribute table entry, which starts at byte 2 */
+#define SMART_ATTR_SIZE		12
+
+/*
+ * Read the attribute table of the drive.  This needs the drive spinning,
+ * so it wakes a drive which is in standby.
+ */
+int ata_smart_read( ATA *ata, struct ata_smart *smart )
+{
+	const uint8_t *buf;
+	char *data = NULL;
+	uint8_t sum = 0;
+	int rc;
+	int i, j;
+
+	ata_setataparams(ata, 0, 0);
+	ata_setfeature_param(ata, ATA__SMART_READ_DATA);
+	ata_setlba_param(ata, ATA_SMART_LBA);
+	ata_setdataout_params(ata, &data, 512);
+	rc = ata_cmd(ata, ATA__SMART, 0);
+	if (rc)
+		return rc;
+
+	buf = (const uint8_t *) data;
+	for (i = 0; i < 512; i++)
+		sum += buf[i];
+	if (sum != 0) {
+		errno = EIO;
+		return -1;
+	}
+
+	memset(smart, 0, sizeof(struct ata_smart));
+	for (i = 0; i < SMART_NATTRS; i++) {
+		const uint8_t *entry = buf + 2 + i * SMART_ATTR_SIZE;
+		struct ata_smart_attr *attr = &smart->attrs[smart->nattrs];
+
+		if (entry[0] == 0)
+			continue;
+		attr->id = entry[0];
+		attr->flags = entry[1] | (entry[2] << 8);
+		attr->value = entry[3];
+		attr->worst = entry[4];
+		attr->raw = 0;
+		for (j = 5; j >= 0; j--)
+			attr->raw = (attr->raw << 8) | entry[5 + j];
+		smart->nattrs++;
+	}
+
+	return 0;
+}
+
+/*
+ * Get a counter attribute.  Some vendors keep other things in the upper
+ * bytes of the raw value, so only the lower 32 bits are used.
+ */
+int ata_smart_count( const struct ata_smart *smart, uint8_t id,
+		uint32_t *count )
+{
+	int i;
+
+	for (i = 0; i < smart->nattrs; i++) {
+		if (smart->attrs[i].id == id) {
+			*count = smart->attrs[i].raw & 0xFFFFFFFF;
+			return 0;
+		}
+	}
+
+	return -1;
+}
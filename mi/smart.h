@@ -0,0 +1,34 @@
+#ifndef SMART_H
+#define SMART_H
+
+#include <stdint.h>
+
+#include "atagen.h"
+
+/* attributes ataidle looks at */
+#define SMART_START_STOP	4	/* spin-ups */
+#define SMART_POWER_ON_HOURS	9
+#define SMART_LOAD_CYCLES	193	/* head loads */
+
+#define SMART_NATTRS		30
+
+struct ata_smart_attr
+{
+	uint8_t		id;
+	uint16_t	flags;
+	uint8_t		value;		/* normalised, higher is better */
+	uint8_t		worst;
+	uint64_t	raw;		/* 48 bits */
+};
+
+struct ata_smart
+{
+	int			nattrs;
+	struct ata_smart_attr	attrs[SMART_NATTRS];
+};
+
+int	ata_smart_read( ATA *ata, struct ata_smart *smart );
+int	ata_smart_count( const struct ata_smart *smart, uint8_t id,
+	    uint32_t *count );
+
+#endif /* SMART_H */
@@ -0,0 +1,724 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Host-side spindown: the drive firmware timers can only be set to a few
+ * values (see ata_getidleval()) and some drives ignore them, so instead
+ * watch the I/O statistics of each device and send STANDBY IMMEDIATE once
+ * it has been idle for the requested time.
+ *
+ * In adaptive mode the timeout of each drive is chosen from the gaps seen
+ * between its I/O (see adaptive.c) and chosen again every ADAPTIVE_PERIOD.
+ * When the drive's own timer can be set to it, that is used, and otherwise
+ * the host-side timer is.
+ *
+ * Every hour a drive is seen busy its SMART counters are checked against
+ * its load and start/stop cycle ratings (see cycles.c), and its timeout is
+ * doubled when it is wearing out too fast.
+ *
+ * Drives in the same md array, or given as a group, are spun down and up
+ * together: a stripe waits for its slowest member, so a member left in
+ * standby costs every read a spin-up.  A group is only put into standby
+ * once all its members have been idle for their timeouts, and when one of
+ * them sees I/O the others are woken straight away, all at once rather
+ * than one by one as the stripe reaches them.  The drives' own timers
+ * would spin members down on their own, so they are turned off.
+ *
+ * With an APM policy the APM level of each drive is also switched between
+ * a low level and ATA_APM_MAXPERF as its workload changes, see apmswitch.c.
+ * The level the drive is at is read from IDENTIFY word 91 at the start
+ * and kept track of after that, so SET FEATURES is only sent when the
+ * level has to change.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adaptive.h"
+#include "apmswitch.h"
+#include "atadefs.h"
+#include "atagen.h"
+#include "cache.h"
+#include "cycles.h"
+#include "show.h"
+#include "spindown.h"
+#include "util.h"
+#include "wheel.h"
+
+struct spindown_dev
+{
+	const char *		device;
+	ATA *			ata;
+	struct wheel_timer	timer;
+	uint64_t		ios;
+	uint64_t		last_active;	/* tick */
+	bool			standby;
+	uint32_t		timeout;	/* 0 if never spun down */
+	bool			firmware;	/* the drive's timer is used */
+	struct adaptive_gaps *	gaps;		/* NULL unless adaptive */
+	uint64_t		chosen;		/* tick the timeout was set */
+	uint32_t		minimum;	/* shortest timeout allowed */
+	uint64_t		guarded;	/* tick of the next cycles check */
+	struct spindown_group *	group;		/* NULL if on its own */
+	bool			apmsupp;	/* APM is switched */
+	int			apmlevel;	/* the drive's, -1 if unknown */
+	uint8_t			apmlow;		/* level while quiet */
+	struct apm_switch	apm;
+	uint64_t		apmlast;	/* tick of the last sample */
+};
+
+struct spindown_group
+{
+	char			name[ATA_ARRAY_LEN];
+	struct spindown_dev **	members;
+	int			nmembers;
+	bool			standby;	/* put there by us */
+};
+
+/* a member being sent a command by a thread of its own */
+struct spindown_cmd
+{
+	struct spindown_dev *	sd;
+	bool			standby;	/* or idle */
+	pthread_t		thread;
+	bool			started;
+	int			rc;
+	int			error;
+};
+
+struct spindown_ctx
+{
+	struct timer_wheel	wheel;
+	uint32_t		budget;
+	const struct cycles_limits *limits;
+	struct spindown_group *	groups;
+	int			ngroups;
+	const struct apm_policy *apm;		/* NULL if not switching */
+};
+
+static void	spindown_expire( struct wheel_timer *timer, void *arg );
+static void *	spindown_thread( void *arg );
+static int	spindown_together( struct spindown_group *g,
+		    bool standby );
+static void	spindown_expiregroup( struct spindown_ctx *ctx,
+		    struct spindown_dev *sd );
+static void	spindown_wakegroup( struct spindown_ctx *ctx,
+		    struct spindown_dev *sd, uint64_t now );
+static struct spindown_group *	spindown_addgroup( struct spindown_ctx *ctx,
+				    const char *name, int ndevices );
+static int	spindown_groups( struct spindown_ctx *ctx,
+		    struct spindown_dev *devs, int ndevices, char **groups,
+		    int ngroups );
+static void	spindown_adapt( struct spindown_ctx *ctx,
+		    struct spindown_dev *sd, uint64_t now );
+static void	spindown_guard( struct spindown_ctx *ctx,
+		    struct spindown_dev *sd, uint64_t now );
+static void	spindown_apminit( struct spindown_ctx *ctx,
+		    struct spindown_dev *sd );
+static void	spindown_apm( struct spindown_ctx *ctx,
+		    struct spindown_dev *sd, const struct ata_iostat *st,
+		    uint64_t now );
+static void	spindown_free( struct spindown_ctx *ctx,
+		    struct spindown_dev *devs, int ndevices );
+
+static void spindown_expire( struct wheel_timer *timer, void *arg )
+{
+	struct spindown_ctx *ctx = arg;
+	struct spindown_dev *sd = timer->arg;
+	uint64_t deadline = sd->last_active + sd->timeout;
+
+	/*
+	 * Activity only updates last_active, the timer is pushed back
+	 * here when it fires early.
+	 */
+	if (deadline > ctx->wheel.now) {
+		wheel_add(&ctx->wheel, timer, deadline);
+		return;
+	}
+
+	if (sd->group != NULL) {
+		spindown_expiregroup(ctx, sd);
+		return;
+	}
+
+	if (ata_setstandbytimer(sd->ata, ATA_IDLEVAL_IMMEDIATE) == 0) {
+		printf("%s: drive set to standby immediately\n", sd->device);
+		sd->standby = true;
+	} else {
+		fprintf(stderr, "%s: error setting idle timeout: %s\n",
+		    sd->device, strerror(errno));
+		wheel_add(&ctx->wheel, timer, ctx->wheel.now + sd->timeout);
+	}
+	fflush(stdout);
+}
+
+static void * spindown_thread( void *arg )
+{
+	struct spindown_cmd *c = arg;
+
+	if (c->standby)
+		c->rc = ata_setstandbytimer(c->sd->ata, ATA_IDLEVAL_IMMEDIATE);
+	else
+		c->rc = ata_setidletimer(c->sd->ata, ATA_IDLEVAL_IMMEDIATE);
+	c->error = errno;
+
+	return NULL;
+}
+
+/*
+ * Send STANDBY IMMEDIATE, or IDLE IMMEDIATE, to every member of a group
+ * which isn't in that state already, all at once, and wait for them.
+ * Returns how many failed.
+ */
+static int spindown_together( struct spindown_group *g, bool standby )
+{
+	struct spindown_cmd *cmds;
+	int failed = 0;
+	int i;
+
+	cmds = calloc(g->nmembers, sizeof(struct spindown_cmd));
+	if (cmds == NULL)
+		return g->nmembers;
+
+	for (i = 0; i < g->nmembers; i++) {
+		struct spindown_cmd *c = &cmds[i];
+
+		c->sd = g->members[i];
+		c->standby = standby;
+		if (c->sd->standby == standby)
+			continue;
+		c->error = pthread_create(&c->thread, NULL, spindown_thread, c);
+		if (c->error)
+			c->rc = -1;
+		else
+			c->started = true;
+	}
+
+	for (i = 0; i < g->nmembers; i++) {
+		struct spindown_cmd *c = &cmds[i];
+		const char *mode = standby ? "standby" : "idle";
+
+		if (c->started)
+			pthread_join(c->thread, NULL);
+		else if (c->rc == 0)
+			continue;
+
+		if (c->rc) {
+			fprintf(stderr, "%s: error setting %s mode: %s\n",
+			    c->sd->device, mode, strerror(c->error));
+			failed++;
+		} else {
+			printf("%s: drive set to %s immediately (%s)\n",
+			    c->sd->device, mode, g->name);
+			c->sd->standby = standby;
+		}
+	}
+	fflush(stdout);
+
+	free(cmds);
+	return failed;
+}
+
+/*
+ * The timer of a member has run out: put the group into standby if every
+ * member has been idle for its timeout, otherwise wait for the last one.
+ */
+static void spindown_expiregroup( struct spindown_ctx *ctx,
+		struct spindown_dev *sd )
+{
+	struct spindown_group *g = sd->group;
+	uint64_t latest = 0;
+	int i;
+
+	for (i = 0; i < g->nmembers; i++) {
+		struct spindown_dev *m = g->members[i];
+
+		/* a member which never spins down keeps the group up */
+		if (m->timeout == 0)
+			return;
+		if (!m->standby && m->last_active + m->timeout > latest)
+			latest = m->last_active + m->timeout;
+	}
+	if (latest > ctx->wheel.now) {
+		wheel_add(&ctx->wheel, &sd->timer, latest);
+		return;
+	}
+
+	spindown_together(g, true);
+	g->standby = true;
+	for (i = 0; i < g->nmembers; i++) {
+		struct spindown_dev *m = g->members[i];
+
+		if (m->standby)
+			wheel_del(&m->timer);
+		else
+			wheel_add(&ctx->wheel, &m->timer,
+			    ctx->wheel.now + m->timeout);
+	}
+}
+
+/* a member of a group in standby saw I/O, wake the rest with it */
+static void spindown_wakegroup( struct spindown_ctx *ctx,
+		struct spindown_dev *sd, uint64_t now )
+{
+	struct spindown_group *g = sd->group;
+	int i;
+
+	g->standby = false;
+	sd->standby = false;
+	printf("%s: I/O on %s, waking the other members\n", g->name,
+	    sd->device);
+	spindown_together(g, false);
+
+	/* they are about to be read along with it */
+	for (i = 0; i < g->nmembers; i++) {
+		struct spindown_dev *m = g->members[i];
+
+		m->standby = false;
+		m->last_active = now;
+		if (!m->firmware && m->timeout != 0)
+			wheel_add(&ctx->wheel, &m->timer, now + m->timeout);
+	}
+}
+
+static struct spindown_group * spindown_addgroup( struct spindown_ctx *ctx,
+		const char *name, int ndevices )
+{
+	struct spindown_group *g;
+	int i;
+
+	for (i = 0; i < ctx->ngroups; i++)
+		if (strcmp(ctx->groups[i].name, name) == 0)
+			return &ctx->groups[i];
+
+	g = &ctx->groups[ctx->ngroups];
+	g->members = calloc(ndevices, sizeof(struct spindown_dev *));
+	if (g->members == NULL)
+		return NULL;
+	snprintf(g->name, sizeof(g->name), "%s", name);
+	ctx->ngroups++;
+
+	return g;
+}
+
+/*
+ * Put the devices into groups: those given, each a comma separated list
+ * of devices, then the md arrays the others are in.  Groups of one are
+ * dropped, and the drive timers of the members turned off.
+ */
+static int spindown_groups( struct spindown_ctx *ctx,
+		struct spindown_dev *devs, int ndevices, char **groups,
+		int ngroups )
+{
+	char name[ATA_ARRAY_LEN];
+	int i, j, k;
+
+	/* there can't be more groups than devices, or than given */
+	ctx->groups = calloc(ndevices + ngroups, sizeof(struct spindown_group));
+	if (ctx->groups == NULL)
+		return -1;
+
+	for (i = 0; i < ngroups; i++) {
+		const char *p = groups[i];
+		struct spindown_group *g;
+
+		snprintf(name, sizeof(name), "group%d", i + 1);
+		g = spindown_addgroup(ctx, name, ndevices);
+		if (g == NULL)
+			return -1;
+
+		while (*p != '\0') {
+			size_t n = strcspn(p, ",");
+
+			for (j = 0; j < ndevices; j++)
+				if (strlen(devs[j].device) == n &&
+				    strncmp(devs[j].device, p, n) == 0)
+					break;
+			if (j == ndevices || devs[j].group != NULL) {
+				fprintf(stderr, "%.*s: %s\n", (int) n, p,
+				    (j == ndevices) ? "not one of the devices" :
+				    "already in a group");
+				return -1;
+			}
+			devs[j].group = g;
+			g->members[g->nmembers++] = &devs[j];
+			p += n;
+			p += strspn(p, ",");
+		}
+	}
+
+	for (i = 0; i < ndevices; i++) {
+		struct spindown_group *g;
+
+		if (devs[i].group != NULL ||
+		    ata_getarray(devs[i].ata, name, sizeof(name)))
+			continue;
+		g = spindown_addgroup(ctx, name, ndevices);
+		if (g == NULL)
+			return -1;
+		devs[i].group = g;
+		g->members[g->nmembers++] = &devs[i];
+	}
+
+	for (i = 0; i < ctx->ngroups; i++) {
+		struct spindown_group *g = &ctx->groups[i];
+
+		if (g->nmembers == 1)
+			g->members[0]->group = NULL;
+		if (g->nmembers < 2)
+			continue;
+
+		printf("%s:", g->name);
+		for (j = 0; j < g->nmembers; j++)
+			printf(" %s", g->members[j]->device);
+		printf(" spin down together\n");
+
+		for (j = 0; j < g->nmembers; j++) {
+			struct spindown_dev *m = g->members[j];
+			enum ata_power_mode mode;
+
+			/* IDLE would spin a stopped drive up */
+			if (ata_checkpowermode(m->ata, &mode) != 0 &&
+			    errno == ETIMEDOUT)
+				continue;
+			if (mode == ATA_POWER_STANDBY || mode == ATA_POWER_SLEEP)
+				continue;
+			if (ata_setidletimer(m->ata, 0))
+				fprintf(stderr, "%s: error setting idle timeout: "
+				    "%s\n", m->device, strerror(errno));
+			else
+				printf("%s: turned off idle timer\n", m->device);
+		}
+	}
+	fflush(stdout);
+
+	/* squeeze out the groups of one */
+	for (i = 0, k = 0; i < ctx->ngroups; i++) {
+		if (ctx->groups[i].nmembers < 2) {
+			free(ctx->groups[i].members);
+			continue;
+		}
+		if (k != i) {
+			ctx->groups[k] = ctx->groups[i];
+			for (j = 0; j < ctx->groups[k].nmembers; j++)
+				ctx->groups[k].members[j]->group = &ctx->groups[k];
+		}
+		k++;
+	}
+	ctx->ngroups = k;
+
+	return 0;
+}
+
+/*
+ * Choose the timeout of a drive again.  This is only done while the drive
+ * is spinning, as setting its timer with IDLE would otherwise wake it.
+ */
+static void spindown_adapt( struct spindown_ctx *ctx, struct spindown_dev *sd,
+		uint64_t now )
+{
+	uint32_t spinup = ADAPTIVE_DEFAULT_SPINUP;
+	uint32_t timeout;
+	bool firmware;
+
+	sd->chosen = now;
+	if (sd->gaps->n < ADAPTIVE_MIN_GAPS)
+		return;
+
+	ata_cache_getspinup(sd->ata, &spinup);
+	timeout = adaptive_choose(sd->gaps, now, spinup, ctx->budget);
+	if (timeout != 0 && timeout < sd->minimum)
+		timeout = sd->minimum;
+	/* the drive's timer would spin a member down on its own */
+	firmware = (sd->group == NULL && adaptive_firmware(timeout));
+
+	printf("%s: %d idle periods, %lu ms to spin up: ", sd->device,
+	    sd->gaps->n, (unsigned long) spinup);
+	if (timeout == 0)
+		printf("not spinning down\n");
+	else
+		printf("standby after %lu seconds, using the %s timer\n",
+		    (unsigned long) timeout, firmware ? "drive's" : "host");
+
+	/*
+	 * Set the drive's timer every time, in case the drive was reset and
+	 * forgot it, and turn it off when the host-side timer takes over.
+	 */
+	if (firmware || sd->firmware) {
+		if (ata_setidletimer_secs(sd->ata, firmware ? timeout : 0)) {
+			fprintf(stderr, "%s: error setting idle timeout: %s\n",
+			    sd->device, strerror(errno));
+			firmware = false;
+		} else if (firmware)
+			printf("%s: idle timer set to %lu seconds\n", sd->device,
+			    (unsigned long) timeout);
+		else
+			printf("%s: turned off idle timer\n", sd->device);
+	}
+	fflush(stdout);
+
+	sd->timeout = timeout;
+	sd->firmware = firmware;
+	if (firmware || timeout == 0)
+		wheel_del(&sd->timer);
+	else
+		wheel_add(&ctx->wheel, &sd->timer, sd->last_active + timeout);
+}
+
+/* lengthen the timeout of a drive which is using up its rated cycles */
+static void spindown_guard( struct spindown_ctx *ctx, struct spindown_dev *sd,
+		uint64_t now )
+{
+	struct cycles_status st;
+	uint32_t current, relaxed;
+	bool warned = false;
+
+	sd->guarded = now + SPINDOWN_GUARD_INTERVAL;
+	if (cycles_check(sd->ata, ctx->limits, &st) || !st.over)
+		return;
+
+	/* head unloads at low APM levels count as load cycles too */
+	if (ctx->apm != NULL && sd->apmlow != cycles_relax_apm(sd->apmlow)) {
+		cycles_warn(sd->device, ctx->limits, &st);
+		warned = true;
+		sd->apmlow = cycles_relax_apm(sd->apmlow);
+		printf("%s: using APM %u instead of %u while quiet\n",
+		    sd->device, (unsigned int) sd->apmlow,
+		    (unsigned int) ctx->apm->low);
+		fflush(stdout);
+	}
+
+	current = (sd->timeout > sd->minimum) ? sd->timeout : sd->minimum;
+	relaxed = cycles_relax_timeout(current);
+	if (current == 0 || relaxed == current)
+		return;
+
+	if (!warned)
+		cycles_warn(sd->device, ctx->limits, &st);
+	printf("%s: not spinning down before %lu seconds\n", sd->device,
+	    (unsigned long) relaxed);
+	fflush(stdout);
+
+	/* give the new timeout time to show in the rate */
+	sd->guarded = now + CYCLES_MIN_HOURS * 3600;
+	sd->minimum = relaxed;
+	if (sd->gaps != NULL && sd->firmware) {
+		spindown_adapt(ctx, sd, now);
+	} else if (sd->timeout != 0 && sd->timeout < relaxed) {
+		sd->timeout = relaxed;
+		if (!sd->standby)
+			wheel_add(&ctx->wheel, &sd->timer,
+			    sd->last_active + relaxed);
+	}
+}
+
+/* find out whether the drive has APM, and the level it is at */
+static void spindown_apminit( struct spindown_ctx *ctx,
+		struct spindown_dev *sd )
+{
+	struct ata_ident ident;
+	enum ata_power_mode mode;
+	int rc;
+
+	sd->apmlevel = -1;
+	sd->apmlow = ctx->apm->low;
+	sd->apmsupp = true;
+
+	/* a spinning drive is asked, in case the cache is out of date */
+	if (ata_checkpowermode(sd->ata, &mode) == 0 &&
+	    mode != ATA_POWER_STANDBY && mode != ATA_POWER_SLEEP)
+		rc = ata_ident(sd->ata, &ident);
+	else
+		rc = ata_cache_getident(sd->ata, &ident);
+	if (rc)
+		return;
+
+	if (!(ident.cmd_supp2 & ATA_APM_SUPPORTED)) {
+		printf("%s: the device does not support advanced power "
+		    "management, not switching APM\n", sd->device);
+		sd->apmsupp = false;
+	} else if (ident.cmd_enabled2 & ATA_APM_ENABLED) {
+		sd->apmlevel = ident.apm_value & 0xFF;
+	} else {
+		sd->apmlevel = 0;
+	}
+}
+
+/* move the drive to the APM level its workload calls for */
+static void spindown_apm( struct spindown_ctx *ctx, struct spindown_dev *sd,
+		const struct ata_iostat *st, uint64_t now )
+{
+	bool perf;
+	uint8_t level;
+
+	perf = apmswitch_sample(ctx->apm, &sd->apm, st, now - sd->apmlast);
+	sd->apmlast = now;
+	level = perf ? ATA_APM_MAXPERF : sd->apmlow;
+
+	/* a drive put into standby is left alone until it is woken */
+	if (level == sd->apmlevel || sd->standby)
+		return;
+
+	if (ata_setapm(sd->ata, level)) {
+		fprintf(stderr, "%s: set APM failed: %s, not switching APM\n",
+		    sd->device, strerror(errno));
+		sd->apmsupp = false;
+		return;
+	}
+	printf("%s: APM set to %u, the drive is %s\n", sd->device,
+	    (unsigned int) level, perf ? "busy" : "quiet");
+	fflush(stdout);
+	sd->apmlevel = level;
+}
+
+static void spindown_free( struct spindown_ctx *ctx,
+		struct spindown_dev *devs, int ndevices )
+{
+	int i;
+
+	for (i = 0; i < ndevices; i++)
+		free(devs[i].gaps);
+	free(devs);
+	for (i = 0; i < ctx->ngroups; i++)
+		free(ctx->groups[i].members);
+	free(ctx->groups);
+}
+
+/*
+ * Run forever, putting each device into standby mode when it hasn't done
+ * any I/O for timeout seconds.  With a budget, the timeouts adapt to the
+ * I/O of each drive instead, starting from timeout, so that the drives keep
+ * I/O waiting for spin-ups for at most budget seconds an hour.  Unless
+ * limits is NULL, timeouts are lengthened when a drive would exceed them.
+ * groups are lists of devices to spin down together, as well as the md
+ * arrays found.  A timeout of 0 leaves the drives spinning, e.g. to only
+ * switch their APM levels with apm.
+ */
+int spindown_run( ATA **atas, char **devices, int ndevices, uint32_t timeout,
+		uint32_t budget, const struct cycles_limits *limits,
+		char **groups, int ngroups, const struct apm_policy *apm )
+{
+	struct spindown_ctx ctx;
+	struct spindown_dev *devs;
+	struct ata_iostat st;
+	uint64_t start;
+	int i;
+
+	devs = calloc(ndevices, sizeof(struct spindown_dev));
+	if (devs == NULL)
+		return -1;
+
+	start = ata_now_usec() / 1000000;
+	ctx.budget = budget;
+	ctx.limits = limits;
+	ctx.groups = NULL;
+	ctx.ngroups = 0;
+	ctx.apm = apm;
+	wheel_init(&ctx.wheel, 0);
+
+	for (i = 0; i < ndevices; i++) {
+		devs[i].device = devices[i];
+		devs[i].ata = atas[i];
+		devs[i].timer.arg = &devs[i];
+		devs[i].timeout = timeout;
+		if (budget > 0) {
+			devs[i].gaps = calloc(1, sizeof(struct adaptive_gaps));
+			if (devs[i].gaps == NULL) {
+				spindown_free(&ctx, devs, ndevices);
+				return -1;
+			}
+		}
+
+		if (ata_getiostat(atas[i], &st)) {
+			fprintf(stderr, "%s: cannot read I/O statistics: %s\n",
+			    devices[i], strerror(errno));
+			spindown_free(&ctx, devs, ndevices);
+			return -1;
+		}
+		devs[i].ios = st.reads + st.writes;
+		if (timeout != 0)
+			wheel_add(&ctx.wheel, &devs[i].timer, timeout);
+		if (apm != NULL)
+			spindown_apminit(&ctx, &devs[i]);
+	}
+
+	if (spindown_groups(&ctx, devs, ndevices, groups, ngroups)) {
+		spindown_free(&ctx, devs, ndevices);
+		return -1;
+	}
+
+	for (;;) {
+		uint64_t now;
+
+		sleep(SPINDOWN_POLL_INTERVAL);
+		now = ata_now_usec() / 1000000 - start;
+
+		for (i = 0; i < ndevices; i++) {
+			struct spindown_dev *sd = &devs[i];
+
+			if (ata_getiostat(sd->ata, &st))
+				continue;
+			if (apm != NULL && sd->apmsupp)
+				spindown_apm(&ctx, sd, &st, now);
+			if (st.reads + st.writes == sd->ios && st.in_flight == 0)
+				continue;
+
+			sd->ios = st.reads + st.writes;
+			if (sd->gaps != NULL &&
+			    now - sd->last_active > SPINDOWN_POLL_INTERVAL)
+				adaptive_addgap(sd->gaps, now,
+				    now - sd->last_active);
+			sd->last_active = now;
+			if (sd->group != NULL && sd->group->standby) {
+				spindown_wakegroup(&ctx, sd, now);
+			} else if (sd->standby) {
+				sd->standby = false;
+				if (!sd->firmware && sd->timeout != 0)
+					wheel_add(&ctx.wheel, &sd->timer,
+					    now + sd->timeout);
+			}
+			if (sd->gaps != NULL &&
+			    now - sd->chosen >= ADAPTIVE_PERIOD)
+				spindown_adapt(&ctx, sd, now);
+			if (limits != NULL && limits->load > 0 &&
+			    now >= sd->guarded)
+				spindown_guard(&ctx, sd, now);
+		}
+
+		wheel_advance(&ctx.wheel, now, spindown_expire, &ctx);
+	}
+
+	/* NOTREACHED */
+	spindown_free(&ctx, devs, ndevices);
+	return 0;
+}
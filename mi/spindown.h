@@ -0,0 +1,20 @@
+#ifndef SPINDOWN_H
+#define SPINDOWN_H
+
+#include <stdint.h>
+
+#include "apmswitch.h"
+#include "atagen.h"
+#include "cycles.h"
+
+/* how often the I/O statistics are read, in seconds */
+#define SPINDOWN_POLL_INTERVAL	1
+/* how often the SMART cycle counters are checked, in seconds */
+#define SPINDOWN_GUARD_INTERVAL	3600
+
+int	spindown_run( ATA **atas, char **devices, int ndevices,
+	    uint32_t timeout, uint32_t budget,
+	    const struct cycles_limits *limits, char **groups, int ngroups,
+	    const struct apm_policy *apm );
+
+#endif /* SPINDOWN_H */
@@ -0,0 +1,320 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Command timing.  Once enabled on a handle, every command sent through
+ * ata_cmd() or the command queue is timed with the monotonic clock and
+ * added to a histogram for its opcode.  Commands sent while the drive was
+ * stopped go into a separate histogram, so the time taken to spin up can
+ * be told apart from slow firmware, bridges or drivers.  The power mode
+ * is followed from the results of the commands sent, and a command sent
+ * while it isn't known counts as the drive spinning.  If asked to probe,
+ * a CHECK POWER MODE (which never spins the drive up) is sent before such
+ * a command to find out, at the cost of a command the caller didn't ask
+ * for.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "stats.h"
+#include "util.h"
+
+static bool	stats_wakes( enum ata_command atacmd );
+static int	hist_bucket( uint64_t usecs );
+static struct ata_opstats *	stats_op( struct ata_stats *stats,
+		    enum ata_command atacmd );
+static void	stats_printhist( FILE *fp, const struct ata_opstats *op,
+		    int spinup, bool json );
+
+int ata_stats_enable( ATA *ata, bool probe )
+{
+	if (ata->stats != NULL)
+		return 0;
+
+	ata->stats = calloc(1, sizeof(struct ata_stats));
+	if (ata->stats == NULL)
+		return -1;
+	ata->stats->power = ATA_POWER_UNKNOWN;
+	ata->stats->probe = probe;
+
+	return 0;
+}
+
+void ata_stats_free( ATA *ata )
+{
+	free(ata->stats);
+	ata->stats = NULL;
+}
+
+const struct ata_stats * ata_stats_get( ATA *ata )
+{
+	return ata->stats;
+}
+
+/* whether the drive has to be spinning to carry out the command */
+static bool stats_wakes( enum ata_command atacmd )
+{
+	switch (atacmd) {
+	case ATA_CHECK_POWER_MODE:
+	case ATA_STANDBY:
+	case ATA_STANDBY_IMMEDIATE:
+	case ATA_SLEEP:
+		return false;
+	default:
+		return true;
+	}
+}
+
+/*
+ * Called by the backends before sending a command, returns the time to
+ * pass to ata_stats_end().
+ */
+uint64_t ata_stats_begin( ATA *ata, enum ata_command atacmd )
+{
+	if (ata->stats == NULL)
+		return 0;
+
+	if (ata->stats->power == ATA_POWER_UNKNOWN && ata->stats->probe &&
+	    stats_wakes(atacmd)) {
+		struct ata_cmd saved;
+
+		/* the result is picked up by ata_stats_end() */
+		memcpy(&saved, &ata->atacmd, sizeof(struct ata_cmd));
+		ata_setataparams(ata, 0, 0);
+		if (ata_cmd(ata, ATA_CHECK_POWER_MODE, 0) != 0 ||
+		    !ata->regs.valid)
+			ata->stats->probe = false;
+		memcpy(&ata->atacmd, &saved, sizeof(struct ata_cmd));
+	}
+
+	return ata_now_usec();
+}
+
+static struct ata_opstats * stats_op( struct ata_stats *stats,
+		enum ata_command atacmd )
+{
+	int i;
+
+	for (i = 0; i < stats->nops; i++)
+		if (stats->ops[i].opcode == atacmd)
+			return &stats->ops[i];
+
+	if (stats->nops == ATA_STATS_MAXOPS)
+		return NULL;
+	stats->ops[stats->nops].opcode = atacmd;
+	return &stats->ops[stats->nops++];
+}
+
+/* record a finished command and what it did to the power mode */
+void ata_stats_end( ATA *ata, enum ata_command atacmd, int rc,
+		uint64_t start )
+{
+	struct ata_stats *stats = ata->stats;
+	struct ata_opstats *op;
+	uint64_t now;
+	bool stopped;
+
+	if (stats == NULL)
+		return;
+
+	now = ata_now_usec();
+
+	stopped = stats_wakes(atacmd) && (stats->power == ATA_POWER_STANDBY ||
+	    stats->power == ATA_POWER_SLEEP);
+
+	op = stats_op(stats, atacmd);
+	if (op != NULL) {
+		ata_hist_add(&op->hist[stopped ? ATA_STATS_SPINUP :
+		    ATA_STATS_SPINNING], now - start);
+		if (rc)
+			op->errors++;
+	}
+
+	if (rc) {
+		stats->power = ATA_POWER_UNKNOWN;
+		return;
+	}
+
+	switch (atacmd) {
+	case ATA_CHECK_POWER_MODE:
+		stats->power = ata_decodepowermode(&ata->regs);
+		break;
+	case ATA_STANDBY:
+	case ATA_STANDBY_IMMEDIATE:
+		stats->power = ATA_POWER_STANDBY;
+		break;
+	case ATA_SLEEP:
+		stats->power = ATA_POWER_SLEEP;
+		break;
+	case ATA_IDLE:
+	case ATA_IDLE_IMMEDIATE:
+		stats->power = ATA_POWER_IDLE;
+		break;
+	case ATA__SETFEATURES:
+		/* some drives spin up for SET FEATURES, some don't */
+		if (stopped)
+			stats->power = ATA_POWER_UNKNOWN;
+		break;
+	default:
+		stats->power = ATA_POWER_ACTIVE;
+		break;
+	}
+}
+
+static int hist_bucket( uint64_t usecs )
+{
+	int e = 0;
+	int bucket;
+
+	if (usecs < ATA_HIST_SUB)
+		return usecs;
+
+	while ((usecs >> e) >= 2 * ATA_HIST_SUB)
+		e++;
+	bucket = (e + 1) * ATA_HIST_SUB + (int) ((usecs >> e) - ATA_HIST_SUB);
+
+	return (bucket < ATA_HIST_BUCKETS) ? bucket : ATA_HIST_BUCKETS - 1;
+}
+
+/* the smallest time which goes into a bucket */
+uint64_t ata_hist_lower( int bucket )
+{
+	if (bucket < ATA_HIST_SUB)
+		return bucket;
+
+	return (uint64_t) (ATA_HIST_SUB + bucket % ATA_HIST_SUB) <<
+	    (bucket / ATA_HIST_SUB - 1);
+}
+
+void ata_hist_add( struct ata_hist *hist, uint64_t usecs )
+{
+	if (hist->count == 0 || usecs < hist->min)
+		hist->min = usecs;
+	if (usecs > hist->max)
+		hist->max = usecs;
+	hist->count++;
+	hist->sum += usecs;
+	hist->buckets[hist_bucket(usecs)]++;
+}
+
+/* the upper end of the bucket holding the percentile, at most the maximum */
+uint64_t ata_hist_percentile( const struct ata_hist *hist,
+		unsigned int percent )
+{
+	uint64_t rank = (hist->count * percent + 99) / 100;
+	uint64_t seen = 0;
+	int i;
+
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < ATA_HIST_BUCKETS - 1; i++) {
+		seen += hist->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	if (i == ATA_HIST_BUCKETS - 1 || ata_hist_lower(i + 1) - 1 > hist->max)
+		return hist->max;
+	return ata_hist_lower(i + 1) - 1;
+}
+
+static void stats_printhist( FILE *fp, const struct ata_opstats *op,
+		int spinup, bool json )
+{
+	const struct ata_hist *hist = &op->hist[spinup];
+	int i, n;
+
+	if (!json) {
+		fprintf(fp, "  %-18s %-6s %8" PRIu64 " %8" PRIu64,
+		    ata_commandname(op->opcode), spinup ? "yes" : "no",
+		    hist->count, op->errors);
+		fprintf(fp, " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+		    " %10" PRIu64 "\n", hist->min,
+		    ata_hist_percentile(hist, 50),
+		    ata_hist_percentile(hist, 99), hist->max);
+		return;
+	}
+
+	fprintf(fp, "{\"opcode\":%u,\"command\":\"%s\",\"spinup\":%s,",
+	    op->opcode, ata_commandname(op->opcode),
+	    spinup ? "true" : "false");
+	fprintf(fp, "\"count\":%" PRIu64 ",\"errors\":%" PRIu64
+	    ",\"sum_us\":%" PRIu64 ",", hist->count, op->errors, hist->sum);
+	fprintf(fp, "\"min_us\":%" PRIu64 ",\"p50_us\":%" PRIu64
+	    ",\"p99_us\":%" PRIu64 ",\"max_us\":%" PRIu64 ",", hist->min,
+	    ata_hist_percentile(hist, 50), ata_hist_percentile(hist, 99),
+	    hist->max);
+
+	/* [lower bound, count] of every bucket in use */
+	fprintf(fp, "\"buckets\":[");
+	for (i = 0, n = 0; i < ATA_HIST_BUCKETS; i++) {
+		if (hist->buckets[i] == 0)
+			continue;
+		fprintf(fp, "%s[%" PRIu64 ",%lu]", n++ ? "," : "",
+		    ata_hist_lower(i),
+		    (unsigned long) hist->buckets[i]);
+	}
+	fprintf(fp, "]}");
+}
+
+/*
+ * Print the statistics of a device, as a table or as one line of JSON.
+ * Errors are counted per opcode, so they're shown with both histograms.
+ */
+void ata_stats_print( FILE *fp, const char *device,
+		const struct ata_stats *stats, bool json )
+{
+	int i, spinup, n;
+
+	if (json)
+		fprintf(fp, "{\"device\":\"%s\",\"commands\":[", device);
+	else
+		fprintf(fp, "%s: command times in microseconds\n"
+		    "  %-18s %-6s %8s %8s %10s %10s %10s %10s\n", device,
+		    "command", "spinup", "count", "errors", "min", "p50", "p99",
+		    "max");
+
+	for (i = 0, n = 0; stats != NULL && i < stats->nops; i++) {
+		for (spinup = 0; spinup < 2; spinup++) {
+			if (stats->ops[i].hist[spinup].count == 0)
+				continue;
+			if (json && n++)
+				fputc(',', fp);
+			stats_printhist(fp, &stats->ops[i], spinup, json);
+		}
+	}
+
+	if (json)
+		fprintf(fp, "]}\n");
+	fflush(fp);
+}
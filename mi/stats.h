@@ -0,0 +1,65 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+
+/*
+ * Log-linear histogram of command times in microseconds: every power of
+ * two is split into ATA_HIST_SUB equal buckets, so the error is at most
+ * 1/ATA_HIST_SUB of the value from 1us up to several hours.
+ */
+#define ATA_HIST_SUBBITS	3
+#define ATA_HIST_SUB		(1 << ATA_HIST_SUBBITS)
+#define ATA_HIST_BUCKETS	(ATA_HIST_SUB * 36)
+
+struct ata_hist
+{
+	uint64_t	count;
+	uint64_t	sum;
+	uint64_t	min;
+	uint64_t	max;
+	uint32_t	buckets[ATA_HIST_BUCKETS];
+};
+
+/* different opcodes recorded per handle */
+#define ATA_STATS_MAXOPS	16
+
+/* hist[ATA_STATS_SPINUP] holds commands sent while the drive was stopped */
+#define ATA_STATS_SPINNING	0
+#define ATA_STATS_SPINUP	1
+
+struct ata_opstats
+{
+	uint8_t		opcode;
+	uint64_t	errors;
+	struct ata_hist	hist[2];
+};
+
+struct ata_stats
+{
+	enum ata_power_mode	power;	/* last known, to tag spin-ups */
+	bool			probe;	/* find out unknown power modes */
+	int			nops;
+	struct ata_opstats	ops[ATA_STATS_MAXOPS];
+};
+
+int	ata_stats_enable( ATA *ata, bool probe );
+void	ata_stats_free( ATA *ata );
+const struct ata_stats *	ata_stats_get( ATA *ata );
+uint64_t	ata_stats_begin( ATA *ata, enum ata_command atacmd );
+void	ata_stats_end( ATA *ata, enum ata_command atacmd, int rc,
+	    uint64_t start );
+void	ata_stats_print( FILE *fp, const char *device,
+	    const struct ata_stats *stats, bool json );
+
+void	ata_hist_add( struct ata_hist *hist, uint64_t usecs );
+uint64_t	ata_hist_lower( int bucket );
+uint64_t	ata_hist_percentile( const struct ata_hist *hist,
+		    unsigned int percent );
+
+#endif /* STATS_H */
@@ -0,0 +1,560 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Command traces.  Once a handle is traced, every command sent through
+ * ata_cmd() or the command queue is appended to the trace file as one
+ * record: what was asked for, the CDB and sense data of SAT devices, the
+ * registers and data that came back, the error, when the command was sent
+ * and how long it took.  Records are written with a single write() to a
+ * file opened for appending, so processes started by -j can share it.
+ *
+ * A device named
+ *
+ *	replay:FILE[,device=NAME][,scale=N]
+ *
+ * plays a trace back: each command has to be the one recorded next for
+ * the device (the first one in the trace unless NAME is given), and gets
+ * the recorded registers, data and error after the recorded time divided
+ * by N, or straight away if N is 0.  A command which doesn't match fails
+ * with EPROTO, and once the trace runs out every command fails with
+ * ENODATA.
+ *
+ * Replayed devices are never cached, so that what they are sent depends
+ * on the trace alone.  IDENTIFY data a traced handle got from the cache
+ * is recorded with the cached flag, and is played back as a cache hit
+ * rather than as a command.
+ *
+ * All numbers are little-endian.  The file starts with TRACE_MAGIC and
+ * the format version as 32 bits, followed by records of
+ *
+ *	length 32, timestamp 64 (ns since the epoch), latency 64 (ns),
+ *	opcode, feature, count, CDB length 8, LBA 32, data asked for 32,
+ *	failed 8, sense length 8, name length 16, errno 32,
+ *	registers 8 x 8 (valid, status, error, count, LBA low, mid and
+ *	high, device), data returned 32, flags 8,
+ *
+ * then the CDB, sense data, device name and data.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "trace.h"
+
+#define TRACE_MAGIC		"ATATRACE"
+#define TRACE_VERSION		1
+#define TRACE_HEADER		16
+#define TRACE_FIXED		64
+#define TRACE_NAME_MAX		256
+#define TRACE_CACHED		0x01	/* IDENTIFY served from the cache */
+#define TRACE_RECORD_MAX	(TRACE_FIXED + ATA_CDB_MAX + \
+				    ATA_SENSE_BUFSIZE + TRACE_NAME_MAX + \
+				    ATA_DATA_BUFSIZE)
+
+struct ata_trace
+{
+	int		fd;
+	char		name[TRACE_NAME_MAX];
+	size_t		namelen;
+	uint8_t		rec[TRACE_RECORD_MAX];
+};
+
+struct ata_replay
+{
+	uint8_t *	map;
+	size_t		size;
+	size_t *	recs;		/* offsets of the device's records */
+	size_t		nrecs;
+	size_t		next;
+	double		scale;
+	char		name[TRACE_NAME_MAX];
+};
+
+static void	put16( uint8_t *p, uint16_t v );
+static void	put32( uint8_t *p, uint32_t v );
+static void	put64( uint8_t *p, uint64_t v );
+static uint16_t	get16( const uint8_t *p );
+static uint32_t	get32( const uint8_t *p );
+static uint64_t	get64( const uint8_t *p );
+static uint64_t	trace_now( void );
+static void	trace_record( ATA *ata, enum ata_command atacmd,
+		    uint8_t feature, uint8_t count, uint32_t lba,
+		    size_t datalen, int rc, uint64_t start, uint64_t end,
+		    const uint8_t *data, uint8_t flags );
+static int	replay_parse( struct ata_replay *rp, const char *spec,
+		    char *path, size_t len );
+static int	replay_index( struct ata_replay *rp );
+
+static void put16( uint8_t *p, uint16_t v )
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+static void put32( uint8_t *p, uint32_t v )
+{
+	put16(p, v & 0xFFFF);
+	put16(p + 2, v >> 16);
+}
+
+static void put64( uint8_t *p, uint64_t v )
+{
+	put32(p, v & 0xFFFFFFFFUL);
+	put32(p + 4, v >> 32);
+}
+
+static uint16_t get16( const uint8_t *p )
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32( const uint8_t *p )
+{
+	return get16(p) | ((uint32_t) get16(p + 2) << 16);
+}
+
+static uint64_t get64( const uint8_t *p )
+{
+	return get32(p) | ((uint64_t) get32(p + 4) << 32);
+}
+
+static uint64_t trace_now( void )
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* create an empty trace, returning the descriptor to pass to handles */
+int ata_trace_create( const char *path )
+{
+	uint8_t header[TRACE_HEADER];
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (fd == -1)
+		return -1;
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, TRACE_MAGIC, 8);
+	put32(header + 8, TRACE_VERSION);
+	if (write(fd, header, sizeof(header)) != sizeof(header)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* record the commands of a handle in the trace, under the given name */
+int ata_trace_enable( ATA *ata, int fd, const char *device )
+{
+	struct ata_trace *tr;
+
+	if (ata->trace == NULL) {
+		ata->trace = malloc(sizeof(struct ata_trace));
+		if (ata->trace == NULL)
+			return -1;
+	}
+	tr = ata->trace;
+	tr->fd = fd;
+	snprintf(tr->name, sizeof(tr->name), "%s", device);
+	tr->namelen = strlen(tr->name);
+
+	return 0;
+}
+
+void ata_trace_free( ATA *ata )
+{
+	free(ata->trace);
+	ata->trace = NULL;
+}
+
+/*
+ * Called by the backends before sending a command, returns the time to
+ * pass to ata_trace_end().
+ */
+uint64_t ata_trace_begin( ATA *ata )
+{
+	if (ata->trace == NULL)
+		return 0;
+
+	ata->cdblen = 0;
+	ata->senselen = 0;
+	return trace_now();
+}
+
+/* append a finished command to the trace, leaving errno alone */
+void ata_trace_end( ATA *ata, enum ata_command atacmd, uint8_t feature,
+		uint8_t count, uint32_t lba, size_t datalen, int rc,
+		uint64_t start )
+{
+	if (ata->trace == NULL)
+		return;
+
+	trace_record(ata, atacmd, feature, count, lba, datalen, rc, start,
+	    trace_now(), ata->data, 0);
+}
+
+/* record IDENTIFY data which was taken from the cache instead of asked for */
+void ata_trace_cached( ATA *ata, const struct ata_ident *ident )
+{
+	uint64_t now;
+
+	if (ata->trace == NULL)
+		return;
+
+	now = trace_now();
+	ata->cdblen = 0;
+	ata->senselen = 0;
+	memset(&ata->regs, 0, sizeof(struct ata_regs));
+	trace_record(ata, ATA__IDENTIFY, 0, 0, 0, sizeof(struct ata_ident),
+	    0, now, now, (const uint8_t *) ident, TRACE_CACHED);
+}
+
+static void trace_record( ATA *ata, enum ata_command atacmd,
+		uint8_t feature, uint8_t count, uint32_t lba, size_t datalen,
+		int rc, uint64_t start, uint64_t end, const uint8_t *data,
+		uint8_t flags )
+{
+	struct ata_trace *tr = ata->trace;
+	uint8_t *p;
+	size_t cdblen, senselen, datain;
+	int saved_errno = errno;
+
+	cdblen = (ata->cdblen <= ATA_CDB_MAX) ? ata->cdblen : 0;
+	senselen = (ata->senselen <= ATA_SENSE_BUFSIZE) ? ata->senselen : 0;
+	datain = (rc == 0) ? datalen : 0;
+	if (datain > ATA_DATA_BUFSIZE)
+		datain = ATA_DATA_BUFSIZE;
+
+	p = tr->rec;
+	put32(p, TRACE_FIXED + cdblen + senselen + tr->namelen + datain);
+	put64(p + 4, start);
+	put64(p + 12, end - start);
+	p[20] = atacmd;
+	p[21] = feature;
+	p[22] = count;
+	p[23] = cdblen;
+	put32(p + 24, lba);
+	put32(p + 28, datalen);
+	p[32] = (rc != 0);
+	p[33] = senselen;
+	put16(p + 34, tr->namelen);
+	put32(p + 36, rc ? saved_errno : 0);
+	p[40] = ata->regs.valid;
+	p[41] = ata->regs.status;
+	p[42] = ata->regs.error;
+	p[43] = ata->regs.count;
+	p[44] = ata->regs.lba_low;
+	p[45] = ata->regs.lba_mid;
+	p[46] = ata->regs.lba_high;
+	p[47] = ata->regs.device;
+	put32(p + 48, datain);
+	p[52] = flags;
+	memset(p + 53, 0, TRACE_FIXED - 53);
+	p += TRACE_FIXED;
+
+	memcpy(p, ata->cdb, cdblen);
+	p += cdblen;
+	memcpy(p, ata->sense, senselen);
+	p += senselen;
+	memcpy(p, tr->name, tr->namelen);
+	p += tr->namelen;
+	memcpy(p, data, datain);
+	p += datain;
+
+	/* a short write leaves the rest of the trace unreadable, stop there */
+	if (write(tr->fd, tr->rec, p - tr->rec) != p - tr->rec)
+		ata_trace_free(ata);
+
+	errno = saved_errno;
+}
+
+bool trace_isreplay( const char *device )
+{
+	return strncmp(device, ATA_REPLAY_PREFIX,
+	    strlen(ATA_REPLAY_PREFIX)) == 0;
+}
+
+/* split the device name into the file name and the keys after it */
+static int replay_parse( struct ata_replay *rp, const char *spec,
+		char *path, size_t len )
+{
+	const char *comma = strchr(spec, ',');
+	char keys[TRACE_NAME_MAX + 32];
+	char *key, *val, *end, *next;
+
+	if (comma == NULL)
+		comma = spec + strlen(spec);
+	if (comma == spec || (size_t) (comma - spec) >= len)
+		return -1;
+	memcpy(path, spec, comma - spec);
+	path[comma - spec] = '\0';
+
+	if (*comma == '\0')
+		return 0;
+	if (strlen(comma + 1) >= sizeof(keys))
+		return -1;
+	strcpy(keys, comma + 1);
+
+	/* not strtok(), handles may be opened from several threads */
+	for (key = keys; key != NULL; key = next) {
+		next = strchr(key, ',');
+		if (next != NULL)
+			*next++ = '\0';
+		val = strchr(key, '=');
+		if (val == NULL)
+			return -1;
+		*val++ = '\0';
+		if (strcmp(key, "device") == 0) {
+			snprintf(rp->name, sizeof(rp->name), "%s", val);
+		} else if (strcmp(key, "scale") == 0) {
+			rp->scale = strtod(val, &end);
+			if (end == val || *end != '\0' || rp->scale < 0)
+				return -1;
+		} else {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* find the records of the device being replayed */
+static int replay_index( struct ata_replay *rp )
+{
+	size_t off = TRACE_HEADER;
+	size_t *recs;
+
+	if (rp->size < TRACE_HEADER || memcmp(rp->map, TRACE_MAGIC, 8) != 0 ||
+	    get32(rp->map + 8) != TRACE_VERSION)
+		return -1;
+
+	while (off + TRACE_FIXED <= rp->size) {
+		const uint8_t *p = rp->map + off;
+		uint32_t len = get32(p);
+		uint16_t namelen = get16(p + 34);
+		const char *name = (const char *) p + TRACE_FIXED + p[23] + p[33];
+
+		if (len < TRACE_FIXED || len > rp->size - off ||
+		    TRACE_FIXED + p[23] + p[33] + namelen + get32(p + 48) != len)
+			return -1;
+		/* what is copied into the handle's buffers has to fit */
+		if (p[23] > ATA_CDB_MAX || p[33] > ATA_SENSE_BUFSIZE ||
+		    get32(p + 48) > ATA_DATA_BUFSIZE)
+			return -1;
+
+		if (rp->name[0] == '\0' && namelen < sizeof(rp->name)) {
+			memcpy(rp->name, name, namelen);
+			rp->name[namelen] = '\0';
+		}
+		if (namelen == strlen(rp->name) &&
+		    memcmp(name, rp->name, namelen) == 0) {
+			recs = realloc(rp->recs, (rp->nrecs + 1) * sizeof(size_t));
+			if (recs == NULL)
+				return -1;
+			rp->recs = recs;
+			rp->recs[rp->nrecs++] = off;
+		}
+		off += len;
+	}
+
+	return 0;
+}
+
+int ata_replay_open( ATA *ata, const char *device )
+{
+	struct ata_replay *rp;
+	char path[1024];
+	struct stat sb;
+	int fd;
+
+	rp = calloc(1, sizeof(struct ata_replay));
+	if (rp == NULL)
+		return -1;
+	rp->scale = 1;
+
+	if (replay_parse(rp, device + strlen(ATA_REPLAY_PREFIX), path,
+	    sizeof(path))) {
+		free(rp);
+		errno = EINVAL;
+		return -1;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &sb)) {
+		if (fd != -1)
+			close(fd);
+		free(rp);
+		return -1;
+	}
+	rp->size = sb.st_size;
+	rp->map = (rp->size > 0) ? mmap(NULL, rp->size, PROT_READ,
+	    MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (rp->map == MAP_FAILED || replay_index(rp)) {
+		if (rp->map != MAP_FAILED)
+			munmap(rp->map, rp->size);
+		free(rp->recs);
+		free(rp);
+		errno = EINVAL;
+		return -1;
+	}
+
+	ata->replay = rp;
+	ata->access_mode = ACCESS_MODE_REPLAY;
+	return 0;
+}
+
+void ata_replay_close( ATA *ata )
+{
+	struct ata_replay *rp = ata->replay;
+
+	if (rp == NULL)
+		return;
+	munmap(rp->map, rp->size);
+	free(rp->recs);
+	free(rp);
+	ata->replay = NULL;
+}
+
+/* answer a command with the next record of the device */
+int ata_replay_cmd( ATA *ata, enum ata_command atacmd, uint8_t feature,
+		uint8_t count, uint32_t lba, size_t datalen )
+{
+	struct ata_replay *rp = ata->replay;
+	const uint8_t *p;
+	size_t cdblen, senselen, namelen, datain;
+	uint64_t latency;
+
+	if (rp->next == rp->nrecs) {
+		errno = ENODATA;
+		return -1;
+	}
+
+	p = rp->map + rp->recs[rp->next];
+	if ((p[52] & TRACE_CACHED) || p[20] != atacmd || p[21] != feature ||
+	    p[22] != count || get32(p + 24) != lba ||
+	    get32(p + 28) != datalen) {
+		errno = EPROTO;
+		return -1;
+	}
+	rp->next++;
+
+	/* scale 0 answers straight away */
+	latency = (rp->scale > 0) ? get64(p + 12) / rp->scale : 0;
+	if (latency > 0) {
+		struct timespec ts;
+
+		ts.tv_sec = latency / 1000000000;
+		ts.tv_nsec = latency % 1000000000;
+		while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+			;
+	}
+
+	ata->regs.valid = p[40];
+	ata->regs.status = p[41];
+	ata->regs.error = p[42];
+	ata->regs.count = p[43];
+	ata->regs.lba_low = p[44];
+	ata->regs.lba_mid = p[45];
+	ata->regs.lba_high = p[46];
+	ata->regs.device = p[47];
+
+	cdblen = p[23];
+	senselen = p[33];
+	namelen = get16(p + 34);
+	datain = get32(p + 48);
+	p += TRACE_FIXED;
+
+	memcpy(ata->cdb, p, cdblen);
+	ata->cdblen = cdblen;
+	p += cdblen;
+	memcpy(ata->sense, p, senselen);
+	ata->senselen = senselen;
+	p += senselen + namelen;
+	memcpy(ata->data, p, datain);
+
+	p = rp->map + rp->recs[rp->next - 1];
+	if (p[32]) {
+		errno = get32(p + 36);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Play back IDENTIFY data which was taken from the cache when the trace
+ * was recorded.  Returns -1 if the next record isn't one, as a cache miss.
+ */
+int ata_replay_cached( ATA *ata, struct ata_ident *ident )
+{
+	struct ata_replay *rp = ata->replay;
+	const uint8_t *p;
+
+	if (rp->next == rp->nrecs)
+		return -1;
+	p = rp->map + rp->recs[rp->next];
+	if (!(p[52] & TRACE_CACHED) || p[20] != ATA__IDENTIFY ||
+	    get32(p + 48) != sizeof(struct ata_ident))
+		return -1;
+	rp->next++;
+
+	memcpy(ident, p + TRACE_FIXED + p[23] + p[33] + get16(p + 34),
+	    sizeof(struct ata_ident));
+	return 0;
+}
+
+int ata_replay_getdevid( ATA *ata, char *devid, size_t idlen,
+		char *firmware, size_t fwlen )
+{
+	(void) idlen;
+	(void) fwlen;
+
+	/*
+	 * no identity, so nothing is cached for the device: whether IDENTIFY
+	 * is sent has to depend on the trace alone, not on what earlier runs
+	 * left in the cache
+	 */
+	devid[0] = '\0';
+	firmware[0] = '\0';
+	return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+
+/* devices named replay:FILE[,key=value...] play a trace back */
+#define ATA_REPLAY_PREFIX	"replay:"
+
+int	ata_trace_create( const char *path );
+int	ata_trace_enable( ATA *ata, int fd, const char *device );
+void	ata_trace_free( ATA *ata );
+uint64_t	ata_trace_begin( ATA *ata );
+void	ata_trace_end( ATA *ata, enum ata_command atacmd, uint8_t feature,
+	    uint8_t count, uint32_t lba, size_t datalen, int rc,
+	    uint64_t start );
+void	ata_trace_cached( ATA *ata, const struct ata_ident *ident );
+
+bool	trace_isreplay( const char *device );
+int	ata_replay_open( ATA *ata, const char *device );
+void	ata_replay_close( ATA *ata );
+int	ata_replay_cmd( ATA *ata, enum ata_command atacmd, uint8_t feature,
+	    uint8_t count, uint32_t lba, size_t datalen );
+int	ata_replay_cached( ATA *ata, struct ata_ident *ident );
+int	ata_replay_getdevid( ATA *ata, char *devid, size_t idlen,
+	    char *firmware, size_t fwlen );
+
+#endif /* TRACE_H */
@@ -27,16 +27,18 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sysexits.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "atadefs.h"
 #include "atagen.h"
+#include "cache.h"
 #include "util.h"
 
 static int is_big_endian(void);
@@ -44,68 +46,90 @@ static int is_big_endian(void);
 /* calculate the idle timer value to send to the drive. */
 int ata_getidleval(uint32_t idle_mins, uint16_t *timer_val)
 {
-	int rc = 0;
+	if (idle_mins == ATA_IDLEVAL_IMMEDIATE) {
+		*timer_val = ATA_IDLEVAL_IMMEDIATE;
+		return 0;
+	}
 
-	/* idle value of 0 disables spindown */
-	if( idle_mins == 0 )
-		*timer_val = 0;
+	/* keeps idle_mins * 60 from overflowing */
+	if (idle_mins > 330) {
+		errno = EINVAL;
+		return -1;
+	}
 
-	/* value is (value*5)s between 1 and 20 minutes */
-	if( idle_mins <= 20 )
-		*timer_val = (idle_mins*60)/5;
+	return ata_getidlesecs(idle_mins * 60, timer_val);
+}
 
-	/* special case for 21 minutes */
-	if( idle_mins == 21 )
+/*
+ * The count register value for a timer of secs seconds: 0 disables it,
+ * 1-240 are multiples of 5 seconds up to 20 minutes, 241-251 are
+ * (value - 240) * 30 minutes, up to 5.5 hours, and 252 is 21 minutes.
+ * There is no encoding for anything else.
+ */
+int ata_getidlesecs(uint32_t secs, uint16_t *timer_val)
+{
+	if (secs <= 20 * 60 && secs % 5 == 0)
+		*timer_val = secs / 5;
+	else if (secs == 21 * 60)
 		*timer_val = 252;
-
-	/* there is no encoding for values between 21 and 30 minutes */
-	if( (idle_mins > 21) && (idle_mins < 30) ) {
-		printf("cannot set timeout for values 20-30 minutes\n" );
-		rc = -2;
+	else if (secs % 1800 == 0 && secs <= 330 * 60)
+		*timer_val = 240 + secs / 1800;
+	else {
+		errno = EINVAL;
+		return -1;
 	}
 
-	/* after 30 mins, encoding is (idle_mins-29)*30, so you
-	 * can only encode multiples of 30 minutes
-	 */
-	if( idle_mins >= 30 ) {
-		/* if it's not a multiple of 30 minutes, or it's greater than 5 hours,
-		 * we can't handle it.
-		 */
-		if( (((idle_mins % 30) != 0) || (idle_mins > 330))
-				&& (idle_mins != ATA_IDLEVAL_IMMEDIATE) )
-		{
-			printf( "idle value must be a multiple of 30 minutes, "
-					"up to 5 hours\n" );
-			rc = -2;
-		}
+	return 0;
+}
+
 
-		/* otherwise, calculate the timer value */
-		if(idle_mins == ATA_IDLEVAL_IMMEDIATE)
-			*timer_val = ATA_IDLEVAL_IMMEDIATE;
-		else
-			*timer_val = 241 + (idle_mins/30);
+/*
+ * parse a timeout given in minutes, or in seconds, minutes or hours
+ * with an s, m or h suffix
+ */
+int ata_parsetime(const char *str, uint32_t *secs)
+{
+	char *end;
+	unsigned long val;
+	unsigned long mult = 60;
+
+	errno = 0;
+	val = strtoul(str, &end, 10);
+	if (errno || end == str)
+		return -1;
+
+	switch (*end) {
+	case 's':
+		mult = 1;
+		end++;
+		break;
+	case 'm':
+		end++;
+		break;
+	case 'h':
+		mult = 3600;
+		end++;
+		break;
 	}
 
-	return rc;
+	if (*end != '\0' || val > UINT32_MAX / mult)
+		return -1;
+
+	*secs = val * mult;
+	return 0;
 }
 
 
-char * ata_getversionstring( unsigned short ata_version )
+/* describe the highest ATA version in the major version word */
+char * ata_getversionstring( uint16_t ata_version, char *version, size_t len )
 {
-	const int ATAVERSION_LEN = 16;
-	char * version = malloc(ATAVERSION_LEN);
 	int i;
 
-	if(version == 0) { /* malloc failed */
-		fprintf(stderr, "malloc failed\n");
-		return NULL;
-	}
-
-	memset(version, 0, ATAVERSION_LEN);
+	memset(version, 0, len);
 
 	for(i = 0; i < 15; i++) {
 		if( (ata_version >> i) > 0 ) {
-			sprintf(version, "ATA-%d", i);
+			snprintf(version, len, "ATA-%d", i);
 		}
 	}
 
@@ -113,69 +137,48 @@ char * ata_getversionstring( unsigned short ata_version )
 }
 
 
-void usage(void)
-{
-	printf( "ataidle version " ATAIDLE_VERSION "\n\n"
-			"usage: \n"
-			"ataidle [-h] [-i] [-s] [-o] [-I idle] [-S standby] [-A acoustic] [-P apm]\n"
-			"\tdevice\n\n"
-			"Options:\n");
-	printf(
-			"-h\t\tdisplay this help and exit\n"
-			"-I\t\tset the idle timeout in minutes\n"
-			"-i\t\tput the drive into idle mode\n"
-			"-S\t\tset the standby timeout in minutes\n"
-			"-s\t\tput the drive into standby mode\n"
-			"-o\t\tput the drive into sleep mode\n"
-			"-A\t\tset the acoustic level, values 1-127\n"
-			"-P\t\tset the power management level, values 1-254\n"
-			"device\t\tthe device node e.g /dev/ad0\n\n"
-			"if no options are specified, information\n"
-			"about the device will be displayed\n\n");
-
-	exit(EX_USAGE);
-}
-
+/*
+ * swap the bytes of each 16 bit word starting at buf[from], up to and
+ * including the word starting at buf[to].  Two words are swapped at a
+ * time with shifts and masks, which works the same on any byte order.
+ */
 void byteswap(char * buf, int from, int to)
 {
+	int end = from + ((to - from) / 2 + 1) * 2;
 	int i;
-	for(i = from; i <= to; i+=2)
-	{
+
+	for (i = from; i + 4 <= end; i += 4) {
+		uint32_t w;
+
+		memcpy(&w, buf + i, 4);
+		w = ((w & 0x00FF00FFUL) << 8) | ((w >> 8) & 0x00FF00FFUL);
+		memcpy(buf + i, &w, 4);
+	}
+
+	if (i < end) {
 		char b1 = buf[i];
 		buf[i] = buf[i+1];
 		buf[i+1] = b1;
 	}
 }
 
+/* remove leading spaces from buf[from..to], padding the end with NULs */
 void strpack(char * buf, int from, int to)
 {
-	int i = 0, j= 0, k = 0;
+	static const uint32_t spaces = 0x20202020UL;
+	int i = 0;
 	int numchars = (to-from)+1;
-	char *tmpbuf = malloc(numchars*sizeof(char));
-
-	if(tmpbuf == 0) { /* malloc failed, skip the string packing */
-		fprintf(stderr, "malloc failed\n");
-		return;
-	}
-
-	strncpy(tmpbuf, buf+from, numchars);
-	memset(buf+from, 0, numchars);
 
-	i = 0;
-
-	while(tmpbuf[i] == ' ')
+	while (i + 4 <= numchars && memcmp(buf + from + i, &spaces, 4) == 0)
+		i += 4;
+	while(i < numchars && buf[from+i] == ' ')
 		i++;
 
-	j = 0;
-	k = 0;
-
-	for(j = i; j < numchars; j++)
-	{
-		buf[from+k] = tmpbuf[j];
-		k++;
-	}
+	if (i == 0)
+		return;
 
-	free(tmpbuf);
+	memmove(buf+from, buf+from+i, numchars-i);
+	memset(buf+from+numchars-i, 0, i);
 }
 
 void mem_swap(int16_t * val)
@@ -194,101 +197,93 @@ static int is_big_endian(void)
 	return (i != 1);
 }
 
-void ata_showdeviceinfo( ATA *ata )
+/* decode the parts of the IDENTIFY data ataidle knows about */
+void ata_decodeident( const struct ata_ident *ident, struct ata_info *info )
 {
-	int rc = 0;
-	struct ata_ident ident;
-	int16_t *buf;
-	unsigned int mbsize;
-	char model[41];
-	char serial[21];
-	char firmware[9];
-	char *ata_version = NULL;
-
-	memset(&ident, 0, sizeof(struct ata_ident));
-
-	rc = ata_ident( ata,(struct ata_ident*)  &ident );
-
-	if (rc) {
-		printf("could not get device information: is a device attached?\n");
-		return;
-	}
-
-	buf = (int16_t*) &ident;
-
-	memset(model, 0, 41);
-	memset(serial, 0, 21);
-	memset(firmware, 0, 9);
-
-	strncpy(model, (char*) ident.model, 40);
-	strncpy(serial, (char*) ident.serial, 20);
-	strncpy(firmware, (char*) ident.firmware, 8);
-
-	printf("Model:\t\t\t%s\n", model);
-	printf("Serial:\t\t\t%s\n", serial);
-	printf("Firmware Rev:\t\t%s\n", firmware);
-	ata_version = ata_getversionstring(buf[80]);
-	printf("ATA revision:\t\t%s\n", (ident.version_major > 1)?
-			ata_version : "unknown/pre ATA-2");
-	printf("LBA 48:\t\t\t%s\n", (buf[86] & 0x400)? "yes" : "no");
-	printf("Geometry:\t\t%d cyls, %d heads, %d spt\n", buf[1], buf[3], buf[6]);
-
-	if (ata_version != NULL)
-		free(ata_version);
-
-	mbsize = 0;
-
-	if (buf[86] & 0x400)
-	{
-		mbsize = (((uint64_t)ident.max_lba48_address[0] +
-			((uint64_t)ident.max_lba48_address[1] << 16) +
-			((uint64_t)ident.max_lba48_address[2] << 32) +
-			((uint64_t)ident.max_lba48_address[3] << 48))*512)/1048576;
-	}
-	else 
-	{
-		mbsize = ((ident.nsect[0] + (ident.nsect[1] << 16))*512)/1048576;
-	}
-
-	printf("Capacity:\t\t%u%s\n", (mbsize < 1024)?
-			mbsize : mbsize/1024, (mbsize < 1024)? "MB" : "GB");
-	printf("SMART Supported: \t%s\n", (buf[82] & 1)? "yes" : "no" );
-	if(buf[82] & 1)
-		printf("SMART Enabled: \t\t%s\n", (buf[85] & 1)? "yes" : "no" );
-	printf("APM Supported: \t\t%s\n", (buf[83] & 8)? "yes" : "no" );
-	if(buf[83] & 8)
-		printf("APM Enabled: \t\t%s\n", (buf[86] & 8)? "yes" : "no" );
-	printf("AAM Supported: \t\t%s\n", (buf[83] & 0x200)? "yes" : "no" );
-	printf("AAM Enabled: \t\t%s\n", (buf[86] & 0x200)? "yes" : "no");
-	if((buf[86] & 0x200)) {
-		printf("Current AAM: \t\t%d\n", ((buf[94] & 0x00FF))-127);
-		printf("Vendor Recommends AAM: \t%d\n", ((buf[94] & 0xFF00) >> 8)-127);
+	memset(info, 0, sizeof(struct ata_info));
+
+	strncpy(info->model, (const char *) ident->model, 40);
+	strncpy(info->serial, (const char *) ident->serial, 20);
+	strncpy(info->firmware, (const char *) ident->firmware, 8);
+	if (ident->version_major > 1)
+		ata_getversionstring(ident->version_major, info->version,
+		    sizeof(info->version));
+
+	info->cylinders = ident->word1;
+	info->heads = ident->word3;
+	info->sectors_per_track = ident->word6;
+	info->lba48 = (ident->cmd_enabled2 & 0x400) != 0;
+	if (info->lba48)
+		info->sectors = (uint64_t) ident->max_lba48_address[0] +
+		    ((uint64_t) ident->max_lba48_address[1] << 16) +
+		    ((uint64_t) ident->max_lba48_address[2] << 32) +
+		    ((uint64_t) ident->max_lba48_address[3] << 48);
+	else
+		info->sectors = ident->nsect[0] +
+		    ((uint32_t) ident->nsect[1] << 16);
+
+	/* word 106 describes the sector sizes when bit 14 alone is set */
+	info->logical_sector = 512;
+	if ((ident->word104[2] & 0xC000) == 0x4000) {
+		if (ident->word104[2] & 0x1000)
+			info->logical_sector = 2 * (ident->word104[13] +
+			    ((uint32_t) ident->word104[14] << 16));
+		info->physical_sector = info->logical_sector;
+		if (ident->word104[2] & 0x2000)
+			info->physical_sector <<= ident->word104[2] & 0xF;
+	} else {
+		info->physical_sector = info->logical_sector;
 	}
 
-	if((buf[86] & 8))
-		printf("APM Value: \t\t%d\n", buf[91]);
+	/* word 217 */
+	if (ident->word206[11] == 1 || (ident->word206[11] >= 0x401 &&
+	    ident->word206[11] != 0xFFFF))
+		info->rotation = ident->word206[11];
+
+	info->smart_supp = (ident->cmd_supp1 & ATA_SMART_SUPPORTED) != 0;
+	info->smart_enabled = info->smart_supp &&
+	    (ident->cmd_enabled1 & ATA_SMART_ENABLED);
+	info->pm_supp = (ident->cmd_supp1 & ATA_PM_SUPPORTED) != 0;
+	info->apm_supp = (ident->cmd_supp2 & ATA_APM_SUPPORTED) != 0;
+	info->apm_enabled = (ident->cmd_enabled2 & ATA_APM_ENABLED) != 0;
+	info->aam_supp = (ident->cmd_supp2 & ATA_AAM_SUPPORTED) != 0;
+	info->aam_enabled = (ident->cmd_enabled2 & ATA_AAM_ENABLED) != 0;
+	info->apm = ident->apm_value;
+	info->aam = (ident->aam_value & 0x00FF) - 127;
+	info->aam_recommended = ((ident->aam_value & 0xFF00) >> 8) - 127;
 }
 
 void byteswap_ata_data( int16_t * buf )
 {
-	int i;
-
-	for (i = 0; i < 10; i++)
-		mem_swap(buf+i);
+	char *bytes = (char *) buf;
 
-	for (i = 20; i < 23; i++)
-		mem_swap(buf+i);
+	byteswap(bytes, 0, 18);		/* words 0-9 */
+	byteswap(bytes, 40, 44);	/* words 20-22 */
+	byteswap(bytes, 94, 508);	/* words 47-254 */
+}
 
-	for (i = 47; i < 255; i++)
-		mem_swap(buf + i);
+/*
+ * Put the 512 bytes of IDENTIFY data as the drive sent them into the
+ * order struct ata_ident expects: the strings are stored with the bytes
+ * of each word swapped, and the serial number may be padded in front.
+ */
+void ata_fixident( char *buf )
+{
+	byteswap( buf, 20, 39 ); /* serial */
+	byteswap( buf, 46, 52 ); /* firmware */
+	byteswap( buf, 54, 92 ); /* model */
+	strpack( buf, 20, 39 );
 
+	if (is_big_endian())
+		byteswap_ata_data((int16_t*)buf);
 }
 
 /*
  * Set the Advanced Power Management mode for the drive.   Modern hard
  * drives can have a number of power management states, ranging from
  * lowest (least performance) to highest power consumption, which results
- * in the highest performance.
+ * in the highest performance.  0 disables APM.  Returns -1 with errno set
+ * to EINVAL if the level is out of range.
  */
 int ata_setapm( ATA *ata, uint32_t apm_val)
 {
@@ -297,8 +292,8 @@ int ata_setapm( ATA *ata, uint32_t apm_val)
 	/* user inputs vale 1-126, 0x01-0xFE */
 
 	if (apm_val > ATA_APM_MAXPERF) {
-		printf("invalid APM value: must be %d-%d\n", ATA_APM_MINPERF, ATA_APM_MAXPERF);
-		rc = -1;
+		errno = EINVAL;
+		return -1;
 	}
 
 	/* allocate and initialize the ata_cmd structure */
@@ -309,27 +304,18 @@ int ata_setapm( ATA *ata, uint32_t apm_val)
 		ata_setfeature_param(ata, ATA_APM_DISABLE);
 
 	/* send the APM command to the drive as a FEATURE */
-	if(!rc) {
-		rc = ata_cmd(ata, ATA__SETFEATURES, 0);
-
-		if(rc) {
-			perror("set APM failed");
-		} else {
-			printf("APM set to %d\n", apm_val);
-			if(apm_val == ATA_APM_MAXPERF)
-				printf("APM set to highest power consumption\n");
-			else if(apm_val == ATA_APM_MINPERF)
-				printf("APM set to lowest power consumption\n");
-			else if(apm_val == 0)
-				printf("APM Disabled\n");
-		}
-	}
+	rc = ata_cmd(ata, ATA__SETFEATURES, 0);
+	if (!rc)
+		ata_cache_setfeature(ata, (apm_val == 0) ?
+		    ATA_APM_DISABLE : ATA_APM_ENABLE, apm_val);
+
 	return rc;
 }
 
 /*
  * Sets the acoustic level on modern hard drives.   This is used to run it
- * at a lower speed/performance level, which in turn reduces noise.
+ * at a lower speed/performance level, which in turn reduces noise.  The
+ * level is 1-127, 0 disables AAM.
  */
 int ata_setacoustic(ATA *ata, uint32_t acoustic_val)
 {
@@ -339,8 +325,8 @@ int ata_setacoustic(ATA *ata, uint32_t acoustic_val)
 	acoustic_val += aam_user_offset; /* scale it 0x80-0xFE, 128-254 */
 	/* range check our acoustic level parameter */
 	if (acoustic_val > ATA_AUTOACOUSTIC_MAXPERF) {
-		printf("invalid acoustic value: must be %d-%d\n", 1, ATA_AUTOACOUSTIC_MAXPERF - aam_user_offset);
-		rc = -1;
+		errno = EINVAL;
+		return -1;
 	}
 
 	ata_setataparams(ata, acoustic_val, 0);
@@ -353,120 +339,200 @@ int ata_setacoustic(ATA *ata, uint32_t acoustic_val)
 	/* send the drive a SET_FEATURES command
 	 * with a FEATURE of ATA_AUTOACOUSTIC_ENABLE
 	 */
-	if(!rc) {
-		rc = ata_cmd( ata, ATA__SETFEATURES, 0 );
-
-		if(rc)
-			perror("set AAM failed");
-		else
-		{
-			printf("AAM set to %d\n", acoustic_val-aam_user_offset);
-			if(acoustic_val == ATA_AUTOACOUSTIC_MAXPERF)
-				printf("AAM set to maximum performance\n");
-			else if(acoustic_val == ATA_AUTOACOUSTIC_MINPERF)
-				printf("AAM set to quietest setting\n");
-			else if(acoustic_val == 127)
-				printf("AAM disabled\n");
-		}
-	}
+	rc = ata_cmd( ata, ATA__SETFEATURES, 0 );
+	if (!rc)
+		ata_cache_setfeature(ata, (acoustic_val == 127) ?
+		    ATA_AUTOACOUSTIC_DISABLE : ATA_AUTOACOUSTIC_ENABLE,
+		    acoustic_val);
+
 	return rc;
 }
 
-/* command the device to spindown after idle_mins of no disk activity */
+/*
+ * command the device to spindown after idle_mins of no disk activity,
+ * without spinning it down now
+ */
 int ata_setidletimer(ATA *ata, uint32_t idle_mins)
 {
 	uint16_t timer_val = 0;
-	int rc = 0;
 
-	rc = ata_getidleval( idle_mins, &timer_val );
-
-	if(timer_val == ATA_IDLEVAL_IMMEDIATE)
-		ata_setataparams(ata, 0, 0);
-	else
-		ata_setataparams(ata, timer_val, 0);
+	if (ata_getidleval( idle_mins, &timer_val ))
+		return -1;
 
 	/* send the IDLE command to the drive */
-	if(!rc) {
-		if(timer_val == ATA_IDLEVAL_IMMEDIATE)
-			rc = ata_cmd(ata, ATA_IDLE_IMMEDIATE, 0);
-		else
-			rc = ata_cmd(ata, ATA_IDLE, 0);
+	if(timer_val == ATA_IDLEVAL_IMMEDIATE) {
+		ata_setataparams(ata, 0, 0);
+		return ata_cmd(ata, ATA_IDLE_IMMEDIATE, 0);
 	}
 
-	if(rc)
-	{
-		if(rc == -2)
-			printf("error setting idle timeout\n");
-		else
-			perror("error setting idle timeout");
-	}
-	else
-	{
-		if(timer_val == ATA_IDLEVAL_IMMEDIATE)
-			printf("drive set to idle immediately\n");
-		else if(timer_val == 0)
-			printf("turned off idle timer\n");
-		else
-			printf("idle timer set to %d minutes\n", idle_mins);
-	}
-	return rc;
+	ata_setataparams(ata, timer_val, 0);
+	return ata_cmd(ata, ATA_IDLE, 0);
+}
+
+/*
+ * The same with the timer in seconds, for the values ata_getidlesecs()
+ * can encode which aren't whole minutes
+ */
+int ata_setidletimer_secs(ATA *ata, uint32_t idle_secs)
+{
+	uint16_t timer_val = 0;
+
+	if (ata_getidlesecs( idle_secs, &timer_val ))
+		return -1;
+
+	ata_setataparams(ata, timer_val, 0);
+	return ata_cmd(ata, ATA_IDLE, 0);
 }
 
 /* comand the drive to go into sleep mode */
 int ata_sleep(ATA *ata)
 {
-	int rc = 0;
-
 	ata_setataparams(ata, 0, 0);
 
 	/* send the SLEEP command to the drive */
-	rc = ata_cmd(ata, ATA_SLEEP, 0);
-
-	if (rc)
-	{
-		perror("error setting sleep mode");
-	}
-	else
-	{
-		printf("drive set to sleep\n");
-	}
-
-	return rc;
+	return ata_cmd(ata, ATA_SLEEP, 0);
 }
 
-/* command the device to spindown after standby_mins of no disk activity */
+/*
+ * command the device to spindown after standby_mins of no disk activity,
+ * spinning it down now
+ */
 int ata_setstandbytimer( ATA *ata, uint32_t standby_mins)
 {
 	uint16_t timer_val = 0;
-	int  rc = 0;
 
-	rc = ata_getidleval( standby_mins, &timer_val );
+	if (ata_getidleval( standby_mins, &timer_val ))
+		return -1;
 
-	if (timer_val == ATA_IDLEVAL_IMMEDIATE)
+	/* send the STANDBY command to the drive */
+	if (timer_val == ATA_IDLEVAL_IMMEDIATE) {
 		ata_setataparams(ata, 0, 0);
-	else
-		ata_setataparams(ata, timer_val, 0);
+		return ata_cmd(ata, ATA_STANDBY_IMMEDIATE, 0);
+	}
 
-	/* send the STANDBY command to the drive */
-	if(!rc)
-	{
-		if(timer_val == ATA_IDLEVAL_IMMEDIATE)
-			rc = ata_cmd(ata, ATA_STANDBY_IMMEDIATE, 0);
-		else
-			rc = ata_cmd(ata, ATA_STANDBY, 0);
+	ata_setataparams(ata, timer_val, 0);
+	return ata_cmd(ata, ATA_STANDBY, 0);
+}
+
+/*
+ * Ask the drive which power mode it is in.  Unlike IDENTIFY this never
+ * spins the drive up, so it is safe to use on sleeping arrays.  A drive
+ * in sleep mode doesn't answer at all until it is reset, which fails
+ * with ETIMEDOUT; whether to take that as sleep is up to the caller.
+ */
+int ata_checkpowermode(ATA *ata, enum ata_power_mode *mode)
+{
+	int rc = 0;
+
+	*mode = ATA_POWER_UNKNOWN;
+
+	ata_setataparams(ata, 0, 0);
+	rc = ata_cmd(ata, ATA_CHECK_POWER_MODE, 0);
+	if (rc)
+		return rc;
+
+	*mode = ata_decodepowermode(&ata->regs);
+
+	return rc;
+}
+
+/* decode the count register returned by CHECK POWER MODE */
+enum ata_power_mode ata_decodepowermode(const struct ata_regs *regs)
+{
+	/* the backend couldn't read the count register back */
+	if (!regs->valid)
+		return ATA_POWER_UNKNOWN;
+
+	switch (regs->count) {
+	case ATA_POWER_COUNT_STANDBY:
+	case ATA_POWER_COUNT_NV_STANDBY:
+		return ATA_POWER_STANDBY;
+	case ATA_POWER_COUNT_IDLE:
+	case ATA_POWER_COUNT_IDLE_A:
+	case ATA_POWER_COUNT_IDLE_B:
+	case ATA_POWER_COUNT_IDLE_C:
+		return ATA_POWER_IDLE;
+	case ATA_POWER_COUNT_NV_ACTIVE:
+	case ATA_POWER_COUNT_ACTIVE:
+		return ATA_POWER_ACTIVE;
+	default:
+		return ATA_POWER_UNKNOWN;
 	}
-	if(rc)
-	{
-		perror("error setting idle timeout");
-	} else {
-		if( timer_val == ATA_IDLEVAL_IMMEDIATE )
-			printf("drive set to standby immediately\n");
-		else if(timer_val == 0)
-			printf("turned off standby timer\n");
-		else
-			printf("standby timer set to %d minutes\n", standby_mins);
+}
+
+const char * ata_powermodestring(enum ata_power_mode mode)
+{
+	switch (mode) {
+	case ATA_POWER_ACTIVE:
+		return "active";
+	case ATA_POWER_IDLE:
+		return "idle";
+	case ATA_POWER_STANDBY:
+		return "standby";
+	case ATA_POWER_SLEEP:
+		return "sleep";
+	default:
+		return "unknown";
+	}
+}
+
+const char * ata_transportstring(enum ata_transport transport)
+{
+	switch (transport) {
+	case ATA_TRANSPORT_ATA:
+		return "ata";
+	case ATA_TRANSPORT_SAT:
+		return "sat";
+	case ATA_TRANSPORT_SAS:
+		return "sas";
+	case ATA_TRANSPORT_SIM:
+		return "sim";
+	default:
+		return "unknown";
+	}
+}
+
+/* free the list returned by ata_listdevices() */
+void ata_freedevices(char **devices, int ndevices)
+{
+	int i;
+
+	if (devices == NULL)
+		return;
+	for (i = 0; i < ndevices; i++)
+		free(devices[i]);
+	free(devices);
+}
+
+/* the names of the commands ataidle sends */
+const char * ata_commandname(uint8_t opcode)
+{
+	switch (opcode) {
+	case ATA_STANDBY_IMMEDIATE:
+		return "STANDBY IMMEDIATE";
+	case ATA_IDLE_IMMEDIATE:
+		return "IDLE IMMEDIATE";
+	case ATA_STANDBY:
+		return "STANDBY";
+	case ATA_IDLE:
+		return "IDLE";
+	case ATA_CHECK_POWER_MODE:
+		return "CHECK POWER MODE";
+	case ATA_SLEEP:
+		return "SLEEP";
+	case ATA__IDENTIFY:
+		return "IDENTIFY";
+	case ATA__ATAPI_IDENTIFY:
+		return "IDENTIFY PACKET";
+	case ATA__SETFEATURES:
+		return "SET FEATURES";
+	case ATA_READ_VERIFY:
+		return "READ VERIFY";
+	case ATA__SMART:
+		return "SMART";
+	default:
+		return "unknown";
 	}
-	return rc;
 }
 
 /* this function sends an IDENTIFY command to a drive */
@@ -487,28 +553,63 @@ int ata_ident(ATA *ata, struct ata_ident * identity)
 		rc = ata_cmd(ata, ATA__ATAPI_IDENTIFY, 0);
 	}
 
-	if (!rc)
+	if(!rc)
 	{
-		byteswap( buf, 20, 39 ); /* serial */
-		byteswap( buf, 46, 52 ); /* firmware */
-		byteswap( buf, 54, 92 ); /* model */
-		strpack( buf, 20, 39 );
+		ata_fixident(buf);
+		memcpy(identity, buf, sizeof(struct ata_ident));
 	}
 
-	if (is_big_endian())
-		byteswap_ata_data((int16_t*)buf);
+	return rc;
+}
 
-	if(!rc)
-		memcpy(identity, buf, sizeof(struct ata_ident));
+/* allocate the command buffers of a newly opened handle */
+int ata_allocbuffers( ATA *ata )
+{
+	void *mem;
 
-	return rc;
+	if (posix_memalign(&mem, ATA_BUFFER_ALIGN,
+	    ATA_DATA_BUFSIZE + ATA_SENSE_BUFSIZE) != 0)
+		return -1;
+
+	memset(mem, 0, ATA_DATA_BUFSIZE + ATA_SENSE_BUFSIZE);
+	ata->data = mem;
+	ata->sense = ata->data + ATA_DATA_BUFSIZE;
+	return 0;
 }
 
-void hexdump(const char *data, int count)
+void ata_freebuffers( ATA *ata )
 {
-	int i;
-	for (i = 0; i < count; i++)
-	{
-		printf( "%c ", data[i]);
-	}
+	free(ata->data);
+	ata->data = NULL;
+	ata->sense = NULL;
+}
+
+/*
+ * read a small file into buf and NUL terminate it, without going through
+ * stdio so nothing is allocated
+ */
+int ata_readfile( const char *path, char *buf, size_t len )
+{
+	int fd;
+	ssize_t n;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return -1;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+
+	buf[n] = '\0';
+	return n;
+}
+
+/* microseconds since some unspecified starting point */
+uint64_t ata_now_usec( void )
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
@@ -1,20 +1,24 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #define ATAIDLE_VERSION "2.4"
 
-void 	usage(void);
 int	ata_strtolong( const char *src, long * dest );
 int	ata_getidleval( uint32_t idle_mins, uint16_t *timer_val );
-char*	ata_getversionstring(uint16_t ata_version);
+int	ata_getidlesecs( uint32_t secs, uint16_t *timer_val );
+int	ata_parsetime( const char *str, uint32_t *secs );
+char*	ata_getversionstring(uint16_t ata_version, char *version, size_t len);
 void	byteswap(char * buf, int from, int to);
 void	strpack(char * buf, int from, int to);
 bool	checkargs( int argc, char ** argv, const char *optstr, bool * needchandev );
 void	byteswap_ata_data( int16_t * buf );
-void	hexdump( const char *data, int count );
+void	ata_fixident( char *buf );
 void	mem_swap(int16_t * val);
+int	ata_readfile( const char *path, char *buf, size_t len );
+uint64_t	ata_now_usec( void );
 
 #endif /* UTIL_H */
@@ -0,0 +1,546 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Staggered spin-up.  A drive draws several times its idle power while
+ * its spindle comes up to speed, so waking a full enclosure at once can
+ * trip its power supply, while waking the drives one after another takes
+ * as long as all their spin-ups put together.  Instead each controller
+ * (see ata_getcontroller()) gets a power budget, and drives are sent
+ * IDLE IMMEDIATE as long as the drives spinning up and those already up
+ * fit in it.  CHECK POWER MODE is then polled until the drive says it is
+ * up, when it only draws its idle power, and the difference is given to
+ * the next drives waiting.  Drives in standby are counted as drawing
+ * nothing.
+ *
+ * The power drawn by each drive comes from a table of model patterns,
+ *
+ *	drive spinup-watts idle-watts model-pattern
+ *	budget controller watts
+ *
+ * matched against the model in the IDENTIFY cache, so a drive is never
+ * asked for it.  Each drive is woken by a thread of its own, as IDLE
+ * IMMEDIATE only completes once the drive has spun up.
+ */
+
+#include <errno.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "atadefs.h"
+#include "atagen.h"
+#include "cache.h"
+#include "util.h"
+#include "wake.h"
+
+/* group of drives which have no controller the backend can name */
+#define WAKE_NOCONTROLLER	"unknown"
+
+struct wake_model
+{
+	char *	pattern;
+	double	spinup;
+	double	idle;
+};
+
+struct wake_budget
+{
+	char *	controller;
+	double	watts;
+};
+
+struct wake_table
+{
+	struct wake_model *	models;
+	int			nmodels;
+	struct wake_budget *	budgets;
+	int			nbudgets;
+};
+
+struct wake_group
+{
+	char		name[ATA_CONTROLLER_LEN];
+	double		budget;
+	double		used;		/* watts drawn or reserved now */
+	double		peak;
+	int		spinning;
+	int		ndevs;
+	bool		warned;		/* a drive was over the budget */
+};
+
+enum wake_state {
+	WAKE_UP,		/* already spinning, or done */
+	WAKE_WAITING,
+	WAKE_SPINNING,
+	WAKE_FINISHED		/* thread done, not yet collected */
+};
+
+struct wake_dev
+{
+	const char *		device;
+	ATA *			ata;
+	struct wake_group *	group;
+	double			spinup;
+	double			idle;
+	enum wake_state		state;
+	pthread_t		thread;
+	bool			joinable;	/* thread was started */
+	uint64_t		started;
+	uint64_t		elapsed;	/* usecs to spin up */
+	int			error;		/* errno, 0 if it spun up */
+	struct wake_ctx *	ctx;
+};
+
+struct wake_ctx
+{
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	int			finished;
+};
+
+static int	wake_readtable( const char *path, struct wake_table *table );
+static void	wake_freetable( struct wake_table *table );
+static void	wake_power( const struct wake_table *table, ATA *ata,
+		    double *spinup, double *idle );
+static struct wake_group *	wake_group( struct wake_group *groups,
+				    int *ngroups, const char *name,
+				    const struct wake_table *table,
+				    double budget );
+static void *	wake_thread( void *arg );
+static void	wake_start( struct wake_dev *dev );
+static void	wake_collect( struct wake_dev *dev );
+
+/*
+ * Read the power table.  Errors are reported with the file name and line
+ * number.
+ */
+static int wake_readtable( const char *path, struct wake_table *table )
+{
+	char line[1024];
+	int lineno = 0;
+	FILE *fp;
+
+	memset(table, 0, sizeof(struct wake_table));
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *kind, *a, *b, *rest, *end;
+		double x, y = 0;
+
+		lineno++;
+		if ((end = strchr(line, '#')) != NULL)
+			*end = '\0';
+		if ((end = strpbrk(line, "\r\n")) != NULL)
+			*end = '\0';
+
+		kind = strtok(line, " \t");
+		if (kind == NULL)
+			continue;
+		a = strtok(NULL, " \t");
+		b = strtok(NULL, " \t");
+		rest = strtok(NULL, "");
+		if (rest != NULL) {
+			rest += strspn(rest, " \t");
+			end = rest + strlen(rest);
+			while (end > rest && (end[-1] == ' ' || end[-1] == '\t'))
+				*--end = '\0';
+			if (*rest == '\0')
+				rest = NULL;
+		}
+
+		if (strcmp(kind, "drive") == 0) {
+			struct wake_model *m;
+
+			if (a == NULL || b == NULL || rest == NULL) {
+				fprintf(stderr, "%s:%d: expected 'drive spinup-watts "
+				    "idle-watts model'\n", path, lineno);
+				goto fail;
+			}
+			x = strtod(a, &end);
+			if (*end == '\0')
+				y = strtod(b, &end);
+			if (*end != '\0' || x <= 0 || y < 0 || y > x) {
+				fprintf(stderr, "%s:%d: invalid power\n", path,
+				    lineno);
+				goto fail;
+			}
+			m = realloc(table->models,
+			    (table->nmodels + 1) * sizeof(struct wake_model));
+			if (m == NULL)
+				goto nomem;
+			table->models = m;
+			m = &m[table->nmodels];
+			m->pattern = malloc(strlen(rest) + 1);
+			if (m->pattern == NULL)
+				goto nomem;
+			strcpy(m->pattern, rest);
+			m->spinup = x;
+			m->idle = y;
+			table->nmodels++;
+		} else if (strcmp(kind, "budget") == 0) {
+			struct wake_budget *bu;
+
+			if (a == NULL || b == NULL || rest != NULL) {
+				fprintf(stderr, "%s:%d: expected 'budget controller "
+				    "watts'\n", path, lineno);
+				goto fail;
+			}
+			x = strtod(b, &end);
+			if (*end != '\0' || x <= 0) {
+				fprintf(stderr, "%s:%d: invalid budget '%s'\n", path,
+				    lineno, b);
+				goto fail;
+			}
+			bu = realloc(table->budgets,
+			    (table->nbudgets + 1) * sizeof(struct wake_budget));
+			if (bu == NULL)
+				goto nomem;
+			table->budgets = bu;
+			bu = &bu[table->nbudgets];
+			bu->controller = malloc(strlen(a) + 1);
+			if (bu->controller == NULL)
+				goto nomem;
+			strcpy(bu->controller, a);
+			bu->watts = x;
+			table->nbudgets++;
+		} else {
+			fprintf(stderr, "%s:%d: unknown keyword '%s'\n", path,
+			    lineno, kind);
+			goto fail;
+		}
+	}
+
+	if (ferror(fp)) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto fail;
+	}
+	fclose(fp);
+	return 0;
+
+nomem:
+	fprintf(stderr, "%s: %s\n", path, strerror(ENOMEM));
+fail:
+	fclose(fp);
+	wake_freetable(table);
+	return -1;
+}
+
+static void wake_freetable( struct wake_table *table )
+{
+	int i;
+
+	for (i = 0; i < table->nmodels; i++)
+		free(table->models[i].pattern);
+	for (i = 0; i < table->nbudgets; i++)
+		free(table->budgets[i].controller);
+	free(table->models);
+	free(table->budgets);
+	memset(table, 0, sizeof(struct wake_table));
+}
+
+/* the power drawn by a drive, from the first pattern matching its model */
+static void wake_power( const struct wake_table *table, ATA *ata,
+		double *spinup, double *idle )
+{
+	struct ata_ident ident;
+	struct ata_info info;
+	int i;
+
+	*spinup = WAKE_DEFAULT_SPINUP;
+	*idle = WAKE_DEFAULT_IDLE;
+
+	if (table->nmodels == 0 || ata_cache_getident(ata, &ident))
+		return;
+	ata_decodeident(&ident, &info);
+
+	for (i = 0; i < table->nmodels; i++) {
+		if (fnmatch(table->models[i].pattern, info.model, 0) == 0) {
+			*spinup = table->models[i].spinup;
+			*idle = table->models[i].idle;
+			return;
+		}
+	}
+}
+
+/* find the group of a controller, adding it if it's new */
+static struct wake_group * wake_group( struct wake_group *groups,
+		int *ngroups, const char *name, const struct wake_table *table,
+		double budget )
+{
+	struct wake_group *g;
+	int i;
+
+	for (i = 0; i < *ngroups; i++)
+		if (strcmp(groups[i].name, name) == 0)
+			return &groups[i];
+
+	g = &groups[(*ngroups)++];
+	snprintf(g->name, sizeof(g->name), "%s", name);
+	g->budget = budget;
+	for (i = 0; i < table->nbudgets; i++)
+		if (strcmp(table->budgets[i].controller, name) == 0)
+			g->budget = table->budgets[i].watts;
+
+	return g;
+}
+
+/*
+ * Wake one drive, returning once it reports it is spinning, it fails or
+ * WAKE_TIMEOUT passes.
+ */
+static void * wake_thread( void *arg )
+{
+	struct wake_dev *dev = arg;
+	struct wake_ctx *ctx = dev->ctx;
+	enum ata_power_mode mode;
+	struct timespec ts;
+	int error = 0;
+
+	if (ata_setidletimer(dev->ata, ATA_IDLEVAL_IMMEDIATE))
+		error = errno;
+
+	while (error == 0) {
+		if (ata_checkpowermode(dev->ata, &mode)) {
+			/* still asleep, it doesn't answer */
+			if (errno != ETIMEDOUT) {
+				error = errno;
+				break;
+			}
+			mode = ATA_POWER_SLEEP;
+		}
+		/* drives which can't report it are up once IDLE completes */
+		if (mode != ATA_POWER_STANDBY && mode != ATA_POWER_SLEEP)
+			break;
+		if (ata_now_usec() - dev->started >= (uint64_t) WAKE_TIMEOUT * 1000000) {
+			error = ETIMEDOUT;
+			break;
+		}
+		ts.tv_sec = 0;
+		ts.tv_nsec = WAKE_POLL_INTERVAL * 1000000L;
+		nanosleep(&ts, NULL);
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	dev->elapsed = ata_now_usec() - dev->started;
+	dev->error = error;
+	dev->state = WAKE_FINISHED;
+	ctx->finished++;
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+
+	return NULL;
+}
+
+/* reserve the spin-up power of a drive and start waking it */
+static void wake_start( struct wake_dev *dev )
+{
+	struct wake_group *g = dev->group;
+
+	if (g->used + dev->spinup > g->budget && !g->warned) {
+		fprintf(stderr, "%s: %.0f W budget is too small to spin up "
+		    "%s, waking it on its own\n", g->name, g->budget,
+		    dev->device);
+		g->warned = true;
+	}
+
+	g->used += dev->spinup;
+	if (g->used > g->peak)
+		g->peak = g->used;
+	g->spinning++;
+	dev->state = WAKE_SPINNING;
+	dev->started = ata_now_usec();
+
+	dev->error = pthread_create(&dev->thread, NULL, wake_thread, dev);
+	if (dev->error) {
+		dev->state = WAKE_FINISHED;
+		dev->ctx->finished++;
+	} else {
+		dev->joinable = true;
+	}
+}
+
+/* give back the power a drive no longer needs and report it */
+static void wake_collect( struct wake_dev *dev )
+{
+	struct wake_group *g = dev->group;
+
+	if (dev->joinable)
+		pthread_join(dev->thread, NULL);
+
+	/* a drive which failed is assumed not to have spun up */
+	g->used -= dev->spinup;
+	if (dev->error == 0)
+		g->used += dev->idle;
+	g->spinning--;
+	dev->state = WAKE_UP;
+
+	if (dev->error)
+		fprintf(stderr, "%s: spin-up failed: %s\n", dev->device,
+		    strerror(dev->error));
+	else
+		printf("%s: spun up in %.1f s (%s)\n", dev->device,
+		    dev->elapsed / 1e6, g->name);
+	fflush(stdout);
+}
+
+/*
+ * Spin every drive up, keeping the drives behind each controller within
+ * budget watts, or what the table at path gives the controller.
+ */
+int wake_run( ATA **atas, char **devices, int ndevices, double budget,
+		const char *path )
+{
+	struct wake_table table;
+	struct wake_group *groups;
+	struct wake_dev *devs;
+	struct wake_ctx ctx;
+	int ngroups = 0;
+	int waiting = 0;
+	int failed = 0;
+	uint64_t start;
+	int i;
+
+	memset(&table, 0, sizeof(struct wake_table));
+	if (path != NULL && wake_readtable(path, &table))
+		return -1;
+
+	groups = calloc(ndevices, sizeof(struct wake_group));
+	devs = calloc(ndevices, sizeof(struct wake_dev));
+	if (groups == NULL || devs == NULL) {
+		free(groups);
+		free(devs);
+		wake_freetable(&table);
+		return -1;
+	}
+
+	pthread_mutex_init(&ctx.lock, NULL);
+	pthread_cond_init(&ctx.cond, NULL);
+	ctx.finished = 0;
+	start = ata_now_usec();
+
+	/* drives which are already spinning only count their idle power */
+	for (i = 0; i < ndevices; i++) {
+		struct wake_dev *dev = &devs[i];
+		char controller[ATA_CONTROLLER_LEN];
+		enum ata_power_mode mode;
+
+		dev->device = devices[i];
+		dev->ata = atas[i];
+		dev->ctx = &ctx;
+		if (ata_getcontroller(dev->ata, controller, sizeof(controller)))
+			strcpy(controller, WAKE_NOCONTROLLER);
+		dev->group = wake_group(groups, &ngroups, controller, &table,
+		    budget);
+		dev->group->ndevs++;
+		wake_power(&table, dev->ata, &dev->spinup, &dev->idle);
+
+		if (ata_checkpowermode(dev->ata, &mode) == 0 &&
+		    mode != ATA_POWER_STANDBY && mode != ATA_POWER_SLEEP &&
+		    mode != ATA_POWER_UNKNOWN) {
+			dev->state = WAKE_UP;
+			dev->group->used += dev->idle;
+			printf("%s: already spinning (%s)\n", dev->device,
+			    dev->group->name);
+		} else {
+			dev->state = WAKE_WAITING;
+			waiting++;
+		}
+	}
+	for (i = 0; i < ngroups; i++)
+		groups[i].peak = groups[i].used;
+	fflush(stdout);
+
+	/*
+	 * Start every waiting drive which fits in its controller's budget,
+	 * in the order given, then wait for one to finish and go again.  A
+	 * drive which doesn't fit even with nothing else spinning up is
+	 * started on its own rather than never.
+	 */
+	pthread_mutex_lock(&ctx.lock);
+	while (waiting > 0 || ctx.finished > 0) {
+		for (i = 0; i < ndevices; i++) {
+			struct wake_dev *dev = &devs[i];
+
+			if (dev->state == WAKE_FINISHED) {
+				wake_collect(dev);
+				ctx.finished--;
+				if (dev->error)
+					failed++;
+			}
+		}
+
+		for (i = 0; i < ndevices && waiting > 0; i++) {
+			struct wake_dev *dev = &devs[i];
+			struct wake_group *g = dev->group;
+
+			if (dev->state != WAKE_WAITING)
+				continue;
+			if (g->used + dev->spinup > g->budget && g->spinning > 0)
+				continue;
+			wake_start(dev);
+			waiting--;
+		}
+
+		while (ctx.finished == 0) {
+			for (i = 0; i < ndevices; i++)
+				if (devs[i].state == WAKE_SPINNING)
+					break;
+			if (i == ndevices)
+				break;
+			pthread_cond_wait(&ctx.cond, &ctx.lock);
+		}
+	}
+	pthread_mutex_unlock(&ctx.lock);
+
+	for (i = 0; i < ngroups; i++)
+		printf("%s: %d drive%s, at most %.0f W of %.0f W\n",
+		    groups[i].name, groups[i].ndevs,
+		    (groups[i].ndevs == 1) ? "" : "s", groups[i].peak,
+		    groups[i].budget);
+	printf("%d of %d drives ready in %.1f s\n", ndevices - failed,
+	    ndevices, (ata_now_usec() - start) / 1e6);
+
+	pthread_cond_destroy(&ctx.cond);
+	pthread_mutex_destroy(&ctx.lock);
+	free(groups);
+	free(devs);
+	wake_freetable(&table);
+
+	if (failed)
+		errno = EIO;
+	return (failed ? -1 : 0);
+}
@@ -0,0 +1,17 @@
+#ifndef WAKE_H
+#define WAKE_H
+
+#include "atagen.h"
+
+/* watts assumed for drives the power table doesn't know, a 3.5" disk */
+#define WAKE_DEFAULT_SPINUP	25.0
+#define WAKE_DEFAULT_IDLE	6.0
+/* how often a drive spinning up is asked whether it's done, in ms */
+#define WAKE_POLL_INTERVAL	50
+/* seconds after which a drive is given up on */
+#define WAKE_TIMEOUT		60
+
+int	wake_run( ATA **atas, char **devices, int ndevices, double budget,
+	    const char *path );
+
+#endif /* WAKE_H */
@@ -0,0 +1,144 @@
+/*-
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wheel.h"
+
+static void wheel_insert( struct timer_wheel *wheel, struct wheel_timer *timer );
+static void wheel_cascade( struct timer_wheel *wheel, int level );
+
+void wheel_init( struct timer_wheel *wheel, uint64_t now )
+{
+	int l, i;
+
+	wheel->now = now;
+	for (l = 0; l < WHEEL_LEVELS; l++) {
+		for (i = 0; i < WHEEL_SLOTS; i++) {
+			wheel->slot[l][i].next = &wheel->slot[l][i];
+			wheel->slot[l][i].prev = &wheel->slot[l][i];
+		}
+	}
+}
+
+/* link a timer into the slot it belongs in, relative to the current tick */
+static void wheel_insert( struct timer_wheel *wheel, struct wheel_timer *timer )
+{
+	struct wheel_timer *head;
+	uint64_t delta;
+	int level = 0;
+
+	if (timer->expires < wheel->now)
+		timer->expires = wheel->now;
+	delta = timer->expires - wheel->now;
+	if (delta >= WHEEL_MAX_DELTA) {
+		delta = WHEEL_MAX_DELTA - 1;
+		timer->expires = wheel->now + delta;
+	}
+
+	while (level < WHEEL_LEVELS - 1 &&
+			delta >= ((uint64_t) 1 << (WHEEL_BITS * (level + 1))))
+		level++;
+
+	head = &wheel->slot[level][(timer->expires >> (WHEEL_BITS * level))
+	    & WHEEL_MASK];
+	timer->next = head;
+	timer->prev = head->prev;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+/* schedule a timer, it fires no earlier than the next tick */
+void wheel_add( struct timer_wheel *wheel, struct wheel_timer *timer,
+		uint64_t expires )
+{
+	if (wheel_pending(timer))
+		wheel_del(timer);
+	if (expires <= wheel->now)
+		expires = wheel->now + 1;
+	timer->expires = expires;
+	wheel_insert(wheel, timer);
+}
+
+void wheel_del( struct wheel_timer *timer )
+{
+	if (!wheel_pending(timer))
+		return;
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+int wheel_pending( const struct wheel_timer *timer )
+{
+	return timer->next != NULL;
+}
+
+/* move the timers in the current slot of a level down the hierarchy */
+static void wheel_cascade( struct timer_wheel *wheel, int level )
+{
+	struct wheel_timer *head;
+	struct wheel_timer *timer;
+
+	head = &wheel->slot[level][(wheel->now >> (WHEEL_BITS * level))
+	    & WHEEL_MASK];
+	while ((timer = head->next) != head) {
+		wheel_del(timer);
+		wheel_insert(wheel, timer);
+	}
+}
+
+/*
+ * Advance the wheel to the tick 'now', calling func for every timer which
+ * expires on the way.  Timers are removed before func is called, so it may
+ * add them again.
+ */
+void wheel_advance( struct timer_wheel *wheel, uint64_t now,
+		wheel_func_t func, void *ctx )
+{
+	struct wheel_timer *head;
+	struct wheel_timer *timer;
+	int level;
+
+	while (wheel->now < now) {
+		wheel->now++;
+
+		for (level = 1; level < WHEEL_LEVELS; level++) {
+			if ((wheel->now >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK)
+				break;
+			wheel_cascade(wheel, level);
+		}
+
+		head = &wheel->slot[0][wheel->now & WHEEL_MASK];
+		while ((timer = head->next) != head) {
+			wheel_del(timer);
+			func(timer, ctx);
+		}
+	}
+}
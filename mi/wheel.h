@@ -0,0 +1,41 @@
+#ifndef WHEEL_H
+#define WHEEL_H
+
+#include <stdint.h>
+
+/*
+ * Hierarchical timer wheel: WHEEL_LEVELS wheels of WHEEL_SLOTS slots each,
+ * every level covering WHEEL_SLOTS times the range of the one below it.
+ * Adding and removing a timer is O(1) regardless of how many are pending.
+ */
+#define WHEEL_BITS	6
+#define WHEEL_SLOTS	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS	4
+#define WHEEL_MAX_DELTA	((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+struct wheel_timer
+{
+	struct wheel_timer *	next;
+	struct wheel_timer *	prev;
+	uint64_t		expires;	/* in ticks */
+	void *			arg;
+};
+
+struct timer_wheel
+{
+	uint64_t		now;		/* ticks */
+	struct wheel_timer	slot[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+typedef void (*wheel_func_t)( struct wheel_timer *timer, void *ctx );
+
+void	wheel_init( struct timer_wheel *wheel, uint64_t now );
+void	wheel_add( struct timer_wheel *wheel, struct wheel_timer *timer,
+	    uint64_t expires );
+void	wheel_del( struct wheel_timer *timer );
+int	wheel_pending( const struct wheel_timer *timer );
+void	wheel_advance( struct timer_wheel *wheel, uint64_t now,
+	    wheel_func_t func, void *ctx );
+
+#endif /* WHEEL_H */
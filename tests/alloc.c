@@ -0,0 +1,261 @@
+/*-
+ *
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Allocations made by the command path, run with "make test".  malloc and
+ * its relatives are replaced with counting versions handing out memory
+ * from a static arena, so allocations made inside the C library are
+ * counted too.  A drive is opened and sent each kind of command until it
+ * has settled, and then sent them many more times, which must not
+ * allocate anything.
+ *
+ * On Linux the drive is first /dev/null behind a stand-in for ioctl(2)
+ * answering SG_IO the way a SAT bridge does, so the real ATA PASS-THROUGH
+ * CDBs are built and the sense data decoded; then a simulated drive.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <scsi/sg.h>
+#endif
+
+#include "../mi/atadefs.h"
+#include "../mi/atagen.h"
+#include "../mi/smart.h"
+
+#define ALLOC_ARENA		(32 * 1024 * 1024)
+#define ALLOC_HEADER		16	/* holds the size, keeps 16 byte alignment */
+#define ALLOC_WARMUP		10
+#define ALLOC_ROUNDS		1000
+
+static unsigned char alloc_arena[ALLOC_ARENA];
+static size_t alloc_used;
+static unsigned long alloc_count;
+
+static void *	alloc_arena_get( size_t size, size_t align );
+static int	alloc_round( ATA *ata );
+static int	alloc_device( const char *device );
+
+/* free() gives nothing back, the arena only has to outlast the test */
+static void * alloc_arena_get( size_t size, size_t align )
+{
+	uintptr_t base = (uintptr_t) alloc_arena;
+	uintptr_t p = base + alloc_used + ALLOC_HEADER;
+
+	if (align < ALLOC_HEADER)
+		align = ALLOC_HEADER;
+	p = (p + align - 1) & ~((uintptr_t) align - 1);
+	if (size > ALLOC_ARENA || p - base > ALLOC_ARENA - size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	((size_t *) p)[-1] = size;
+	alloc_used = p + size - base;
+	alloc_count++;
+	return (void *) p;
+}
+
+void * malloc( size_t size )
+{
+	return alloc_arena_get(size, ALLOC_HEADER);
+}
+
+void * calloc( size_t n, size_t size )
+{
+	void *p;
+
+	if (size != 0 && n > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	p = alloc_arena_get(n * size, ALLOC_HEADER);
+	if (p != NULL)
+		memset(p, 0, n * size);
+	return p;
+}
+
+void * realloc( void *old, size_t size )
+{
+	size_t oldsize;
+	void *p;
+
+	p = alloc_arena_get(size, ALLOC_HEADER);
+	if (p != NULL && old != NULL) {
+		oldsize = ((size_t *) old)[-1];
+		memcpy(p, old, oldsize < size ? oldsize : size);
+	}
+	return p;
+}
+
+void free( void *p )
+{
+	(void) p;
+}
+
+int posix_memalign( void **mem, size_t align, size_t size )
+{
+	*mem = alloc_arena_get(size, align);
+	return (*mem == NULL) ? ENOMEM : 0;
+}
+
+void * aligned_alloc( size_t align, size_t size )
+{
+	return alloc_arena_get(size, align);
+}
+
+#ifdef __linux__
+/*
+ * Answer SG_IO like a SAT bridge with an active drive: commands reading
+ * data get zeroes, the others CHECK CONDITION with an ATA Status Return
+ * descriptor.  Anything else isn't for a SCSI device.
+ */
+int ioctl( int fd, unsigned long request, ... )
+{
+	struct sg_io_hdr *io;
+	va_list ap;
+
+	(void) fd;
+	va_start(ap, request);
+	io = va_arg(ap, struct sg_io_hdr *);
+	va_end(ap);
+
+	switch (request) {
+	case SG_GET_VERSION_NUM:
+		*(int *) io = 30536;
+		return 0;
+	case SG_IO:
+		io->status = 0;
+		io->host_status = 0;
+		io->driver_status = 0;
+		io->sb_len_wr = 0;
+		if (io->dxfer_direction == SG_DXFER_FROM_DEV) {
+			memset(io->dxferp, 0, io->dxfer_len);
+			return 0;
+		}
+		if (io->mx_sb_len < 22) {
+			errno = EINVAL;
+			return -1;
+		}
+		memset(io->sbp, 0, 22);
+		io->sbp[0] = 0x72;	/* descriptor format, current */
+		io->sbp[1] = 0x01;	/* RECOVERED ERROR */
+		io->sbp[3] = 0x1D;	/* ATA PASS-THROUGH information available */
+		io->sbp[7] = 14;
+		io->sbp[8] = 0x09;	/* ATA Status Return */
+		io->sbp[9] = 12;
+		io->sbp[13] = 0xFF;	/* count: active or idle */
+		io->sbp[21] = 0x50;	/* status: DRDY, DSC */
+		io->sb_len_wr = 22;
+		io->status = 0x02;	/* CHECK CONDITION */
+		io->driver_status = 0x08;	/* DRIVER_SENSE */
+		return 0;
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+#endif
+
+/* one of each command a polling agent sends, returns -1 if one failed */
+static int alloc_round( ATA *ata )
+{
+	struct ata_ident ident;
+	struct ata_smart smart;
+	enum ata_power_mode mode;
+
+	if (ata_checkpowermode(ata, &mode) || ata_ident(ata, &ident) ||
+	    ata_smart_read(ata, &smart) || ata_setapm(ata, 128) ||
+	    ata_setacoustic(ata, 1) || ata_setidletimer(ata, 20) ||
+	    ata_setstandbytimer(ata, 20) ||
+	    ata_setidletimer(ata, ATA_IDLEVAL_IMMEDIATE))
+		return -1;
+	return 0;
+}
+
+/* settle the device, then count what many more rounds allocate */
+static int alloc_device( const char *device )
+{
+	ATA *ata = NULL;
+	unsigned long before, after;
+	int i;
+
+	before = alloc_count;
+	if (ata_open(&ata, device) <= 0) {
+		printf("FAIL: can't open %s: %s\n", device, strerror(errno));
+		return 1;
+	}
+	/* opening allocates, so if nothing was counted malloc wasn't replaced */
+	if (alloc_count == before) {
+		printf("FAIL: allocations aren't being counted\n");
+		return 1;
+	}
+
+	for (i = 0; i < ALLOC_WARMUP; i++) {
+		if (alloc_round(ata)) {
+			printf("FAIL: %s: command failed: %s\n", device,
+			    strerror(errno));
+			return 1;
+		}
+	}
+
+	before = alloc_count;
+	for (i = 0; i < ALLOC_ROUNDS; i++) {
+		if (alloc_round(ata)) {
+			printf("FAIL: %s: command failed: %s\n", device,
+			    strerror(errno));
+			return 1;
+		}
+	}
+	after = alloc_count;
+	ata_close(&ata);
+
+	if (after != before) {
+		printf("FAIL: %s: %lu allocations in %d rounds of commands\n",
+		    device, after - before, ALLOC_ROUNDS);
+		return 1;
+	}
+	return 0;
+}
+
+int main( void )
+{
+#ifdef __linux__
+	if (alloc_device("/dev/null"))
+		return 1;
+#endif
+	if (alloc_device("sim:alloc"))
+		return 1;
+	printf("alloc: ok\n");
+	return 0;
+}
@@ -0,0 +1,98 @@
+/*-
+ *
+ * Copyright 2004-2008 Bruce Cran <bruce@cran.org.uk>. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * Standby timer encodings, run with "make test".  The count register
+ * values of ata_getidleval() are checked against the ATA definitions, and
+ * every timer --cycle-limit relaxes to must come out at least as long as
+ * the one asked for once encoded.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "../mi/atadefs.h"
+#include "../mi/cycles.h"
+#include "../mi/util.h"
+
+static const struct {
+	uint32_t	mins;
+	uint16_t	count;
+} timer_cases[] = {
+	{ 0, 0 }, { 1, 12 }, { 20, 240 }, { 21, 252 }, { 30, 241 },
+	{ 60, 242 }, { 330, 251 }
+};
+
+#define TIMER_NCASES	(sizeof(timer_cases) / sizeof(timer_cases[0]))
+
+static uint32_t	timer_secs( uint16_t count );
+
+/* the seconds a count register value stands for */
+static uint32_t timer_secs( uint16_t count )
+{
+	if (count <= 240)
+		return count * 5;
+	if (count <= 251)
+		return (count - 240) * 30 * 60;
+	return 21 * 60;
+}
+
+int main( void )
+{
+	uint16_t count, relaxed;
+	uint32_t mins;
+	unsigned int i;
+	int failed = 0;
+
+	for (i = 0; i < TIMER_NCASES; i++) {
+		if (ata_getidleval(timer_cases[i].mins, &count) ||
+		    count != timer_cases[i].count) {
+			printf("FAIL: %lu minutes encoded as %u, not %u\n",
+			    (unsigned long) timer_cases[i].mins, count,
+			    timer_cases[i].count);
+			failed++;
+		}
+	}
+
+	for (mins = 1; mins <= 330; mins++) {
+		if (ata_getidleval(mins, &count))
+			continue;
+		if (ata_getidleval(cycles_relax_standby(mins), &relaxed) ||
+		    timer_secs(relaxed) < timer_secs(count)) {
+			printf("FAIL: %lu minutes relaxed to %lu, count %u\n",
+			    (unsigned long) mins,
+			    (unsigned long) cycles_relax_standby(mins), relaxed);
+			failed++;
+		}
+	}
+
+	if (failed)
+		return 1;
+	printf("timer: ok\n");
+	return 0;
+}